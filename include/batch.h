@@ -0,0 +1,53 @@
+#define _XOPEN_SOURCE 700
+#define _FILE_OFFSET_BITS 64
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include <pthread.h>
+
+#include "pipeline.h"
+#include "fault.h"
+
+#define BATCH_JOBS 2
+
+struct batch_s;
+typedef error_state_t (*batch_job_t)(struct batch_s *batch, char *folder, void *opaque);
+
+typedef struct {
+    char *folder;
+    off_t size;
+    error_state_t result;
+
+} batch_item_t;
+
+// Folders are handed out largest first to a fixed pool of workers, so a huge
+// disc starts early instead of being the last thing left running. Jobs wrap
+// their disk heavy phases in batch_io_enter/leave to respect the I/O cap.
+typedef struct batch_s {
+    batch_item_t *items;
+    uint32_t count;
+    uint32_t next;
+    uint32_t finished;
+
+    int io_slots;
+    int io_busy;
+
+    batch_job_t job;
+    void *opaque;
+
+    pthread_mutex_t lock;
+    pthread_cond_t io_free;
+
+} batch_t;
+
+error_state_t batch_run(char **folders, uint32_t count, int jobs, int io_slots,
+                    batch_job_t job, void *opaque);
+void batch_io_enter(batch_t *batch);
+void batch_io_leave(batch_t *batch);
+
+#endif
@@ -0,0 +1,54 @@
+#define _XOPEN_SOURCE 700
+#define _FILE_OFFSET_BITS 64
+
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include <pthread.h>
+
+#include "viso.h"
+#include "fault.h"
+
+#define BCACHE_BLOCK_SIZE 0x40000
+#define BCACHE_BLOCKS 64
+#define BCACHE_READ_AHEAD 16
+
+enum block_state {BLOCK_EMPTY, BLOCK_LOADING, BLOCK_READY};
+
+typedef struct {
+    enum block_state state;
+    off_t index;
+    size_t length;
+    uint64_t last_use;
+    char *data;
+
+} cache_block_t;
+
+// Fixed size block cache over a virtual ISO. Sequential reads make a helper
+// thread fetch the blocks that follow before they are asked for.
+typedef struct {
+    viso_t *viso;
+    cache_block_t blocks[BCACHE_BLOCKS];
+    uint64_t clock;
+
+    off_t last_end;
+    off_t ahead_next;
+    off_t ahead_end;
+    bool stop;
+
+    pthread_t helper;
+    pthread_mutex_t lock;
+    pthread_cond_t loaded;
+    pthread_cond_t wanted;
+
+} bcache_t;
+
+error_state_t bcache_init(bcache_t *cache, viso_t *viso);
+error_state_t bcache_read(bcache_t *cache, char *buffer, off_t offset, size_t length, size_t *obtained);
+void bcache_free(bcache_t *cache);
+
+#endif
@@ -0,0 +1,77 @@
+#define _XOPEN_SOURCE 700
+#define _FILE_OFFSET_BITS 64
+
+#ifndef CSO_H
+#define CSO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include <stdio.h>
+#include <pthread.h>
+
+#include "pipeline.h"
+#include "fault.h"
+
+#define CSO_MAGIC "CISO"
+#define CSO_HEADER_SIZE 0x18
+#define CSO_BLOCK_SIZE 0x800
+#define CSO_BATCH_BLOCKS 0x100
+#define CSO_PLAIN_FLAG 0x80000000
+#define CSO_LEVEL 9
+
+enum batch_state {BATCH_FREE, BATCH_FILLED, BATCH_BUSY, BATCH_DONE};
+
+typedef struct {
+    enum batch_state state;
+    char *input;
+    size_t filled;
+
+    // Compressed blocks at fixed strides, sizes carry CSO_PLAIN_FLAG
+    char *output;
+    uint32_t sizes[CSO_BATCH_BLOCKS];
+
+} cso_batch_t;
+
+// Blocks are deflated on a worker pool in batches and written back in
+// order by whoever feeds the writer.
+typedef struct {
+    int fd;
+    FILE *stream;
+
+    off_t total_size;
+    uint32_t block_count;
+    uint8_t align;
+
+    uint32_t *index;
+    uint32_t next_block;
+    off_t position;
+    char *pack;
+
+    cso_batch_t *batches;
+    int depth;
+    uint64_t fill_seq;
+    uint64_t claim_seq;
+    uint64_t write_seq;
+
+    char zero_block[CSO_BLOCK_SIZE];
+    uint32_t zero_size;
+
+    pthread_t workers[MAX_THREADS];
+    int worker_count;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t done;
+    bool stop;
+    error_state_t error;
+
+} cso_writer_t;
+
+error_state_t cso_open(cso_writer_t **cso, const char *path, off_t total_size, int threads);
+FILE *cso_stream(cso_writer_t *cso);
+error_state_t cso_write(cso_writer_t *cso, const char *data, size_t length);
+error_state_t cso_finish(cso_writer_t *cso);
+void cso_free(cso_writer_t *cso);
+
+#endif
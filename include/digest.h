@@ -0,0 +1,36 @@
+#define _XOPEN_SOURCE 700
+#define _FILE_OFFSET_BITS 64
+
+#ifndef DIGEST_H
+#define DIGEST_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include <zlib.h>
+#include <mbedtls/md5.h>
+#include <mbedtls/sha1.h>
+
+#include "fault.h"
+
+typedef struct {
+    mbedtls_md5_context md5;
+    mbedtls_sha1_context sha1;
+    uLong crc;
+    off_t length;
+
+    uint8_t md5_sum[0x10];
+    uint8_t sha1_sum[0x14];
+
+} iso_digest_t;
+
+error_state_t digest_init(iso_digest_t *digest);
+error_state_t digest_update(iso_digest_t *digest, const char *data, size_t length);
+error_state_t digest_finish(iso_digest_t *digest);
+error_state_t write_digests(iso_digest_t *digest, const char *iso_path);
+void remove_digests(const char *iso_path);
+bool have_digests(const char *iso_path);
+void digest_free(iso_digest_t *digest);
+
+#endif
@@ -0,0 +1,33 @@
+#define _XOPEN_SOURCE 700
+#define _FILE_OFFSET_BITS 64
+
+#ifndef DIRECT_H
+#define DIRECT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "rebuild.h"
+#include "util.h"
+#include "fault.h"
+
+#define DIRECT_ALIGN 4096
+#define DIRECT_TRANSFER_SIZE 0x800000
+#define DIRECT_MAX_TRANSFER 0x40000000
+
+typedef struct {
+    int fd;
+    bool direct;
+    gap_mode_t gap_mode;
+
+    char *buffer;
+    size_t size;
+    size_t used;
+    off_t base;
+
+} direct_writer_t;
+
+error_state_t direct_rebuild(rebuild_job_t *job, char *output_path);
+
+#endif
@@ -37,6 +37,24 @@ typedef enum {
     PATH_BUFFER_ERROR,
     FILE_LIST_BUFFER_ERROR,
 
+    THREAD_ERROR,
+
+    URING_SETUP_ERROR,
+    URING_SUBMIT_ERROR,
+
+    SHA1_START_ERROR,
+    SHA1_UPDT_ERROR,
+    SHA1_END_ERROR,
+
+    REGION_TABLE_ERROR,
+    REGION_HASH_ERROR,
+
+    JOURNAL_ERROR,
+    MANIFEST_ERROR,
+    MOUNT_ERROR,
+    SOCKET_ERROR,
+    VERIFY_ERROR,
+
     ERROR_COUNT,
 
 } error_state_t;
@@ -0,0 +1,20 @@
+#define _XOPEN_SOURCE 700
+#define _FILE_OFFSET_BITS 64
+
+#ifndef FUSED_H
+#define FUSED_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "iso.h"
+#include "rebuild.h"
+#include "fault.h"
+
+error_state_t fused_begin(file_table_t *ft, const char *folder_path, bool *all_ok);
+error_state_t fused_update(dir_record_t *record, off_t offset, const char *data, size_t length);
+error_state_t fused_finish(file_table_t *ft, const char *folder_path, bool *all_ok);
+void fused_free(file_table_t *ft);
+
+#endif
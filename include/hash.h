@@ -0,0 +1,50 @@
+#define _XOPEN_SOURCE 700
+#define _FILE_OFFSET_BITS 64
+
+#ifndef HASH_H
+#define HASH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include <mbedtls/md5.h>
+
+#include "md5.h"
+#include "fault.h"
+
+#define HASH_BENCH_SIZE 0x100000
+#define HASH_BENCH_ROUNDS 8
+
+typedef enum {
+    HASH_AUTO,
+    HASH_MBEDTLS,
+    HASH_OPENSSL,
+    HASH_BUILTIN,
+
+} hash_backend_t;
+
+// One MD5 stream on whichever backend was selected
+typedef struct hash_md5_s {
+    hash_backend_t backend;
+
+    union {
+        mbedtls_md5_context mbedtls;
+        void *openssl;
+        md5_builtin_t builtin;
+    } ctx;
+
+} hash_md5_t;
+
+bool hash_available(hash_backend_t backend);
+const char *hash_name(hash_backend_t backend);
+error_state_t hash_select(hash_backend_t requested);
+hash_backend_t hash_backend(void);
+bool hash_lanes(void);
+
+error_state_t hash_md5_init(hash_md5_t *hash);
+error_state_t hash_md5_update(hash_md5_t *hash, const void *data, size_t length);
+error_state_t hash_md5_finish(hash_md5_t *hash, uint8_t *checksum);
+void hash_md5_free(hash_md5_t *hash);
+
+#endif
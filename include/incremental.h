@@ -0,0 +1,22 @@
+#define _XOPEN_SOURCE 700
+#define _FILE_OFFSET_BITS 64
+
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "iso.h"
+#include "rebuild.h"
+#include "manifest.h"
+#include "fault.h"
+
+#define PATCH_CHUNK_SIZE 0x100000
+
+error_state_t collect_changed(file_table_t *changed, file_table_t *ft,
+                    manifest_t *previous, manifest_t *current);
+error_state_t patch_extents(rebuild_job_t *job, file_table_t *changed, int iso_fd, off_t *written);
+
+#endif
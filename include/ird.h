@@ -9,6 +9,8 @@
 
 #include "iso.h"
 #include "util.h"
+#include "rebuild.h"
+#include "verify.h"
 #include "fault.h"
 
 #define MAGIC "3IRD"
@@ -75,8 +77,10 @@ typedef struct {
 } ird_t;
 
 error_state_t load_ird(ird_t *ird, const char *ird_path, const char *tmp_path);
+void free_ird(ird_t *ird);
 error_state_t print_iso_list(ird_t *ird);
-error_state_t print_verification(ird_t *ird, char *folder_path);
-error_state_t rebuild_iso(ird_t *ird, char *folder_path, char *output_path);
+error_state_t print_verification(ird_t *ird, char *folder_path, verify_opts_t *opts, bool *passed);
+error_state_t rebuild_iso(ird_t *ird, char *folder_path, char *output_path,
+                    rebuild_opts_t *opts, verify_opts_t *verify);
 
 #endif
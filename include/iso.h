@@ -8,15 +8,15 @@
 #include <sys/types.h>
 
 #include <stdio.h>
-#include <mbedtls/md5.h>
 
 #include "fault.h"
+#include "hash.h"
 
 #define MAX_FOLDERS 0x1000
 #define BP(a,b) [(b) - (a) + 1]
 
-enum file_state {EMPTY, MISSING, SZ_MISMATCH, MD5_MISMATCH, VERIFIED};
-extern const char *state_info[5];
+enum file_state {EMPTY, MISSING, SZ_MISMATCH, MD5_MISMATCH, VERIFIED, SAMPLED, PRESENT};
+extern const char *state_info[7];
 
 typedef struct {
     uint8_t vol_desc_type            BP(1, 1);
@@ -105,6 +105,9 @@ typedef struct dir_record_s {
     off_t file_offset;
     uint32_t block_offset;
 
+    // ft index of the file's last extent, kept on the lead by group_extents
+    uint32_t last_index;
+
     uint32_t extent_length;
     uint8_t record_length;
     off_t total_length;
@@ -115,7 +118,8 @@ typedef struct dir_record_s {
     char *file_id;
     uint8_t hash[0x10];
 
-    mbedtls_md5_context *ctx;
+    hash_md5_t *ctx;
+    off_t ctx_offset;
     enum file_state state;
 
 } dir_record_t;
@@ -150,8 +154,12 @@ uint32_t ecma_int32(uint8_t *iso_num);
 uint16_t ecma_int16(uint8_t *iso_num);
 
 error_state_t build_path(char *buffer, int buffer_size, dir_record_t *record);
+error_state_t build_full_path(char *buffer, int buffer_size,
+                    const char *folder_path, dir_record_t *record);
+off_t extent_position(dir_record_t *record, uint16_t block_size);
 error_state_t init_traverse(parse_info_t *info, 
                   const char *header_path, const char *footer_path);
+void free_traverse(parse_info_t *info);
 
 void sort_dir_list(dir_table_t *dir_list);
 void sort_file_list(file_table_t *file_list);
@@ -162,5 +170,7 @@ error_state_t build_file_list(file_table_t *table_wrapper, parse_info_t *info,
 
 void free_path_record(path_table_record_t *rec);
 void free_dir_record(dir_record_t *rec);
+void free_dir_list(dir_table_t *table_wrapper);
+void free_file_list(file_table_t *table_wrapper);
 
 #endif
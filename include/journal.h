@@ -0,0 +1,62 @@
+#define _XOPEN_SOURCE 700
+#define _FILE_OFFSET_BITS 64
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include <stdio.h>
+
+#include "digest.h"
+#include "region.h"
+#include "fault.h"
+
+#define JOURNAL_MAGIC "PS3RJNL"
+#define JOURNAL_INTERVAL 0x40000000
+
+typedef struct {
+    char magic[8];
+    uint32_t digest_size;
+    uint32_t context_size;
+
+    uint32_t uid;
+    uint32_t crc;
+    uint64_t total_size;
+    uint32_t record_count;
+
+    uint32_t record;
+    uint64_t offset;
+
+    uint8_t has_digest;
+    uint8_t has_regions;
+
+} journal_head_t;
+
+typedef struct {
+    const char *iso_path;
+    char *path;
+    char *tmp_path;
+
+    uint32_t uid;
+    uint32_t crc;
+    off_t total_size;
+    uint32_t record_count;
+
+    iso_digest_t *digest;
+    region_check_t *regions;
+
+    off_t last_offset;
+
+} journal_t;
+
+error_state_t journal_init(journal_t *journal, const char *iso_path, uint32_t uid, uint32_t crc,
+                    off_t total_size, uint32_t record_count);
+error_state_t journal_tick(journal_t *journal, FILE *iso_file, uint32_t record, off_t offset);
+error_state_t journal_load(journal_t *journal, uint32_t *record, off_t *offset);
+void journal_remove(journal_t *journal);
+void journal_free(journal_t *journal);
+
+#endif
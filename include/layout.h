@@ -0,0 +1,41 @@
+#define _XOPEN_SOURCE 700
+#define _FILE_OFFSET_BITS 64
+
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include <stdio.h>
+
+#include "iso.h"
+#include "fault.h"
+
+enum segment_kind {SEG_HEADER, SEG_GAP, SEG_EXTENT, SEG_FOOTER};
+
+typedef struct {
+    enum segment_kind kind;
+    off_t offset;
+    off_t length;
+
+    dir_record_t *record;
+
+} iso_segment_t;
+
+typedef struct {
+    iso_segment_t *segments;
+    uint32_t length;
+
+    off_t header_size;
+    off_t footer_offset;
+    off_t footer_size;
+    off_t total_size;
+
+} iso_layout_t;
+
+error_state_t build_layout(iso_layout_t *layout, parse_info_t *info, file_table_t *ft);
+void free_layout(iso_layout_t *layout);
+
+#endif
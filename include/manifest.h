@@ -0,0 +1,66 @@
+#define _XOPEN_SOURCE 700
+#define _FILE_OFFSET_BITS 64
+
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "iso.h"
+#include "fault.h"
+
+#define MANIFEST_MAGIC "PS3RMN2"
+
+typedef struct {
+    uint32_t record;
+    uint32_t block;
+
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    int64_t ctime_sec;
+    int64_t ctime_nsec;
+    uint64_t dev;
+    uint64_t ino;
+
+} manifest_entry_t;
+
+typedef struct {
+    char magic[8];
+
+    uint32_t uid;
+    uint32_t crc;
+    uint64_t total_size;
+    uint32_t record_count;
+    uint32_t entry_count;
+
+    // The ISO as it was left by the rebuild that saved the manifest
+    manifest_entry_t iso;
+
+} manifest_head_t;
+
+typedef struct {
+    char *path;
+    char *iso_path;
+
+    uint32_t uid;
+    uint32_t crc;
+    off_t total_size;
+    uint32_t record_count;
+
+    manifest_entry_t *entries;
+    uint32_t length;
+
+} manifest_t;
+
+error_state_t manifest_scan(manifest_t *manifest, file_table_t *ft, const char *folder_path,
+                    const char *iso_path, uint32_t uid, uint32_t crc, off_t total_size);
+error_state_t manifest_load(manifest_t *manifest, manifest_t *current);
+error_state_t manifest_save(manifest_t *manifest);
+bool manifest_changed(manifest_t *previous, manifest_t *current, uint32_t entry);
+void manifest_free(manifest_t *manifest);
+void manifest_remove(const char *iso_path);
+
+#endif
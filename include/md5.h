@@ -0,0 +1,115 @@
+#define _XOPEN_SOURCE 700
+#define _FILE_OFFSET_BITS 64
+
+#ifndef MD5_H
+#define MD5_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include <string.h>
+
+// The 64 steps of one MD5 block, written once for plain words and for the
+// vectors of the multi-buffer kernels
+#define MD5_OP_F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define MD5_OP_G(x, y, z) ((y) ^ ((z) & ((x) ^ (y))))
+#define MD5_OP_H(x, y, z) ((x) ^ (y) ^ (z))
+#define MD5_OP_I(x, y, z) ((y) ^ ((x) | ~(z)))
+#define MD5_ROTL(x, s) (((x) << (s)) | ((x) >> (32 - (s))))
+
+#define MD5_STEP(f, a, b, c, d, m, k, s) (a) = (b) + MD5_ROTL((a) + f((b), (c), (d)) + (m) + (k), (s))
+
+#define MD5_ROUNDS(a, b, c, d, m)                                   \
+    MD5_STEP(MD5_OP_F, a, b, c, d, m[0],  0xd76aa478, 7);           \
+    MD5_STEP(MD5_OP_F, d, a, b, c, m[1],  0xe8c7b756, 12);          \
+    MD5_STEP(MD5_OP_F, c, d, a, b, m[2],  0x242070db, 17);          \
+    MD5_STEP(MD5_OP_F, b, c, d, a, m[3],  0xc1bdceee, 22);          \
+    MD5_STEP(MD5_OP_F, a, b, c, d, m[4],  0xf57c0faf, 7);           \
+    MD5_STEP(MD5_OP_F, d, a, b, c, m[5],  0x4787c62a, 12);          \
+    MD5_STEP(MD5_OP_F, c, d, a, b, m[6],  0xa8304613, 17);          \
+    MD5_STEP(MD5_OP_F, b, c, d, a, m[7],  0xfd469501, 22);          \
+    MD5_STEP(MD5_OP_F, a, b, c, d, m[8],  0x698098d8, 7);           \
+    MD5_STEP(MD5_OP_F, d, a, b, c, m[9],  0x8b44f7af, 12);          \
+    MD5_STEP(MD5_OP_F, c, d, a, b, m[10], 0xffff5bb1, 17);          \
+    MD5_STEP(MD5_OP_F, b, c, d, a, m[11], 0x895cd7be, 22);          \
+    MD5_STEP(MD5_OP_F, a, b, c, d, m[12], 0x6b901122, 7);           \
+    MD5_STEP(MD5_OP_F, d, a, b, c, m[13], 0xfd987193, 12);          \
+    MD5_STEP(MD5_OP_F, c, d, a, b, m[14], 0xa679438e, 17);          \
+    MD5_STEP(MD5_OP_F, b, c, d, a, m[15], 0x49b40821, 22);          \
+    MD5_STEP(MD5_OP_G, a, b, c, d, m[1],  0xf61e2562, 5);           \
+    MD5_STEP(MD5_OP_G, d, a, b, c, m[6],  0xc040b340, 9);           \
+    MD5_STEP(MD5_OP_G, c, d, a, b, m[11], 0x265e5a51, 14);          \
+    MD5_STEP(MD5_OP_G, b, c, d, a, m[0],  0xe9b6c7aa, 20);          \
+    MD5_STEP(MD5_OP_G, a, b, c, d, m[5],  0xd62f105d, 5);           \
+    MD5_STEP(MD5_OP_G, d, a, b, c, m[10], 0x02441453, 9);           \
+    MD5_STEP(MD5_OP_G, c, d, a, b, m[15], 0xd8a1e681, 14);          \
+    MD5_STEP(MD5_OP_G, b, c, d, a, m[4],  0xe7d3fbc8, 20);          \
+    MD5_STEP(MD5_OP_G, a, b, c, d, m[9],  0x21e1cde6, 5);           \
+    MD5_STEP(MD5_OP_G, d, a, b, c, m[14], 0xc33707d6, 9);           \
+    MD5_STEP(MD5_OP_G, c, d, a, b, m[3],  0xf4d50d87, 14);          \
+    MD5_STEP(MD5_OP_G, b, c, d, a, m[8],  0x455a14ed, 20);          \
+    MD5_STEP(MD5_OP_G, a, b, c, d, m[13], 0xa9e3e905, 5);           \
+    MD5_STEP(MD5_OP_G, d, a, b, c, m[2],  0xfcefa3f8, 9);           \
+    MD5_STEP(MD5_OP_G, c, d, a, b, m[7],  0x676f02d9, 14);          \
+    MD5_STEP(MD5_OP_G, b, c, d, a, m[12], 0x8d2a4c8a, 20);          \
+    MD5_STEP(MD5_OP_H, a, b, c, d, m[5],  0xfffa3942, 4);           \
+    MD5_STEP(MD5_OP_H, d, a, b, c, m[8],  0x8771f681, 11);          \
+    MD5_STEP(MD5_OP_H, c, d, a, b, m[11], 0x6d9d6122, 16);          \
+    MD5_STEP(MD5_OP_H, b, c, d, a, m[14], 0xfde5380c, 23);          \
+    MD5_STEP(MD5_OP_H, a, b, c, d, m[1],  0xa4beea44, 4);           \
+    MD5_STEP(MD5_OP_H, d, a, b, c, m[4],  0x4bdecfa9, 11);          \
+    MD5_STEP(MD5_OP_H, c, d, a, b, m[7],  0xf6bb4b60, 16);          \
+    MD5_STEP(MD5_OP_H, b, c, d, a, m[10], 0xbebfbc70, 23);          \
+    MD5_STEP(MD5_OP_H, a, b, c, d, m[13], 0x289b7ec6, 4);           \
+    MD5_STEP(MD5_OP_H, d, a, b, c, m[0],  0xeaa127fa, 11);          \
+    MD5_STEP(MD5_OP_H, c, d, a, b, m[3],  0xd4ef3085, 16);          \
+    MD5_STEP(MD5_OP_H, b, c, d, a, m[6],  0x04881d05, 23);          \
+    MD5_STEP(MD5_OP_H, a, b, c, d, m[9],  0xd9d4d039, 4);           \
+    MD5_STEP(MD5_OP_H, d, a, b, c, m[12], 0xe6db99e5, 11);          \
+    MD5_STEP(MD5_OP_H, c, d, a, b, m[15], 0x1fa27cf8, 16);          \
+    MD5_STEP(MD5_OP_H, b, c, d, a, m[2],  0xc4ac5665, 23);          \
+    MD5_STEP(MD5_OP_I, a, b, c, d, m[0],  0xf4292244, 6);           \
+    MD5_STEP(MD5_OP_I, d, a, b, c, m[7],  0x432aff97, 10);          \
+    MD5_STEP(MD5_OP_I, c, d, a, b, m[14], 0xab9423a7, 15);          \
+    MD5_STEP(MD5_OP_I, b, c, d, a, m[5],  0xfc93a039, 21);          \
+    MD5_STEP(MD5_OP_I, a, b, c, d, m[12], 0x655b59c3, 6);           \
+    MD5_STEP(MD5_OP_I, d, a, b, c, m[3],  0x8f0ccc92, 10);          \
+    MD5_STEP(MD5_OP_I, c, d, a, b, m[10], 0xffeff47d, 15);          \
+    MD5_STEP(MD5_OP_I, b, c, d, a, m[1],  0x85845dd1, 21);          \
+    MD5_STEP(MD5_OP_I, a, b, c, d, m[8],  0x6fa87e4f, 6);           \
+    MD5_STEP(MD5_OP_I, d, a, b, c, m[15], 0xfe2ce6e0, 10);          \
+    MD5_STEP(MD5_OP_I, c, d, a, b, m[6],  0xa3014314, 15);          \
+    MD5_STEP(MD5_OP_I, b, c, d, a, m[13], 0x4e0811a1, 21);          \
+    MD5_STEP(MD5_OP_I, a, b, c, d, m[4],  0xf7537e82, 6);           \
+    MD5_STEP(MD5_OP_I, d, a, b, c, m[11], 0xbd3af235, 10);          \
+    MD5_STEP(MD5_OP_I, c, d, a, b, m[2],  0x2ad7d2bb, 15);          \
+    MD5_STEP(MD5_OP_I, b, c, d, a, m[9],  0xeb86d391, 21)
+
+static inline
+uint32_t load_le32(const uint8_t *data) {
+
+    uint32_t word;
+
+    memcpy(&word, data, sizeof(word));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word = __builtin_bswap32(word);
+#endif
+    return word;
+}
+
+typedef struct {
+    uint32_t state[4];
+    uint64_t length;
+
+    uint8_t buffer[64];
+    size_t filled;
+
+} md5_builtin_t;
+
+void md5_blocks(uint32_t *state, const uint8_t *data, size_t blocks);
+void md5_builtin_init(md5_builtin_t *ctx);
+void md5_builtin_update(md5_builtin_t *ctx, const uint8_t *data, size_t length);
+void md5_builtin_finish(md5_builtin_t *ctx, uint8_t *checksum);
+
+#endif
@@ -0,0 +1,67 @@
+#define _XOPEN_SOURCE 700
+#define _FILE_OFFSET_BITS 64
+
+#ifndef MD5MB_H
+#define MD5MB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "fault.h"
+
+#define MD5MB_MAX_LANES 16
+#define MD5MB_CHUNK_SIZE 0x10000
+
+// Hands out the next file for a free lane, *path = NULL once there is none
+typedef error_state_t (*md5mb_next_t)(void *opaque, const char **path, void **tag);
+typedef error_state_t (*md5mb_done_t)(void *opaque, void *tag, const uint8_t *checksum);
+
+// Asked between rounds, true drops the files still in flight unfinished
+typedef bool (*md5mb_stop_t)(void *opaque);
+
+typedef void (*md5mb_kernel_t)(uint32_t *state, const uint8_t **data, size_t blocks);
+
+typedef struct {
+    int fd;
+    void *tag;
+
+    // Always a whole number of blocks, the padding is added after the last read
+    uint8_t *buffer;
+    size_t filled;
+    size_t offset;
+
+    uint64_t length;
+    bool padded;
+    bool active;
+
+} md5mb_lane_t;
+
+// MD5 of several files at once, one per SIMD lane. A single stream can't go
+// faster than one block after the other, but the lanes run independent
+// streams side by side and a lane that finishes is refilled with the next
+// file right away.
+typedef struct {
+    int lanes;
+    md5mb_kernel_t kernel;
+
+    // Word major, state[word * lanes + lane]
+    uint32_t state[4 * MD5MB_MAX_LANES];
+    md5mb_lane_t lane[MD5MB_MAX_LANES];
+
+    // Fed to the lanes that have nothing left to hash
+    uint8_t *idle;
+
+    // Set once next has no more files to give
+    bool drained;
+
+} md5mb_t;
+
+int md5mb_lanes(void);
+error_state_t md5mb_init(md5mb_t *mb);
+error_state_t md5mb_run(md5mb_t *mb, md5mb_next_t next, md5mb_done_t done, md5mb_stop_t stop,
+                    void *opaque, void **failed);
+void md5mb_free(md5mb_t *mb);
+error_state_t md5mb_measure(double *rate);
+
+#endif
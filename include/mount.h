@@ -0,0 +1,13 @@
+#define _XOPEN_SOURCE 700
+#define _FILE_OFFSET_BITS 64
+
+#ifndef MOUNT_H
+#define MOUNT_H
+
+#include "ird.h"
+#include "fault.h"
+
+error_state_t mount_iso(ird_t *ird, char *folder_path, const char *mount_point,
+                    const char *iso_name);
+
+#endif
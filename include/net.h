@@ -11,6 +11,9 @@
 #define PUP_LINK "http://archive.midnightchannel.net"
 #define PUP_REQ "SonyPS/Firmware/?cat=CEX&disc=1&ver"
 
+error_state_t net_init(void);
+void net_cleanup(void);
+
 error_state_t download_ird(sfo_t *sfo, char *ird_path);
 error_state_t download_pup(sfo_t *sfo, char *pup_path);
 
@@ -0,0 +1,34 @@
+#define _XOPEN_SOURCE 700
+#define _FILE_OFFSET_BITS 64
+
+#ifndef NETSRV_H
+#define NETSRV_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "ird.h"
+#include "fault.h"
+
+#define NETSRV_PORT 38008
+#define NETSRV_MAX_READ 0x400000
+#define NETSRV_SECTOR_SIZE 0x800
+#define NETSRV_ISO_DIR "/PS3ISO"
+
+// Nanoseconds to wait after accept runs out of resources
+#define NETSRV_ACCEPT_BACKOFF 100000000
+
+// Subset of the ps3netsrv protocol a console needs to boot an ISO. Commands
+// are 16 bytes, every field is big endian.
+enum netsrv_opcode {
+    NETSRV_OPEN_FILE = 0x1224,
+    NETSRV_READ_FILE_CRITICAL = 0x1225,
+    NETSRV_READ_CD_2048 = 0x1226,
+    NETSRV_READ_FILE = 0x1227,
+    NETSRV_STAT_FILE = 0x1230,
+};
+
+error_state_t serve_iso(ird_t *ird, char *folder_path, uint16_t port, const char *iso_name);
+
+#endif
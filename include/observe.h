@@ -0,0 +1,35 @@
+#define _XOPEN_SOURCE 700
+#define _FILE_OFFSET_BITS 64
+
+#ifndef OBSERVE_H
+#define OBSERVE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "iso.h"
+#include "rebuild.h"
+#include "fault.h"
+
+#define OBSERVE_ZERO_SIZE 0x10000
+#define OBSERVE_READ_SIZE 0x100000
+
+typedef struct {
+    rebuild_job_t *job;
+    dir_record_t *record;
+    off_t offset;
+
+} observe_cursor_t;
+
+bool ordered_backend(rebuild_opts_t *opts);
+bool observing(rebuild_job_t *job);
+
+error_state_t observe_data(rebuild_job_t *job, const char *data, size_t length);
+error_state_t observe_gap(rebuild_job_t *job, off_t length);
+error_state_t observe_extent(rebuild_job_t *job, dir_record_t *record, off_t offset,
+                    const char *data, size_t length);
+error_state_t observe_tap(void *opaque, const char *data, size_t length);
+error_state_t observe_file(rebuild_job_t *job, const char *path);
+
+#endif
@@ -0,0 +1,73 @@
+#define _XOPEN_SOURCE 700
+#define _FILE_OFFSET_BITS 64
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include <stdio.h>
+#include <pthread.h>
+
+#include "iso.h"
+#include "rebuild.h"
+#include "fault.h"
+
+#define PIPE_CHUNK_SIZE 0x100000
+#define PIPE_QUEUE_DEPTH 32
+#define MAX_THREADS 64
+
+typedef struct {
+    uint32_t record;
+    off_t offset;
+
+    size_t length;
+    size_t filled;
+    bool ready;
+
+    char *buffer;
+
+} pipe_slot_t;
+
+typedef struct {
+    rebuild_job_t *job;
+
+    pthread_mutex_t lock;
+    pthread_cond_t slot_free;
+    pthread_cond_t slot_ready;
+
+    pipe_slot_t *slots;
+    uint32_t depth;
+
+    uint64_t claim_seq;
+    uint64_t write_seq;
+    uint64_t total_seq;
+
+    uint32_t claim_record;
+    off_t claim_offset;
+
+    error_state_t error;
+
+} pipeline_t;
+
+typedef struct {
+    rebuild_job_t *job;
+    int iso_fd;
+
+    pthread_mutex_t lock;
+    uint32_t claim_segment;
+    off_t claim_offset;
+
+    // Handed to every worker's zcopy_share
+    bool clone_off;
+
+    error_state_t error;
+
+} positional_t;
+
+error_state_t pipeline_copy(rebuild_job_t *job, FILE *iso_file);
+error_state_t pipeline_positional(rebuild_job_t *job, FILE *iso_file);
+
+#endif
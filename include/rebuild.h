@@ -0,0 +1,77 @@
+#define _XOPEN_SOURCE 700
+#define _FILE_OFFSET_BITS 64
+
+#ifndef REBUILD_H
+#define REBUILD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include <stdio.h>
+
+#include "iso.h"
+#include "layout.h"
+#include "digest.h"
+#include "region.h"
+#include "journal.h"
+#include "util.h"
+#include "fault.h"
+
+typedef enum {
+    IO_STDIO,
+    IO_URING,
+    IO_COPY,
+    IO_REFLINK,
+
+} io_backend_t;
+
+typedef struct {
+    int threads;
+    io_backend_t backend;
+    gap_mode_t gap_mode;
+    bool positional;
+
+    bool direct;
+    size_t transfer_size;
+
+    bool fused;
+    bool digests;
+    bool regions;
+    bool resume;
+    bool incremental;
+
+    // Strictly sequential output, stream_fd is used when the path is "-"
+    bool stream;
+    int stream_fd;
+
+    // Compressed output replaces the ISO when set, it implies stream
+    char *cso_path;
+
+    // Further copies of the ISO fed from the same pass, they imply stream
+    char **tee_paths;
+    int tee_count;
+
+} rebuild_opts_t;
+
+typedef struct {
+    parse_info_t *info;
+    file_table_t *ft;
+    iso_layout_t *layout;
+    char *folder_path;
+    uint16_t block_size;
+
+    rebuild_opts_t *opts;
+    iso_digest_t *digest;
+    region_check_t *regions;
+
+    journal_t *journal;
+    uint32_t first_record;
+    off_t resume_offset;
+
+    // Where the ordered writers pick up, they never ask the output
+    off_t start_offset;
+
+} rebuild_job_t;
+
+#endif
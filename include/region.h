@@ -0,0 +1,49 @@
+#define _XOPEN_SOURCE 700
+#define _FILE_OFFSET_BITS 64
+
+#ifndef REGION_H
+#define REGION_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include <stdio.h>
+#include <mbedtls/md5.h>
+
+#include "fault.h"
+
+#define REGION_READ_SIZE 0x100000
+
+enum region_state {REGION_PENDING, REGION_MATCH, REGION_MISMATCH, REGION_SKIPPED};
+
+typedef struct {
+    off_t start;
+    off_t end;
+    bool encrypted;
+
+    const uint8_t *hash;
+    enum region_state state;
+
+} region_t;
+
+typedef struct {
+    region_t *regions;
+    uint32_t count;
+    uint16_t block_size;
+
+    uint32_t current;
+    off_t position;
+    mbedtls_md5_context ctx;
+
+} region_check_t;
+
+error_state_t region_init(region_check_t *check, FILE *header, uint16_t block_size,
+                    const uint8_t *hashes, uint32_t hash_count);
+error_state_t region_update(region_check_t *check, const char *data, size_t length);
+error_state_t region_verify_span(region_check_t *check, int fd, off_t start, off_t end);
+void region_skip_pending(region_check_t *check);
+error_state_t region_report(region_check_t *check);
+void region_free(region_check_t *check);
+
+#endif
@@ -0,0 +1,46 @@
+#define _XOPEN_SOURCE 700
+#define _FILE_OFFSET_BITS 64
+
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include <stdio.h>
+
+#include "iso.h"
+#include "fault.h"
+
+#define SOURCE_MAX_OPEN 8
+
+typedef struct {
+    dir_record_t *lead;
+    FILE *file;
+
+    // Where the last read left the file, a following extent there needs no seek
+    off_t position;
+
+} source_file_t;
+
+// Source files for the writers that walk ft in ISO order. A file is opened
+// at its first extent and stays open until its last one, even with other
+// files placed between its extents.
+typedef struct {
+    file_table_t *ft;
+    const char *folder_path;
+    char *path;
+
+    source_file_t files[SOURCE_MAX_OPEN];
+
+} source_cache_t;
+
+void group_extents(file_table_t *ft);
+
+error_state_t source_init(source_cache_t *cache, file_table_t *ft, const char *folder_path);
+error_state_t source_get(source_cache_t *cache, uint32_t index, FILE **file);
+void source_done(source_cache_t *cache, uint32_t index, off_t consumed);
+void source_free(source_cache_t *cache);
+
+#endif
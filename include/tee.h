@@ -0,0 +1,67 @@
+#define _XOPEN_SOURCE 700
+#define _FILE_OFFSET_BITS 64
+
+#ifndef TEE_H
+#define TEE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include <stdio.h>
+#include <pthread.h>
+
+#include "fault.h"
+
+#define TEE_CHUNK_SIZE 0x400000
+#define TEE_DEPTH 16
+#define TEE_MAX_TARGETS 8
+
+typedef struct {
+    char *data;
+    size_t filled;
+
+    // Targets that still have to write it before the slot is reused
+    int pending;
+
+} tee_chunk_t;
+
+struct tee_writer_s;
+
+typedef struct {
+    struct tee_writer_s *tee;
+    int fd;
+    uint64_t write_seq;
+    error_state_t error;
+
+    pthread_t thread;
+
+} tee_target_t;
+
+// One ordered stream copied into several files. Every target has its own
+// writer thread going through the shared chunk ring at its own pace, the
+// feeder only waits once the slowest one is a whole ring behind.
+typedef struct tee_writer_s {
+    FILE *stream;
+
+    tee_chunk_t chunks[TEE_DEPTH];
+    uint64_t fill_seq;
+
+    tee_target_t targets[TEE_MAX_TARGETS];
+    int target_count;
+    int started;
+
+    pthread_mutex_t lock;
+    pthread_cond_t filled;
+    pthread_cond_t freed;
+    bool stop;
+
+} tee_writer_t;
+
+error_state_t tee_open(tee_writer_t **tee, char **paths, int count);
+FILE *tee_stream(tee_writer_t *tee);
+error_state_t tee_write(tee_writer_t *tee, const char *data, size_t length);
+error_state_t tee_finish(tee_writer_t *tee);
+void tee_free(tee_writer_t *tee);
+
+#endif
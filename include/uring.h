@@ -0,0 +1,54 @@
+#define _XOPEN_SOURCE 700
+#define _FILE_OFFSET_BITS 64
+
+#ifndef URING_H
+#define URING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include <stdio.h>
+#include <linux/io_uring.h>
+
+#include "rebuild.h"
+#include "fault.h"
+
+#define URING_CHUNK_SIZE 0x100000
+#define URING_QUEUE_DEPTH 32
+
+typedef struct {
+    int fd;
+    unsigned entries;
+
+    void *sq_ptr;
+    void *cq_ptr;
+    size_t sq_size;
+    size_t cq_size;
+
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned sq_pending;
+
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+
+} uring_t;
+
+error_state_t uring_init(uring_t *ring, unsigned entries);
+void uring_free(uring_t *ring);
+
+struct io_uring_sqe *uring_get_sqe(uring_t *ring);
+error_state_t uring_submit(uring_t *ring, unsigned wait_count);
+struct io_uring_cqe *uring_peek_cqe(uring_t *ring);
+void uring_cqe_seen(uring_t *ring);
+
+error_state_t uring_copy(rebuild_job_t *job, FILE *iso_file);
+
+#endif
@@ -24,6 +24,17 @@
 
 #define MAX_PATH_LEN 4096
 #define BUFF_SIFE 4096
+#define ZERO_BUFF_SIZE 0x100000
+#define CHECKSUM_BUFF_SIZE 0x100000
+
+typedef enum {
+    GAP_SPARSE,
+    GAP_ZERO,
+    GAP_RESERVE,
+
+} gap_mode_t;
+
+typedef error_state_t (*data_tap_t)(void *opaque, const char *data, size_t length);
 
 typedef struct {
     char *memory;
@@ -41,7 +52,13 @@ error_state_t utf16_to_utf8(uint16_t *stw, uint8_t *stb);
 error_state_t calc_checksum(uint8_t *checksum, char *file_path);
 
 error_state_t zero_out_file(FILE *in_file, off_t size);
+error_state_t zero_out_fd(int fd, off_t offset, off_t size);
+error_state_t write_fd_full(int fd, const void *buffer, size_t size, off_t offset);
+error_state_t fill_gap_file(FILE *out_file, off_t size, gap_mode_t mode);
+error_state_t fill_gap_fd(int fd, off_t offset, off_t size, gap_mode_t mode);
 error_state_t write_file_to_file(FILE *in_file, FILE *out_file, off_t size, off_t *total_written);
+error_state_t tap_file_to_file(FILE *in_file, FILE *out_file, off_t size, off_t *total_written,
+                    data_tap_t tap, void *opaque);
 error_state_t decompress_to_path(gzFile in_file, char *out_path, off_t size, off_t *total_written);
 
 int64_t min(int64_t a, int64_t b);
@@ -0,0 +1,87 @@
+#define _XOPEN_SOURCE 700
+#define _FILE_OFFSET_BITS 64
+
+#ifndef VCACHE_H
+#define VCACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include <sys/stat.h>
+#include <pthread.h>
+
+#include "fault.h"
+
+#define VCACHE_MAGIC "PS3RVFY"
+
+// Anything that changes a file's content changes at least its ctime
+typedef struct {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime_ns;
+    int64_t ctime_ns;
+
+} vcache_key_t;
+
+typedef struct {
+    vcache_key_t key;
+    uint8_t hash[0x10];
+
+    // MD5 of the blocks a sampled check reads, all zero when none was taken
+    uint8_t sample[0x10];
+
+    // The IRD the file was last checked against and the JB folder it was in
+    uint32_t uid;
+    uint32_t crc;
+    uint64_t folder_dev;
+    uint64_t folder_ino;
+
+} vcache_entry_t;
+
+typedef struct {
+    char magic[8];
+    uint32_t entry_size;
+    uint32_t count;
+
+} vcache_head_t;
+
+// MD5s of files that were already read once, so a file that hasn't been
+// touched since is accepted without reading it again. The index on disk is
+// sorted by device and inode and is shared by every disc of a library.
+typedef struct {
+    const char *path;
+    char *tmp_path;
+    char *lock_path;
+
+    uint32_t uid;
+    uint32_t crc;
+    uint64_t folder_dev;
+    uint64_t folder_ino;
+
+    // As loaded, never changed while files are checked
+    vcache_entry_t *entries;
+    uint32_t count;
+
+    // Every file of this run with a known MD5, written back by vcache_save
+    vcache_entry_t *fresh;
+    uint32_t fresh_count;
+    uint32_t fresh_size;
+    uint32_t hits;
+
+    pthread_mutex_t lock;
+
+} vcache_t;
+
+error_state_t vcache_init(vcache_t *cache, const char *path, uint32_t uid, uint32_t crc,
+                    const char *folder_path);
+void vcache_key(vcache_key_t *key, const struct stat *st);
+bool vcache_lookup(vcache_t *cache, const vcache_key_t *key, uint8_t *hash);
+bool vcache_reference(vcache_t *cache, const vcache_key_t *key, uint8_t *hash, uint8_t *sample);
+error_state_t vcache_store(vcache_t *cache, const vcache_key_t *key, const uint8_t *hash,
+                    const uint8_t *sample);
+error_state_t vcache_save(vcache_t *cache, bool complete);
+void vcache_free(vcache_t *cache);
+
+#endif
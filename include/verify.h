@@ -0,0 +1,86 @@
+#define _XOPEN_SOURCE 700
+#define _FILE_OFFSET_BITS 64
+
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include <pthread.h>
+
+#include "iso.h"
+#include "md5mb.h"
+#include "vcache.h"
+#include "pipeline.h"
+#include "fault.h"
+
+#define VERIFY_SAMPLES 8
+#define VERIFY_SAMPLE_SIZE 0x10000
+
+// How deep files are looked at, from a stat up to every byte. Sampling
+// reads a few blocks spread over each large file, smaller ones are hashed
+// whole since that costs about the same.
+typedef enum {
+    VERIFY_FULL,
+    VERIFY_SAMPLE,
+    VERIFY_SIZE,
+
+} verify_mode_t;
+
+typedef struct {
+    int threads;
+    verify_mode_t mode;
+
+    // Stop at the first file with a problem, the rest stays unchecked
+    bool fail_fast;
+
+    const char *cache_path;
+
+} verify_opts_t;
+
+typedef struct {
+    dir_record_t *lead;
+
+    // What the file looked like when it was checked
+    vcache_key_t key;
+
+} verify_item_t;
+
+// Files are handed out largest first so one big file doesn't end up alone at
+// the tail. Each worker only writes the state of the files it took, so the
+// results don't depend on scheduling.
+typedef struct {
+    verify_item_t *items;
+    uint32_t count;
+    uint32_t next;
+
+    const char *folder_path;
+    vcache_t *cache;
+    verify_mode_t mode;
+    bool fail_fast;
+    bool halted;
+
+    // The failure of the lowest ft entry wins, whatever order they came in
+    error_state_t error;
+    dir_record_t *failed;
+    bool stop;
+
+    pthread_mutex_t lock;
+
+} verify_pool_t;
+
+typedef struct {
+    verify_pool_t *pool;
+    char *full_path;
+    md5mb_t mb;
+
+} verify_worker_t;
+
+int verify_threads(int requested);
+bool verify_passed(enum file_state state);
+error_state_t verify_files(file_table_t *ft, const char *folder_path, verify_opts_t *opts, vcache_t *cache,
+                    bool *verified, bool *complete);
+
+#endif
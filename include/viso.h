@@ -0,0 +1,53 @@
+#define _XOPEN_SOURCE 700
+#define _FILE_OFFSET_BITS 64
+
+#ifndef VISO_H
+#define VISO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include <pthread.h>
+
+#include "iso.h"
+#include "ird.h"
+#include "layout.h"
+#include "fault.h"
+
+#define VISO_HANDLES 32
+
+typedef struct {
+    dir_record_t *lead;
+    int fd;
+    uint32_t users;
+    uint64_t last_use;
+
+} viso_handle_t;
+
+// The ISO a rebuild would produce, answered from the folder on demand. The
+// blobs stay in memory and source files stay open in a small LRU.
+typedef struct {
+    parse_info_t info;
+    dir_table_t dt;
+    file_table_t ft;
+    iso_layout_t layout;
+
+    char *folder_path;
+    uint16_t block_size;
+
+    char *header;
+    char *footer;
+
+    viso_handle_t handles[VISO_HANDLES];
+    uint64_t clock;
+    pthread_mutex_t lock;
+
+} viso_t;
+
+error_state_t viso_open(viso_t **viso, ird_t *ird, char *folder_path);
+error_state_t viso_pread(viso_t *viso, void *buffer, size_t length, off_t offset, size_t *obtained);
+off_t viso_size(viso_t *viso);
+void viso_close(viso_t *viso);
+
+#endif
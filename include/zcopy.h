@@ -0,0 +1,41 @@
+#define _XOPEN_SOURCE 700
+#define _FILE_OFFSET_BITS 64
+
+#ifndef ZCOPY_H
+#define ZCOPY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include <stdio.h>
+
+#include "rebuild.h"
+#include "fault.h"
+
+#define ZCOPY_CHUNK_SIZE 0x1000000
+#define ZCOPY_PIPE_SIZE 0x100000
+
+typedef struct {
+    int pipe_fds[2];
+    bool use_splice;
+
+    // Output block size while extents are shared through reflinks, else 0
+    off_t clone_size;
+    off_t cloned;
+
+    // Shared by every writer of the same output, set once reflinks fail
+    bool *clone_off;
+
+} zcopy_t;
+
+void zcopy_init(zcopy_t *zc);
+void zcopy_free(zcopy_t *zc);
+void zcopy_share(zcopy_t *zc, int out_fd, bool *clone_off);
+
+error_state_t zcopy_range(zcopy_t *zc, int in_fd, off_t in_offset,
+                    int out_fd, off_t out_offset, off_t size, off_t *total_written);
+error_state_t zcopy_blob(FILE *blob, FILE *iso_file);
+error_state_t zcopy_copy(rebuild_job_t *job, FILE *iso_file);
+
+#endif
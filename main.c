@@ -4,6 +4,9 @@
 #include <assert.h>
 #include <argp.h>
 #include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
 
 #include "cwalk.h"
 #include "util.h"
@@ -12,20 +15,83 @@
 #include "sfo.h"
 #include "net.h"
 #include "fault.h"
+#include "rebuild.h"
+#include "pipeline.h"
+#include "direct.h"
+#include "mount.h"
+#include "netsrv.h"
+#include "batch.h"
+#include "tee.h"
+#include "hash.h"
+
+enum long_keys {
+    OPT_IO = 0x100,
+    OPT_GAPS,
+    OPT_POSITIONAL,
+    OPT_DIRECT,
+    OPT_TRANSFER,
+    OPT_FUSED,
+    OPT_DIGESTS,
+    OPT_REGIONS,
+    OPT_RESUME,
+    OPT_INCREMENTAL,
+    OPT_STREAM,
+    OPT_MOUNT,
+    OPT_SERVE,
+    OPT_CSO,
+    OPT_JOBS,
+    OPT_IO_SLOTS,
+    OPT_TEE,
+    OPT_VERIFY_THREADS,
+    OPT_VERIFY_CACHE,
+    OPT_VERIFY,
+    OPT_FAIL_FAST,
+    OPT_CHECK,
+    OPT_HASH,
+};
 
 struct values {
     char *ird_path;
     char *file_name;
 
-    char *in_dir;
+    char **in_dirs;
+    uint32_t in_count;
     char *out_dir;
 
     bool get_pup;
+    int threads;
+    io_backend_t backend;
+    gap_mode_t gap_mode;
+    bool positional;
+    bool direct;
+    long transfer_size;
+    bool fused;
+    bool digests;
+    bool regions;
+    bool resume;
+    bool incremental;
+    bool stream;
+    char *mount_point;
+    long serve_port;
+    bool cso;
+    char *tee_dirs[TEE_MAX_TARGETS];
+    int tee_count;
+    int stream_fd;
+    int jobs;
+    int io_slots;
+    int verify_threads;
+    char *verify_cache;
+    verify_mode_t verify_mode;
+    bool fail_fast;
+    bool check;
+    hash_backend_t hash;
 };
 
 static int parse_opt (int key, char *arg, struct argp_state *state) {
     struct values *vals = (struct values *) state->input;
     struct stat sb;
+    char *end;
+    long mib;
     switch (key) {
         case 'f':
             if (vals->file_name != NULL)
@@ -50,68 +116,238 @@ static int parse_opt (int key, char *arg, struct argp_state *state) {
             cwk_path_normalize(arg, vals->ird_path, 0x420);
             if (stat(vals->ird_path, &sb) != 0)
                 argp_failure(state, 1, 0, "Can't open ird file");
-            if (!S_ISDIR(sb.st_mode))
-                argp_failure(state, 1, 0, "IRD file is not a folder");
+            if (S_ISDIR(sb.st_mode))
+                argp_failure(state, 1, 0, "IRD path is a folder");
             break;
         case 'p':
             vals->get_pup = true;
             break;
+        case 'j':
+            vals->threads = strtol(arg, &end, 10);
+            if (*arg == '\0' || *end != '\0' || vals->threads < 0 || vals->threads > MAX_THREADS)
+                argp_failure(state, 1, 0, "Invalid thread count");
+            break;
+        case OPT_IO:
+            if (strcmp(arg, "stdio") == 0)
+                vals->backend = IO_STDIO;
+            else if (strcmp(arg, "uring") == 0)
+                vals->backend = IO_URING;
+            else if (strcmp(arg, "copy") == 0)
+                vals->backend = IO_COPY;
+            else if (strcmp(arg, "reflink") == 0)
+                vals->backend = IO_REFLINK;
+            else
+                argp_failure(state, 1, 0, "Unknown I/O backend");
+            break;
+        case OPT_GAPS:
+            if (strcmp(arg, "sparse") == 0)
+                vals->gap_mode = GAP_SPARSE;
+            else if (strcmp(arg, "zero") == 0)
+                vals->gap_mode = GAP_ZERO;
+            else if (strcmp(arg, "reserve") == 0)
+                vals->gap_mode = GAP_RESERVE;
+            else
+                argp_failure(state, 1, 0, "Unknown gap mode");
+            break;
+        case OPT_POSITIONAL:
+            vals->positional = true;
+            break;
+        case OPT_DIRECT:
+            vals->direct = true;
+            break;
+        case OPT_FUSED:
+            vals->fused = true;
+            break;
+        case OPT_DIGESTS:
+            vals->digests = true;
+            break;
+        case OPT_REGIONS:
+            vals->regions = true;
+            break;
+        case OPT_RESUME:
+            vals->resume = true;
+            break;
+        case OPT_INCREMENTAL:
+            vals->incremental = true;
+            break;
+        case OPT_STREAM:
+            vals->stream = true;
+            break;
+        case OPT_MOUNT:
+            vals->mount_point = malloc(0x420);
+            cwk_path_normalize(arg, vals->mount_point, 0x420);
+            if (stat(vals->mount_point, &sb) != 0 || !S_ISDIR(sb.st_mode))
+                argp_failure(state, 1, 0, "Mount point is not a folder");
+            break;
+        case OPT_CSO:
+            vals->cso = true;
+            vals->stream = true;
+            break;
+        case OPT_TEE:
+            if (vals->tee_count + 1 >= TEE_MAX_TARGETS)
+                argp_failure(state, 1, 0, "At most %d --tee folders can be used", TEE_MAX_TARGETS - 1);
+            vals->tee_dirs[vals->tee_count] = malloc(0x420);
+            cwk_path_normalize(arg, vals->tee_dirs[vals->tee_count], 0x420);
+            if (stat(vals->tee_dirs[vals->tee_count], &sb) != 0 || !S_ISDIR(sb.st_mode))
+                argp_failure(state, 1, 0, "Tee path %s is not a folder", arg);
+            vals->tee_count += 1;
+            vals->stream = true;
+            break;
+        case OPT_SERVE:
+            vals->serve_port = NETSRV_PORT;
+            if (arg != NULL) {
+                vals->serve_port = strtol(arg, &end, 10);
+                if (*arg == '\0' || *end != '\0' || vals->serve_port <= 0 || vals->serve_port > 0xFFFF)
+                    argp_failure(state, 1, 0, "Invalid port");
+            }
+            break;
+        case OPT_JOBS:
+            vals->jobs = strtol(arg, &end, 10);
+            if (*arg == '\0' || *end != '\0' || vals->jobs <= 0 || vals->jobs > MAX_THREADS)
+                argp_failure(state, 1, 0, "Invalid job count");
+            break;
+        case OPT_IO_SLOTS:
+            vals->io_slots = strtol(arg, &end, 10);
+            if (*arg == '\0' || *end != '\0' || vals->io_slots <= 0 || vals->io_slots > MAX_THREADS)
+                argp_failure(state, 1, 0, "Invalid I/O slot count");
+            break;
+        case OPT_VERIFY_THREADS:
+            vals->verify_threads = strtol(arg, &end, 10);
+            if (*arg == '\0' || *end != '\0' || vals->verify_threads <= 0 || vals->verify_threads > MAX_THREADS)
+                argp_failure(state, 1, 0, "Invalid verification thread count");
+            break;
+        case OPT_VERIFY:
+            if (strcmp(arg, "full") == 0)
+                vals->verify_mode = VERIFY_FULL;
+            else if (strcmp(arg, "sample") == 0)
+                vals->verify_mode = VERIFY_SAMPLE;
+            else if (strcmp(arg, "size") == 0)
+                vals->verify_mode = VERIFY_SIZE;
+            else
+                argp_failure(state, 1, 0, "Unknown verification mode");
+            break;
+        case OPT_FAIL_FAST:
+            vals->fail_fast = true;
+            break;
+        case OPT_CHECK:
+            vals->check = true;
+            break;
+        case OPT_HASH:
+            if (strcmp(arg, "auto") == 0)
+                vals->hash = HASH_AUTO;
+            else if (strcmp(arg, "mbedtls") == 0)
+                vals->hash = HASH_MBEDTLS;
+            else if (strcmp(arg, "openssl") == 0)
+                vals->hash = HASH_OPENSSL;
+            else if (strcmp(arg, "builtin") == 0)
+                vals->hash = HASH_BUILTIN;
+            else
+                argp_failure(state, 1, 0, "Unknown MD5 backend");
+            if (!hash_available(vals->hash))
+                argp_failure(state, 1, 0, "This build has no OpenSSL support");
+            break;
+        case OPT_VERIFY_CACHE:
+            if (vals->verify_cache != NULL)
+                argp_failure(state, 1, 0, "Only one verification cache can be used");
+            vals->verify_cache = malloc(MAX_PATH_LEN);
+            cwk_path_normalize(arg, vals->verify_cache, MAX_PATH_LEN);
+            break;
+        case OPT_TRANSFER:
+            errno = 0;
+            mib = strtol(arg, &end, 10);
+            if (*arg == '\0' || *end != '\0' || errno != 0 || mib < 1 ||
+                    mib > DIRECT_MAX_TRANSFER / 0x100000)
+                argp_failure(state, 1, 0, "Invalid transfer size");
+            vals->transfer_size = mib * 0x100000;
+            break;
 
-        case ARGP_KEY_ARG:            
-            if (vals->in_dir != NULL)
-                argp_failure(state, 1, 0, "Too many arguments");
-            vals->in_dir = malloc(0x420);
-            cwk_path_normalize(arg, vals->in_dir, 0x420);
-            if (stat(vals->in_dir, &sb) != 0)
-                argp_failure(state, 1, 0, "Can't open supplied input folder");
+        case ARGP_KEY_ARG:
+            vals->in_dirs = realloc(vals->in_dirs, sizeof(*vals->in_dirs) * (vals->in_count + 1));
+            vals->in_dirs[vals->in_count] = malloc(MAX_PATH_LEN);
+            cwk_path_normalize(arg, vals->in_dirs[vals->in_count], MAX_PATH_LEN);
+            if (stat(vals->in_dirs[vals->in_count], &sb) != 0)
+                argp_failure(state, 1, 0, "Can't open supplied input folder %s", arg);
             if (!S_ISDIR(sb.st_mode))
-                argp_failure(state, 1, 0, "Input path is not a folder");
+                argp_failure(state, 1, 0, "Input path %s is not a folder", arg);
+            vals->in_count += 1;
             break;
         case ARGP_KEY_END:
-            if (vals->in_dir == NULL)
+            if (vals->in_count == 0)
                 argp_failure(state, 1, 0, "No JB folder was supplied to rebuild");
+            if (vals->in_count > 1 && (vals->file_name != NULL || vals->ird_path != NULL))
+                argp_failure(state, 1, 0, "-f and -r name a single disc, they can't be used with several folders");
+            if (vals->in_count > 1 && (vals->mount_point != NULL || vals->serve_port != 0))
+                argp_failure(state, 1, 0, "Several folders can only be rebuilt into files, not mounted or served");
+            if (vals->fused && (vals->backend != IO_STDIO || vals->positional))
+                argp_failure(state, 1, 0, "--fused needs in-order data, it can't be combined with --io or --positional");
+            if (vals->fused && vals->verify_cache != NULL)
+                argp_failure(state, 1, 0, "--verify-cache only applies to the separate verification pass, not --fused");
+            if (vals->fused && (vals->verify_mode != VERIFY_FULL || vals->fail_fast || vals->check))
+                argp_failure(state, 1, 0, "--fused checks every byte while rebuilding, it takes no other verification options");
+            if (vals->check && (vals->mount_point != NULL || vals->serve_port != 0))
+                argp_failure(state, 1, 0, "--check only verifies, it can't be combined with --mount or --serve");
+            if (vals->resume && (vals->backend != IO_STDIO || vals->positional || vals->direct))
+                argp_failure(state, 1, 0, "--resume only works with the sequential and pipelined (-j) engines");
+            if (vals->resume && vals->incremental)
+                argp_failure(state, 1, 0, "--resume and --incremental can't be combined");
+            if (vals->file_name != NULL && strcmp(vals->file_name, "-") == 0) {
+                if (vals->cso)
+                    argp_failure(state, 1, 0, "--cso writes a file, it can't go to stdout");
+                if (vals->tee_count > 0)
+                    argp_failure(state, 1, 0, "--tee writes files, the ISO can't also go to stdout");
+                vals->stream = true;
+            }
+            if (vals->tee_count > 0 && vals->cso)
+                argp_failure(state, 1, 0, "--tee and --cso can't be combined");
+            if (vals->tee_count > 0 && (vals->backend != IO_STDIO || vals->positional || vals->direct))
+                argp_failure(state, 1, 0, "--tee only works with the sequential and pipelined (-j) engines");
+            if (vals->stream && (vals->backend != IO_STDIO || vals->positional || vals->direct))
+                argp_failure(state, 1, 0, "Streaming only works with the sequential and pipelined (-j) engines");
+            if (vals->stream && (vals->resume || vals->incremental))
+                argp_failure(state, 1, 0, "A streamed ISO can't be resumed or updated in place");
+            if (vals->mount_point != NULL && vals->stream)
+                argp_failure(state, 1, 0, "--mount doesn't write an ISO, it can't be streamed");
+            if (vals->serve_port != 0 && (vals->mount_point != NULL || vals->stream))
+                argp_failure(state, 1, 0, "--serve can't be combined with --mount or streaming");
             break;
     }
     return 0;
 }
 
-int main (int argc, char** argv) {
+// Everything from one JB folder to its ISO. Batch mode runs this on its
+// workers, so paths that depend on the disc are worked out here per call.
+static
+error_state_t rebuild_folder(batch_t *batch, char *in_dir, void *opaque) {
+
     error_state_t ret_val;
-    char *sfo_path, *pup_path, *tmp_path, *iso_path, *err_msg;
+    struct values *vals = opaque;
+    char *sfo_path, *pup_path, *tmp_path, *iso_path, *ird_path, *file_name;
 
     struct stat st = {0};
     sfo_t sfo;
     ird_t ird;
+    rebuild_opts_t opts = {0};
+    verify_opts_t verify = {0};
+    bool passed;
 
-    struct argp_option options[] = {
-        { "filename", 'f', "NAME", 0, "Set filename for ISO"},
-        { "output", 'o', "OUT_PATH", 0, "Set output folder"},
-        { "ird", 'r', "IRD_PATH", 0, "Manually supply IRD file"},
-        { "pup", 'p', 0, 0, "Download/replace PUP file from online archive"},
-        {0}
-    };
-    struct values vals = {NULL, NULL};
-    struct argp argp = { options, parse_opt, "JB_FOLDER", "Rebuild JB Folder dumps into proper ISOs" };
-
-    argp_parse(&argp, argc, argv, 0, 0, &vals);
-    cwk_path_normalize(vals.in_dir, vals.in_dir, MAX_PATH_LEN);
+    sfo_path = pup_path = tmp_path = iso_path = ird_path = file_name = NULL;
 
     sfo_path = malloc(MAX_PATH_LEN);
     if (sfo_path == NULL) {
         ret_val = ALLOC_ERROR;
-        goto exec_error;
+        goto exit_paths;
     }
-    snprintf(sfo_path, MAX_PATH_LEN, "%s/%s", vals.in_dir, SFO_REL_PATH);
+    snprintf(sfo_path, MAX_PATH_LEN, "%s/%s", in_dir, SFO_REL_PATH);
 
     ret_val = load_sfo(&sfo, sfo_path);
     if (ret_val != EXIT_OK) {
-        goto exec_error;
+        goto exit_paths;
     }
 
     tmp_path = malloc(MAX_PATH_LEN);
     if (tmp_path == NULL) {
         ret_val = ALLOC_ERROR;
-        goto exec_error;
+        goto exit_paths;
     }
     snprintf(tmp_path, MAX_PATH_LEN, "%s/%08X", TMP_DIR, sfo.mgz_sig);
 
@@ -123,75 +359,319 @@ int main (int argc, char** argv) {
         mkdir(tmp_path, 0700);
     }
 
-    if (vals.out_dir == NULL) {
-        vals.out_dir = malloc(MAX_PATH_LEN);
-        getcwd(vals.out_dir, MAX_PATH_LEN);
-        cwk_path_normalize(vals.out_dir, vals.out_dir, MAX_PATH_LEN);
+    file_name = malloc(MAX_PATH_LEN);
+    if (file_name == NULL) {
+        ret_val = ALLOC_ERROR;
+        goto exit_paths;
     }
 
-    if (vals.file_name == NULL) {
-
-        vals.file_name = malloc(15);
-        memcpy(vals.file_name, sfo.title_id, 4);
+    if (vals->file_name != NULL) {
+        snprintf(file_name, MAX_PATH_LEN, "%s", vals->file_name);
+    } else {
+        memcpy(file_name, sfo.title_id, 4);
 
-        vals.file_name[4] = '-';
-        memcpy(vals.file_name+5, sfo.title_id+4, 5);
-        memcpy(vals.file_name+10, ".iso", 4);
-        vals.file_name[14] = '\0';
+        file_name[4] = '-';
+        memcpy(file_name+5, sfo.title_id+4, 5);
+        memcpy(file_name+10, ".iso", 4);
+        file_name[14] = '\0';
     }
 
-    if (vals.ird_path == NULL) {
-        vals.ird_path = malloc(MAX_PATH_LEN);
-        if (vals.ird_path == NULL) {
-            ret_val = ALLOC_ERROR;
-            goto exec_error;
-        }
+    ird_path = malloc(MAX_PATH_LEN);
+    if (ird_path == NULL) {
+        ret_val = ALLOC_ERROR;
+        goto exit_paths;
+    }
 
-        snprintf(vals.ird_path, MAX_PATH_LEN, "%s/%s", tmp_path, "ird.bin");
-        ret_val = download_ird(&sfo, vals.ird_path);
+    if (vals->ird_path != NULL) {
+        snprintf(ird_path, MAX_PATH_LEN, "%s", vals->ird_path);
+    } else {
+        snprintf(ird_path, MAX_PATH_LEN, "%s/%s", tmp_path, "ird.bin");
+        ret_val = download_ird(&sfo, ird_path);
         if (ret_val != EXIT_OK) {
-            goto exec_error;
+            goto exit_paths;
         }
     }
 
-    if (vals.get_pup) {
+    if (vals->get_pup) {
         pup_path = malloc(MAX_PATH_LEN);
         if (pup_path == NULL) {
             ret_val = ALLOC_ERROR;
-            goto exec_error;
+            goto exit_paths;
         }
-        snprintf(pup_path, MAX_PATH_LEN, "%s/%s", vals.in_dir, PUP_DIR);
+        snprintf(pup_path, MAX_PATH_LEN, "%s/%s", in_dir, PUP_DIR);
 
         if (stat(pup_path, &st) == -1) {
             mkdir(pup_path, 0700);
         }
 
-        snprintf(pup_path, MAX_PATH_LEN, "%s/%s", vals.in_dir, PUP_REL_PATH);
+        snprintf(pup_path, MAX_PATH_LEN, "%s/%s", in_dir, PUP_REL_PATH);
         ret_val = download_pup(&sfo, pup_path);
         if (ret_val != EXIT_OK) {
-            goto exec_error;
+            goto exit_paths;
         }
     }
-    printf("Here\n");
 
-    ret_val = load_ird(&ird, vals.ird_path, tmp_path);
+    ret_val = load_ird(&ird, ird_path, tmp_path);
     if (ret_val != EXIT_OK) {
-        goto exec_error;
+        goto exit_paths;
     }
 
-    ret_val = print_verification(&ird, vals.in_dir);
-    if (ret_val != EXIT_OK) {
-        goto exec_error;
+    // The virtual ISO reads the folder as it is, nothing is verified up front
+    if (vals->mount_point != NULL) {
+        ret_val = mount_iso(&ird, in_dir, vals->mount_point, file_name);
+        goto exit_ird;
+    }
+
+    if (vals->serve_port != 0) {
+        ret_val = serve_iso(&ird, in_dir, vals->serve_port, file_name);
+        goto exit_ird;
+    }
+
+    verify.threads = vals->verify_threads;
+    verify.mode = vals->verify_mode;
+    verify.fail_fast = vals->fail_fast;
+    verify.cache_path = vals->verify_cache;
+
+    // Triage is done once the folder has been checked, problems fail the disc
+    if (vals->check) {
+        batch_io_enter(batch);
+        ret_val = print_verification(&ird, in_dir, &verify, &passed);
+        batch_io_leave(batch);
+        if (ret_val == EXIT_OK && !passed) {
+            ret_val = VERIFY_ERROR;
+        }
+        goto exit_ird;
     }
 
     iso_path = malloc(MAX_PATH_LEN);
     if (iso_path == NULL) {
         ret_val = ALLOC_ERROR;
+        goto exit_ird;
+    }
+    if (vals->stream_fd != -1) {
+        strcpy(iso_path, "-");
+    } else {
+        snprintf(iso_path, MAX_PATH_LEN, "%s/%s", vals->out_dir, file_name);
+    }
+
+    opts.threads = vals->threads;
+    opts.backend = vals->backend;
+    opts.gap_mode = vals->gap_mode;
+    opts.positional = vals->positional;
+    opts.direct = vals->direct;
+    opts.transfer_size = (vals->transfer_size > 0)? vals->transfer_size : DIRECT_TRANSFER_SIZE;
+    opts.fused = vals->fused;
+    opts.digests = vals->digests;
+    opts.regions = vals->regions;
+    opts.resume = vals->resume;
+    opts.incremental = vals->incremental;
+    opts.stream = vals->stream;
+    opts.stream_fd = vals->stream_fd;
+
+    if (vals->cso) {
+        opts.cso_path = malloc(MAX_PATH_LEN);
+        if (opts.cso_path == NULL) {
+            ret_val = ALLOC_ERROR;
+            goto exit_ird;
+        }
+        snprintf(opts.cso_path, MAX_PATH_LEN, "%s", iso_path);
+
+        // TITLE.iso becomes TITLE.cso, any other name gets the extension added
+        if (strlen(opts.cso_path) > 4 && strcasecmp(opts.cso_path + strlen(opts.cso_path) - 4, ".iso") == 0) {
+            opts.cso_path[strlen(opts.cso_path) - 4] = '\0';
+        }
+        strncat(opts.cso_path, ".cso", MAX_PATH_LEN - strlen(opts.cso_path) - 1);
+    }
+
+    if (vals->tee_count > 0) {
+        opts.tee_paths = calloc(vals->tee_count, sizeof(*opts.tee_paths));
+        if (opts.tee_paths == NULL) {
+            ret_val = ALLOC_ERROR;
+            goto exit_ird;
+        }
+        opts.tee_count = vals->tee_count;
+
+        for (int index = 0; index < vals->tee_count; index++) {
+            opts.tee_paths[index] = malloc(MAX_PATH_LEN);
+            if (opts.tee_paths[index] == NULL) {
+                ret_val = ALLOC_ERROR;
+                goto exit_ird;
+            }
+            snprintf(opts.tee_paths[index], MAX_PATH_LEN, "%s/%s", vals->tee_dirs[index], file_name);
+        }
+    }
+
+    // Holes and reservations need a seekable file
+    if (opts.stream) {
+        opts.gap_mode = GAP_ZERO;
+    }
+
+    // Downloads and IRD parsing stay outside, only the folder and ISO
+    // traffic counts against the batch's I/O slots
+    batch_io_enter(batch);
+    ret_val = rebuild_iso(&ird, in_dir, iso_path, &opts, vals->fused? NULL : &verify);
+    batch_io_leave(batch);
+
+    exit_ird:
+        free_ird(&ird);
+    exit_paths:
+        for (int index = 0; opts.tee_paths != NULL && index < opts.tee_count; index++) {
+            free(opts.tee_paths[index]);
+        }
+        free(opts.tee_paths);
+        free(opts.cso_path);
+        free(iso_path);
+        free(pup_path);
+        free(ird_path);
+        free(file_name);
+        free(tmp_path);
+        free(sfo_path);
+        return ret_val;
+}
+
+// Two folders of the same disc would share a temporary folder and an ISO
+// name, so a batch has to hold distinct discs.
+static
+error_state_t check_batch(struct values *vals) {
+
+    error_state_t ret_val;
+    char *sfo_path;
+    sfo_t *sfos;
+
+    sfo_path = malloc(MAX_PATH_LEN);
+    if (sfo_path == NULL) {
+        ret_val = ALLOC_ERROR;
+        goto exit_normal;
+    }
+
+    sfos = calloc(vals->in_count, sizeof(*sfos));
+    if (sfos == NULL) {
+        ret_val = ALLOC_ERROR;
+        goto exit_path;
+    }
+
+    for (uint32_t index = 0; index < vals->in_count; index++) {
+        snprintf(sfo_path, MAX_PATH_LEN, "%s/%s", vals->in_dirs[index], SFO_REL_PATH);
+        ret_val = load_sfo(&sfos[index], sfo_path);
+        if (ret_val != EXIT_OK) {
+            printf("Can't read the SFO of %s\n", vals->in_dirs[index]);
+            goto exit_sfos;
+        }
+
+        for (uint32_t other = 0; other < index; other++) {
+            if (sfos[other].mgz_sig == sfos[index].mgz_sig ||
+                    memcmp(sfos[other].title_id, sfos[index].title_id, sizeof(sfos->title_id)) == 0) {
+                printf("%s and %s hold the same disc\n", vals->in_dirs[other], vals->in_dirs[index]);
+                ret_val = ARG_ERROR;
+                goto exit_sfos;
+            }
+        }
+    }
+
+    ret_val = EXIT_OK;
+    exit_sfos:
+        free(sfos);
+    exit_path:
+        free(sfo_path);
+    exit_normal:
+        return ret_val;
+}
+
+// Mounting, serving and size-only checks never hash a file, so they skip
+// the MD5 benchmark. --fused always verifies in full and --incremental
+// checks every file it rewrites. A backend given with --hash is always
+// selected, it costs no benchmark.
+static
+bool needs_hashing(struct values *vals) {
+    if (vals->hash != HASH_AUTO || vals->incremental) {
+        return true;
+    }
+    return vals->mount_point == NULL && vals->serve_port == 0 && vals->verify_mode != VERIFY_SIZE;
+}
+
+int main (int argc, char** argv) {
+    error_state_t ret_val;
+    char *err_msg;
+
+    struct argp_option options[] = {
+        { "filename", 'f', "NAME", 0, "Set filename for ISO"},
+        { "output", 'o', "OUT_PATH", 0, "Set output folder"},
+        { "ird", 'r', "IRD_PATH", 0, "Manually supply IRD file"},
+        { "pup", 'p', 0, 0, "Download/replace PUP file from online archive"},
+        { "threads", 'j', "COUNT", 0, "Prefetch extents with COUNT reader threads while rebuilding"},
+        { "io", OPT_IO, "BACKEND", 0, "I/O backend used for rebuilding: stdio (default), uring, copy (zero-copy) or reflink (shared extents on btrfs/XFS)"},
+        { "positional", OPT_POSITIONAL, 0, 0, "Preallocate the ISO and let reader threads write extents out of order"},
+        { "direct", OPT_DIRECT, 0, 0, "Bypass the page cache with O_DIRECT and aligned transfers"},
+        { "transfer-size", OPT_TRANSFER, "MIB", 0, "Transfer size for --direct in MiB (default 8)"},
+        { "fused", OPT_FUSED, 0, 0, "Verify checksums while rebuilding instead of reading the folder twice"},
+        { "digests", OPT_DIGESTS, 0, 0, "Compute the ISO's MD5/SHA-1/CRC32 while writing it and save them next to it"},
+        { "regions", OPT_REGIONS, 0, 0, "Check every disc region against the IRD's region hashes while writing"},
+        { "resume", OPT_RESUME, 0, 0, "Continue an interrupted rebuild from its checkpoint journal"},
+        { "incremental", OPT_INCREMENTAL, 0, 0, "Only rewrite the files that changed since the last --incremental rebuild of this ISO"},
+        { "stream", OPT_STREAM, 0, 0, "Write the ISO strictly in order without seeking, for pipes and FIFOs (implied by -f -)"},
+        { "mount", OPT_MOUNT, "DIR", 0, "Mount a read-only virtual ISO at DIR instead of rebuilding (needs a FUSE build)"},
+        { "cso", OPT_CSO, 0, 0, "Write a deflate-compressed CSO instead of the ISO, compressed on -j threads (all cores by default)"},
+        { "serve", OPT_SERVE, "PORT", OPTION_ARG_OPTIONAL, "Serve a virtual ISO to consoles over the ps3netsrv protocol (default port 38008)"},
+        { "verify-threads", OPT_VERIFY_THREADS, "COUNT", 0, "Check files against the IRD on COUNT threads (default: all cores)"},
+        { "verify-cache", OPT_VERIFY_CACHE, "FILE", 0, "Remember verified files in FILE and skip reading the ones unchanged since"},
+        { "verify", OPT_VERIFY, "MODE", 0, "How deep files are checked: full (default, every byte), sample (a few blocks of large files) or size"},
+        { "fail-fast", OPT_FAIL_FAST, 0, 0, "Stop verifying at the first file with a problem"},
+        { "check", OPT_CHECK, 0, 0, "Only verify the folder, fail if anything doesn't match and write no ISO"},
+        { "hash", OPT_HASH, "BACKEND", 0, "MD5 backend: auto (default, fastest in a quick benchmark), mbedtls, openssl or builtin"},
+        { "jobs", OPT_JOBS, "COUNT", 0, "With several JB folders, rebuild COUNT discs at a time (default 2), largest first"},
+        { "io-slots", OPT_IO_SLOTS, "COUNT", 0, "With several JB folders, let at most COUNT discs verify or write at once (default: all jobs)"},
+        { "tee", OPT_TEE, "DIR", 0, "Also write the ISO into DIR from the same read pass, one writer thread per copy (repeatable)"},
+        { "gaps", OPT_GAPS, "MODE", 0, "Padding between extents: sparse (default, holes), reserve (fallocate) or zero (dense)"},
+        {0}
+    };
+    struct values vals = {NULL, NULL};
+    struct argp argp = { options, parse_opt, "JB_FOLDER...", "Rebuild JB Folder dumps into proper ISOs" };
+
+    argp_parse(&argp, argc, argv, 0, 0, &vals);
+
+    // With the ISO going to stdout every message moves over to stderr
+    vals.stream_fd = -1;
+    if (vals.stream && vals.file_name != NULL && strcmp(vals.file_name, "-") == 0) {
+        vals.stream_fd = dup(STDOUT_FILENO);
+        if (vals.stream_fd == -1 || dup2(STDERR_FILENO, STDOUT_FILENO) == -1) {
+            ret_val = F_OPEN_ERROR;
+            goto exec_error;
+        }
+    }
+
+    if (vals.out_dir == NULL) {
+        vals.out_dir = malloc(MAX_PATH_LEN);
+        getcwd(vals.out_dir, MAX_PATH_LEN);
+        cwk_path_normalize(vals.out_dir, vals.out_dir, MAX_PATH_LEN);
+    }
+
+    if (vals.in_count > 1) {
+        ret_val = check_batch(&vals);
+        if (ret_val != EXIT_OK) {
+            goto exec_error;
+        }
+    }
+
+    if (needs_hashing(&vals)) {
+        ret_val = hash_select(vals.hash);
+        if (ret_val != EXIT_OK) {
+            goto exec_error;
+        }
+    }
+
+    ret_val = net_init();
+    if (ret_val != EXIT_OK) {
         goto exec_error;
     }
-    snprintf(iso_path, MAX_PATH_LEN, "%s/%s", vals.out_dir, vals.file_name);
 
-    ret_val = rebuild_iso(&ird, vals.in_dir, iso_path);
+    if (vals.in_count > 1) {
+        ret_val = batch_run(vals.in_dirs, vals.in_count, (vals.jobs > 0)? vals.jobs : BATCH_JOBS,
+                vals.io_slots, rebuild_folder, &vals);
+    } else {
+        ret_val = rebuild_folder(NULL, vals.in_dirs[0], &vals);
+    }
+    net_cleanup();
+
     if (ret_val != EXIT_OK) {
         goto exec_error;
     }
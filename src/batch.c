@@ -0,0 +1,227 @@
+#define _XOPEN_SOURCE 700
+#define _FILE_OFFSET_BITS 64
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <pthread.h>
+
+#include "batch.h"
+#include "util.h"
+
+// Takes ownership of dir_fd. Unreadable parts count as empty, the job itself
+// reports them later.
+static
+off_t folder_size(int dir_fd) {
+
+    DIR *dir;
+    struct dirent *entry;
+    struct stat sb;
+    off_t total;
+    int child;
+
+    dir = fdopendir(dir_fd);
+    if (dir == NULL) {
+        close(dir_fd);
+        return 0;
+    }
+
+    total = 0;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        if (fstatat(dirfd(dir), entry->d_name, &sb, AT_SYMLINK_NOFOLLOW) != 0) continue;
+
+        if (S_ISREG(sb.st_mode)) {
+            total += sb.st_size;
+        } else if (S_ISDIR(sb.st_mode)) {
+            child = openat(dirfd(dir), entry->d_name, O_RDONLY | O_DIRECTORY);
+            if (child != -1) total += folder_size(child);
+        }
+    }
+
+    closedir(dir);
+    return total;
+}
+
+static
+int compare_items(const void *a, const void *b) {
+    const batch_item_t *left = a;
+    const batch_item_t *right = b;
+
+    if (left->size != right->size) {
+        return (left->size < right->size) - (left->size > right->size);
+    }
+    return strcmp(left->folder, right->folder);
+}
+
+static
+void *batch_worker(void *arg) {
+
+    batch_t *batch = arg;
+    batch_item_t *item;
+    uint32_t index, finished;
+    char *err_msg;
+
+    while (true) {
+        pthread_mutex_lock(&batch->lock);
+        if (batch->next == batch->count) {
+            pthread_mutex_unlock(&batch->lock);
+            break;
+        }
+        index = batch->next;
+        batch->next += 1;
+        pthread_mutex_unlock(&batch->lock);
+
+        item = &batch->items[index];
+        printf("\n< Starting %s >\n\n", item->folder);
+        item->result = batch->job(batch, item->folder, batch->opaque);
+
+        pthread_mutex_lock(&batch->lock);
+        batch->finished += 1;
+        finished = batch->finished;
+        pthread_mutex_unlock(&batch->lock);
+
+        get_error_message(&err_msg, item->result);
+        printf("\n< Finished %s (%u of %u): %s >\n\n", item->folder, finished, batch->count,
+                (item->result == EXIT_OK)? "OK" : err_msg);
+    }
+    return NULL;
+}
+
+// Waits for one of the I/O slots, without a batch there is nothing to share
+void batch_io_enter(batch_t *batch) {
+    if (batch == NULL) return;
+
+    pthread_mutex_lock(&batch->lock);
+    while (batch->io_busy >= batch->io_slots) {
+        pthread_cond_wait(&batch->io_free, &batch->lock);
+    }
+    batch->io_busy += 1;
+    pthread_mutex_unlock(&batch->lock);
+}
+
+void batch_io_leave(batch_t *batch) {
+    if (batch == NULL) return;
+
+    pthread_mutex_lock(&batch->lock);
+    batch->io_busy -= 1;
+    pthread_cond_signal(&batch->io_free);
+    pthread_mutex_unlock(&batch->lock);
+}
+
+static
+error_state_t batch_report(batch_t *batch) {
+
+    error_state_t ret_val;
+    batch_item_t *item;
+    uint32_t rebuilt;
+    char *err_msg;
+
+    ret_val = EXIT_OK;
+    rebuilt = 0;
+
+    printf("\n< Batch Report >\n");
+    for (uint32_t index = 0; index < batch->count; index++) {
+        item = &batch->items[index];
+        if (item->result == EXIT_OK) {
+            rebuilt += 1;
+            printf("\t%s: OK\n", item->folder);
+            continue;
+        }
+
+        if (ret_val == EXIT_OK) ret_val = item->result;
+        get_error_message(&err_msg, item->result);
+        printf("\t%s: %s\n", item->folder, err_msg);
+    }
+    printf("\n< %u of %u folders rebuilt >\n\n", rebuilt, batch->count);
+
+    return ret_val;
+}
+
+// Runs job once per folder on up to jobs threads, with at most io_slots of
+// them inside batch_io_enter at a time (io_slots <= 0 means one per job).
+// Returns the first failure in processing order once every folder was tried.
+error_state_t batch_run(char **folders, uint32_t count, int jobs, int io_slots,
+                    batch_job_t job, void *opaque) {
+
+    error_state_t ret_val;
+    batch_t batch = {0};
+    pthread_t workers[MAX_THREADS];
+    off_t total;
+    int started;
+    int dir_fd;
+
+    if (folders == NULL || count == 0 || job == NULL || jobs <= 0) {
+        ret_val = ARG_ERROR;
+        goto exit_normal;
+    }
+
+    batch.items = calloc(count, sizeof(*batch.items));
+    if (batch.items == NULL) {
+        ret_val = ALLOC_ERROR;
+        goto exit_normal;
+    }
+
+    total = 0;
+    for (uint32_t index = 0; index < count; index++) {
+        batch.items[index].folder = folders[index];
+        batch.items[index].result = UNKNOWN_ERROR;
+
+        dir_fd = open(folders[index], O_RDONLY | O_DIRECTORY);
+        if (dir_fd != -1) batch.items[index].size = folder_size(dir_fd);
+        total += batch.items[index].size;
+    }
+    qsort(batch.items, count, sizeof(*batch.items), compare_items);
+
+    jobs = min(min(jobs, count), MAX_THREADS);
+    batch.count = count;
+    batch.io_slots = (io_slots > 0)? io_slots : jobs;
+    batch.job = job;
+    batch.opaque = opaque;
+
+    if (pthread_mutex_init(&batch.lock, NULL) != 0) {
+        ret_val = THREAD_ERROR;
+        goto exit_items;
+    }
+
+    if (pthread_cond_init(&batch.io_free, NULL) != 0) {
+        ret_val = THREAD_ERROR;
+        goto exit_lock;
+    }
+
+    printf("Rebuilding %u folders (%.2f GiB), %d at a time with %d doing I/O\n",
+            count, (double) total / (1 << 30), jobs, (int) min(batch.io_slots, jobs));
+
+    // Workers drain a shared queue, fewer of them only makes the batch slower
+    for (started = 0; started < jobs; started++) {
+        if (pthread_create(&workers[started], NULL, batch_worker, &batch) != 0) break;
+    }
+    if (started == 0) {
+        ret_val = THREAD_ERROR;
+        goto exit_cond;
+    }
+
+    for (int index = 0; index < started; index++) {
+        pthread_join(workers[index], NULL);
+    }
+
+    ret_val = batch_report(&batch);
+
+    exit_cond:
+        pthread_cond_destroy(&batch.io_free);
+    exit_lock:
+        pthread_mutex_destroy(&batch.lock);
+    exit_items:
+        free(batch.items);
+    exit_normal:
+        return ret_val;
+}
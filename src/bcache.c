@@ -0,0 +1,248 @@
+#define _XOPEN_SOURCE 700
+#define _FILE_OFFSET_BITS 64
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "bcache.h"
+#include "viso.h"
+#include "util.h"
+
+static
+cache_block_t *find_block(bcache_t *cache, off_t index) {
+    for (int slot = 0; slot < BCACHE_BLOCKS; slot++) {
+        if (cache->blocks[slot].state != BLOCK_EMPTY && cache->blocks[slot].index == index) {
+            return &cache->blocks[slot];
+        }
+    }
+    return NULL;
+}
+
+// Least recently used block that isn't being filled, called with the lock held
+static
+cache_block_t *claim_block(bcache_t *cache, off_t index) {
+
+    cache_block_t *victim, *block;
+
+    victim = NULL;
+    for (int slot = 0; slot < BCACHE_BLOCKS; slot++) {
+        block = &cache->blocks[slot];
+        if (block->state == BLOCK_LOADING) continue;
+        if (victim == NULL || block->state == BLOCK_EMPTY ||
+                (victim->state != BLOCK_EMPTY && block->last_use < victim->last_use)) {
+            victim = block;
+        }
+        if (victim->state == BLOCK_EMPTY) break;
+    }
+
+    if (victim != NULL) {
+        victim->state = BLOCK_LOADING;
+        victim->index = index;
+        victim->last_use = ++cache->clock;
+    }
+    return victim;
+}
+
+// The lock is dropped while reading, waiters are woken either way
+static
+error_state_t load_block(bcache_t *cache, cache_block_t *block) {
+
+    error_state_t ret_val;
+    size_t obtained;
+
+    pthread_mutex_unlock(&cache->lock);
+    ret_val = viso_pread(cache->viso, block->data, BCACHE_BLOCK_SIZE,
+                    block->index * BCACHE_BLOCK_SIZE, &obtained);
+    pthread_mutex_lock(&cache->lock);
+
+    if (ret_val == EXIT_OK) {
+        block->state = BLOCK_READY;
+        block->length = obtained;
+    } else {
+        block->state = BLOCK_EMPTY;
+    }
+
+    pthread_cond_broadcast(&cache->loaded);
+    return ret_val;
+}
+
+static
+void *helper_thread(void *arg) {
+
+    bcache_t *cache = arg;
+    cache_block_t *block;
+    off_t index;
+
+    pthread_mutex_lock(&cache->lock);
+    while (!cache->stop) {
+        if (cache->ahead_next >= cache->ahead_end) {
+            pthread_cond_wait(&cache->wanted, &cache->lock);
+            continue;
+        }
+
+        index = cache->ahead_next;
+        cache->ahead_next += 1;
+        if (find_block(cache, index) != NULL) continue;
+
+        block = claim_block(cache, index);
+        if (block == NULL) continue;
+
+        // A failed read-ahead is retried in the foreground if it's needed
+        load_block(cache, block);
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return NULL;
+}
+
+error_state_t bcache_init(bcache_t *cache, viso_t *viso) {
+
+    error_state_t ret_val;
+    int slot;
+
+    if (cache == NULL || viso == NULL) {
+        ret_val = ARG_ERROR;
+        goto exit_normal;
+    }
+
+    memset(cache, 0, sizeof(*cache));
+    cache->viso = viso;
+
+    for (slot = 0; slot < BCACHE_BLOCKS; slot++) {
+        cache->blocks[slot].data = malloc(BCACHE_BLOCK_SIZE);
+        if (cache->blocks[slot].data == NULL) {
+            ret_val = ALLOC_ERROR;
+            goto exit_blocks;
+        }
+    }
+
+    pthread_mutex_init(&cache->lock, NULL);
+    pthread_cond_init(&cache->loaded, NULL);
+    pthread_cond_init(&cache->wanted, NULL);
+
+    if (pthread_create(&cache->helper, NULL, helper_thread, cache) != 0) {
+        ret_val = THREAD_ERROR;
+        goto exit_sync;
+    }
+
+    ret_val = EXIT_OK;
+    goto exit_normal;
+
+    exit_sync:
+        pthread_cond_destroy(&cache->wanted);
+        pthread_cond_destroy(&cache->loaded);
+        pthread_mutex_destroy(&cache->lock);
+    exit_blocks:
+        while (slot-- > 0) free(cache->blocks[slot].data);
+    exit_normal:
+        return ret_val;
+}
+
+static
+error_state_t copy_block(bcache_t *cache, off_t index, char *buffer, off_t inner,
+                    size_t length, size_t *copied) {
+
+    error_state_t ret_val;
+    cache_block_t *block;
+
+    while (true) {
+        block = find_block(cache, index);
+
+        if (block == NULL) {
+            block = claim_block(cache, index);
+            if (block == NULL) {
+                pthread_cond_wait(&cache->loaded, &cache->lock);
+                continue;
+            }
+
+            ret_val = load_block(cache, block);
+            if (ret_val != EXIT_OK) {
+                return ret_val;
+            }
+            continue;
+        }
+
+        if (block->state == BLOCK_LOADING) {
+            pthread_cond_wait(&cache->loaded, &cache->lock);
+            continue;
+        }
+        break;
+    }
+
+    block->last_use = ++cache->clock;
+    *copied = (inner < block->length)? min(length, block->length - inner) : 0;
+    memcpy(buffer, block->data + inner, *copied);
+    return EXIT_OK;
+}
+
+error_state_t bcache_read(bcache_t *cache, char *buffer, off_t offset, size_t length, size_t *obtained) {
+
+    error_state_t ret_val;
+    off_t start, index, inner, last;
+    size_t copied;
+
+    if (cache == NULL || buffer == NULL || obtained == NULL || offset < 0) {
+        return ARG_ERROR;
+    }
+
+    *obtained = 0;
+    start = offset;
+    pthread_mutex_lock(&cache->lock);
+
+    while (length > 0) {
+        index = offset / BCACHE_BLOCK_SIZE;
+        inner = offset % BCACHE_BLOCK_SIZE;
+
+        ret_val = copy_block(cache, index, buffer, inner, min(length, BCACHE_BLOCK_SIZE - inner), &copied);
+        if (ret_val != EXIT_OK) {
+            goto exit_lock;
+        }
+        if (copied == 0) break;
+
+        buffer += copied;
+        offset += copied;
+        length -= copied;
+        *obtained += copied;
+    }
+
+    // Consoles read in order, so a read that continues the last one pulls
+    // the next stretch in behind it
+    if (start == cache->last_end) {
+        index = offset / BCACHE_BLOCK_SIZE;
+        last = (viso_size(cache->viso) + BCACHE_BLOCK_SIZE - 1) / BCACHE_BLOCK_SIZE;
+
+        if (cache->ahead_next < index || cache->ahead_next > index + BCACHE_READ_AHEAD) {
+            cache->ahead_next = index;
+        }
+        cache->ahead_end = min(index + BCACHE_READ_AHEAD, last);
+        pthread_cond_signal(&cache->wanted);
+    }
+    cache->last_end = offset;
+
+    ret_val = EXIT_OK;
+    exit_lock:
+        pthread_mutex_unlock(&cache->lock);
+        return ret_val;
+}
+
+void bcache_free(bcache_t *cache) {
+
+    pthread_mutex_lock(&cache->lock);
+    cache->stop = true;
+    pthread_cond_signal(&cache->wanted);
+    pthread_mutex_unlock(&cache->lock);
+    pthread_join(cache->helper, NULL);
+
+    for (int slot = 0; slot < BCACHE_BLOCKS; slot++) {
+        free(cache->blocks[slot].data);
+    }
+    pthread_cond_destroy(&cache->wanted);
+    pthread_cond_destroy(&cache->loaded);
+    pthread_mutex_destroy(&cache->lock);
+}
@@ -0,0 +1,436 @@
+#define _GNU_SOURCE
+#define _XOPEN_SOURCE 700
+#define _FILE_OFFSET_BITS 64
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <zlib.h>
+
+#include "cso.h"
+#include "util.h"
+
+#define CSO_BATCH_SIZE (CSO_BLOCK_SIZE * CSO_BATCH_BLOCKS)
+
+static const char zero_input[CSO_BLOCK_SIZE];
+
+static
+error_state_t open_deflate(z_stream *zs) {
+    memset(zs, 0, sizeof(*zs));
+    if (deflateInit2(zs, CSO_LEVEL, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return ALLOC_ERROR;
+    }
+    return EXIT_OK;
+}
+
+// Raw deflate, blocks that don't shrink are stored as they are
+static
+uint32_t deflate_block(z_stream *zs, const char *input, size_t length, char *output) {
+
+    deflateReset(zs);
+    zs->next_in = (Bytef *) input;
+    zs->avail_in = length;
+    zs->next_out = (Bytef *) output;
+    zs->avail_out = length - 1;
+
+    if (length > 1 && deflate(zs, Z_FINISH) == Z_STREAM_END) {
+        return zs->total_out;
+    }
+
+    memcpy(output, input, length);
+    return length | CSO_PLAIN_FLAG;
+}
+
+static
+void compress_batch(cso_writer_t *cso, z_stream *zs, cso_batch_t *batch) {
+
+    size_t length;
+    uint32_t count;
+    char *input, *output;
+
+    count = (batch->filled + CSO_BLOCK_SIZE - 1) / CSO_BLOCK_SIZE;
+    for (uint32_t block = 0; block < count; block++) {
+        input = batch->input + block*CSO_BLOCK_SIZE;
+        output = batch->output + block*CSO_BLOCK_SIZE;
+        length = min(CSO_BLOCK_SIZE, batch->filled - block*CSO_BLOCK_SIZE);
+
+        // Gaps and zero padding cost a memcmp instead of a deflate
+        if (length == CSO_BLOCK_SIZE && memcmp(input, zero_input, CSO_BLOCK_SIZE) == 0) {
+            memcpy(output, cso->zero_block, cso->zero_size);
+            batch->sizes[block] = cso->zero_size;
+        } else {
+            batch->sizes[block] = deflate_block(zs, input, length, output);
+        }
+    }
+}
+
+static
+void *cso_worker(void *arg) {
+
+    cso_writer_t *cso = arg;
+    cso_batch_t *batch;
+    z_stream zs;
+
+    if (open_deflate(&zs) != EXIT_OK) {
+        pthread_mutex_lock(&cso->lock);
+        cso->error = ALLOC_ERROR;
+        pthread_cond_broadcast(&cso->done);
+        pthread_mutex_unlock(&cso->lock);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&cso->lock);
+    while (true) {
+        while (!cso->stop && cso->claim_seq >= cso->fill_seq) {
+            pthread_cond_wait(&cso->work, &cso->lock);
+        }
+        if (cso->claim_seq >= cso->fill_seq) break;
+
+        batch = &cso->batches[cso->claim_seq % cso->depth];
+        batch->state = BATCH_BUSY;
+        cso->claim_seq += 1;
+        pthread_mutex_unlock(&cso->lock);
+
+        compress_batch(cso, &zs, batch);
+
+        pthread_mutex_lock(&cso->lock);
+        batch->state = BATCH_DONE;
+        pthread_cond_broadcast(&cso->done);
+    }
+    pthread_mutex_unlock(&cso->lock);
+
+    deflateEnd(&zs);
+    return NULL;
+}
+
+// Only the feeding thread touches finished batches, the lock isn't needed
+static
+error_state_t write_batch(cso_writer_t *cso, cso_batch_t *batch) {
+
+    uint32_t count, size, pad;
+    off_t start;
+    char *cursor;
+
+    start = cso->position;
+    cursor = cso->pack;
+
+    count = (batch->filled + CSO_BLOCK_SIZE - 1) / CSO_BLOCK_SIZE;
+    for (uint32_t block = 0; block < count; block++) {
+        if (cso->next_block >= cso->block_count) {
+            return F_SIZE_ERROR;
+        }
+
+        pad = (-cso->position) & ((1 << cso->align) - 1);
+        memset(cursor, 0, pad);
+        cursor += pad;
+        cso->position += pad;
+
+        cso->index[cso->next_block] = (cso->position >> cso->align) | (batch->sizes[block] & CSO_PLAIN_FLAG);
+        cso->next_block += 1;
+
+        size = batch->sizes[block] & ~CSO_PLAIN_FLAG;
+        memcpy(cursor, batch->output + block*CSO_BLOCK_SIZE, size);
+        cursor += size;
+        cso->position += size;
+    }
+
+    return write_fd_full(cso->fd, cso->pack, cursor - cso->pack, start);
+}
+
+// Writes finished batches in order. Everything before until has to be
+// written before returning, later ones only if they are already done.
+static
+error_state_t drain_batches(cso_writer_t *cso, uint64_t until) {
+
+    error_state_t ret_val;
+    cso_batch_t *batch;
+
+    pthread_mutex_lock(&cso->lock);
+    while (cso->error == EXIT_OK && cso->write_seq < cso->fill_seq) {
+        batch = &cso->batches[cso->write_seq % cso->depth];
+
+        if (batch->state != BATCH_DONE) {
+            if (cso->write_seq >= until) break;
+            pthread_cond_wait(&cso->done, &cso->lock);
+            continue;
+        }
+
+        pthread_mutex_unlock(&cso->lock);
+        ret_val = write_batch(cso, batch);
+        pthread_mutex_lock(&cso->lock);
+
+        if (ret_val != EXIT_OK) {
+            cso->error = ret_val;
+            break;
+        }
+
+        batch->state = BATCH_FREE;
+        batch->filled = 0;
+        cso->write_seq += 1;
+    }
+    ret_val = cso->error;
+    pthread_mutex_unlock(&cso->lock);
+
+    return ret_val;
+}
+
+static
+error_state_t submit_batch(cso_writer_t *cso) {
+
+    uint64_t until;
+
+    pthread_mutex_lock(&cso->lock);
+    cso->batches[cso->fill_seq % cso->depth].state = BATCH_FILLED;
+    cso->fill_seq += 1;
+    pthread_cond_signal(&cso->work);
+    pthread_mutex_unlock(&cso->lock);
+
+    // The slot about to be filled has to be written out first
+    until = (cso->fill_seq + 1 > (uint64_t) cso->depth)? cso->fill_seq + 1 - cso->depth : 0;
+    return drain_batches(cso, until);
+}
+
+error_state_t cso_write(cso_writer_t *cso, const char *data, size_t length) {
+
+    error_state_t ret_val;
+    cso_batch_t *batch;
+    size_t take;
+
+    while (length > 0) {
+        batch = &cso->batches[cso->fill_seq % cso->depth];
+        take = min(length, CSO_BATCH_SIZE - batch->filled);
+
+        memcpy(batch->input + batch->filled, data, take);
+        batch->filled += take;
+        data += take;
+        length -= take;
+
+        if (batch->filled == CSO_BATCH_SIZE) {
+            ret_val = submit_batch(cso);
+            if (ret_val != EXIT_OK) {
+                return ret_val;
+            }
+        }
+    }
+    return EXIT_OK;
+}
+
+static
+ssize_t cookie_write(void *cookie, const char *data, size_t length) {
+    return (cso_write(cookie, data, length) == EXIT_OK)? (ssize_t) length : 0;
+}
+
+FILE *cso_stream(cso_writer_t *cso) {
+    return cso->stream;
+}
+
+static
+void put_le32(uint8_t *data, uint32_t value) {
+    for (int index = 0; index < 4; index++) {
+        data[index] = value & 0xFF;
+        value >>= 8;
+    }
+}
+
+// Block offsets only get 31 bits, big images shift them by align and start
+// every block on that boundary.
+static
+uint8_t pick_align(off_t data_start, off_t total_size, uint32_t block_count) {
+
+    off_t bound;
+    uint8_t align;
+
+    for (align = 0; align < 31; align++) {
+        bound = data_start + total_size + (off_t) block_count * ((1 << align) - 1);
+        if ((bound >> align) < CSO_PLAIN_FLAG) break;
+    }
+    return align;
+}
+
+error_state_t cso_open(cso_writer_t **cso_wrap, const char *path, off_t total_size, int threads) {
+
+    error_state_t ret_val;
+    cso_writer_t *cso;
+    z_stream zs;
+    cookie_io_functions_t functions = {NULL, cookie_write, NULL, NULL};
+
+    if (cso_wrap == NULL || path == NULL || total_size <= 0 || threads <= 0) {
+        ret_val = ARG_ERROR;
+        goto exit_normal;
+    }
+
+    cso = calloc(1, sizeof(*cso));
+    if (cso == NULL) {
+        ret_val = ALLOC_ERROR;
+        goto exit_normal;
+    }
+
+    cso->total_size = total_size;
+    cso->block_count = (total_size + CSO_BLOCK_SIZE - 1) / CSO_BLOCK_SIZE;
+    cso->position = CSO_HEADER_SIZE + ((off_t) cso->block_count + 1) * sizeof(*cso->index);
+    cso->align = pick_align(cso->position, total_size, cso->block_count);
+    cso->worker_count = min(threads, MAX_THREADS);
+    cso->depth = cso->worker_count*2 + 2;
+
+    ret_val = open_deflate(&zs);
+    if (ret_val != EXIT_OK) {
+        goto exit_cso;
+    }
+    cso->zero_size = deflate_block(&zs, zero_input, CSO_BLOCK_SIZE, cso->zero_block);
+    deflateEnd(&zs);
+
+    cso->index = malloc(((size_t) cso->block_count + 1) * sizeof(*cso->index));
+    cso->pack = malloc(CSO_BATCH_BLOCKS * (CSO_BLOCK_SIZE + (1 << cso->align)));
+    cso->batches = calloc(cso->depth, sizeof(*cso->batches));
+    if (cso->index == NULL || cso->pack == NULL || cso->batches == NULL) {
+        ret_val = ALLOC_ERROR;
+        goto exit_buffers;
+    }
+
+    for (int slot = 0; slot < cso->depth; slot++) {
+        cso->batches[slot].input = malloc(CSO_BATCH_SIZE);
+        cso->batches[slot].output = malloc(CSO_BATCH_SIZE);
+        if (cso->batches[slot].input == NULL || cso->batches[slot].output == NULL) {
+            ret_val = ALLOC_ERROR;
+            goto exit_buffers;
+        }
+    }
+
+    cso->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (cso->fd == -1) {
+        ret_val = F_OPEN_ERROR;
+        goto exit_buffers;
+    }
+
+    cso->stream = fopencookie(cso, "w", functions);
+    if (cso->stream == NULL) {
+        ret_val = ALLOC_ERROR;
+        goto exit_fd;
+    }
+    setvbuf(cso->stream, NULL, _IOFBF, CSO_BATCH_SIZE);
+
+    pthread_mutex_init(&cso->lock, NULL);
+    pthread_cond_init(&cso->work, NULL);
+    pthread_cond_init(&cso->done, NULL);
+
+    for (int index = 0; index < cso->worker_count; index++) {
+        if (pthread_create(&cso->workers[index], NULL, cso_worker, cso) != 0) {
+            cso->worker_count = index;
+            fclose(cso->stream);
+            cso_free(cso);
+            ret_val = THREAD_ERROR;
+            goto exit_normal;
+        }
+    }
+
+    *cso_wrap = cso;
+    ret_val = EXIT_OK;
+    goto exit_normal;
+
+    exit_fd:
+        close(cso->fd);
+    exit_buffers:
+        for (int slot = 0; cso->batches != NULL && slot < cso->depth; slot++) {
+            free(cso->batches[slot].input);
+            free(cso->batches[slot].output);
+        }
+        free(cso->batches);
+        free(cso->pack);
+        free(cso->index);
+    exit_cso:
+        free(cso);
+    exit_normal:
+        return ret_val;
+}
+
+// The stream must have been closed already so nothing is left in its buffer
+error_state_t cso_finish(cso_writer_t *cso) {
+
+    error_state_t ret_val;
+    uint8_t header[CSO_HEADER_SIZE];
+    uint8_t *table;
+    uint32_t pad;
+
+    if (cso->batches[cso->fill_seq % cso->depth].filled > 0) {
+        ret_val = submit_batch(cso);
+        if (ret_val != EXIT_OK) {
+            return ret_val;
+        }
+    }
+
+    ret_val = drain_batches(cso, cso->fill_seq);
+    if (ret_val != EXIT_OK) {
+        return ret_val;
+    }
+
+    if (cso->next_block != cso->block_count) {
+        return F_SIZE_ERROR;
+    }
+
+    // The end marker is shifted too, so the last block is padded out to it
+    pad = (-cso->position) & ((1 << cso->align) - 1);
+    memset(cso->pack, 0, pad);
+    ret_val = write_fd_full(cso->fd, cso->pack, pad, cso->position);
+    if (ret_val != EXIT_OK) {
+        return ret_val;
+    }
+    cso->position += pad;
+    cso->index[cso->block_count] = cso->position >> cso->align;
+
+    memset(header, 0, sizeof(header));
+    memcpy(header, CSO_MAGIC, 4);
+    put_le32(header + 4, CSO_HEADER_SIZE);
+    put_le32(header + 8, cso->total_size & 0xFFFFFFFF);
+    put_le32(header + 12, (uint64_t) cso->total_size >> 32);
+    put_le32(header + 16, CSO_BLOCK_SIZE);
+    header[20] = 1;
+    header[21] = cso->align;
+
+    ret_val = write_fd_full(cso->fd, header, sizeof(header), 0);
+    if (ret_val != EXIT_OK) {
+        return ret_val;
+    }
+
+    // The index is written in place as little endian
+    table = (uint8_t *) cso->index;
+    for (uint32_t block = 0; block <= cso->block_count; block++) {
+        put_le32(table + block*4, cso->index[block]);
+    }
+
+    return write_fd_full(cso->fd, cso->index, ((size_t) cso->block_count + 1) * sizeof(*cso->index),
+                    CSO_HEADER_SIZE);
+}
+
+void cso_free(cso_writer_t *cso) {
+
+    pthread_mutex_lock(&cso->lock);
+    cso->stop = true;
+    pthread_cond_broadcast(&cso->work);
+    pthread_mutex_unlock(&cso->lock);
+
+    for (int index = 0; index < cso->worker_count; index++) {
+        pthread_join(cso->workers[index], NULL);
+    }
+
+    close(cso->fd);
+    for (int slot = 0; slot < cso->depth; slot++) {
+        free(cso->batches[slot].input);
+        free(cso->batches[slot].output);
+    }
+    free(cso->batches);
+    free(cso->pack);
+    free(cso->index);
+
+    pthread_cond_destroy(&cso->done);
+    pthread_cond_destroy(&cso->work);
+    pthread_mutex_destroy(&cso->lock);
+    free(cso);
+}
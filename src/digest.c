@@ -0,0 +1,193 @@
+#define _XOPEN_SOURCE 700
+#define _FILE_OFFSET_BITS 64
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "digest.h"
+#include "util.h"
+#include "cwalk.h"
+
+error_state_t digest_init(iso_digest_t *digest) {
+
+    error_state_t ret_val;
+
+    mbedtls_md5_init(&digest->md5);
+    mbedtls_sha1_init(&digest->sha1);
+    digest->crc = crc32(0L, Z_NULL, 0);
+    digest->length = 0;
+
+    if (mbedtls_md5_starts_ret(&digest->md5) != 0) {
+        ret_val = MD5_START_ERROR;
+        goto exit_early;
+    }
+
+    if (mbedtls_sha1_starts_ret(&digest->sha1) != 0) {
+        ret_val = SHA1_START_ERROR;
+        goto exit_early;
+    }
+
+    ret_val = EXIT_OK;
+    goto exit_normal;
+
+    exit_early:
+        digest_free(digest);
+    exit_normal:
+        return ret_val;
+}
+
+error_state_t digest_update(iso_digest_t *digest, const char *data, size_t length) {
+
+    if (mbedtls_md5_update_ret(&digest->md5, (const unsigned char *) data, length) != 0) {
+        return MD5_UPDT_ERROR;
+    }
+
+    if (mbedtls_sha1_update_ret(&digest->sha1, (const unsigned char *) data, length) != 0) {
+        return SHA1_UPDT_ERROR;
+    }
+
+    digest->crc = crc32(digest->crc, (const Bytef *) data, length);
+    digest->length += length;
+    return EXIT_OK;
+}
+
+error_state_t digest_finish(iso_digest_t *digest) {
+
+    if (mbedtls_md5_finish_ret(&digest->md5, digest->md5_sum) != 0) {
+        return MD5_END_ERROR;
+    }
+
+    if (mbedtls_sha1_finish_ret(&digest->sha1, digest->sha1_sum) != 0) {
+        return SHA1_END_ERROR;
+    }
+    return EXIT_OK;
+}
+
+static
+void hex_string(char *buffer, const uint8_t *sum, int length) {
+    for (int index = 0; index < length; index++) {
+        sprintf(buffer + index*2, "%02x", sum[index]);
+    }
+}
+
+static
+error_state_t write_sidecar(const char *iso_path, const char *extension, const char *line) {
+
+    error_state_t ret_val;
+    char *path;
+    FILE *file;
+
+    path = malloc(MAX_PATH_LEN);
+    if (path == NULL) {
+        ret_val = ALLOC_ERROR;
+        goto exit_normal;
+    }
+
+    if (snprintf(path, MAX_PATH_LEN, "%s.%s", iso_path, extension) >= MAX_PATH_LEN) {
+        ret_val = PATH_BUFFER_ERROR;
+        goto exit_path;
+    }
+
+    file = fopen(path, "w");
+    if (file == NULL) {
+        ret_val = F_OPEN_ERROR;
+        goto exit_path;
+    }
+
+    ret_val = (fputs(line, file) < 0)? F_WRITE_ERROR : EXIT_OK;
+
+    if (fclose(file) != 0 && ret_val == EXIT_OK) {
+        ret_val = F_WRITE_ERROR;
+    }
+
+    exit_path:
+        free(path);
+    exit_normal:
+        return ret_val;
+}
+
+// Sidecars follow md5sum/sha1sum and SFV conventions so the usual tools can
+// check the ISO against them.
+error_state_t write_digests(iso_digest_t *digest, const char *iso_path) {
+
+    error_state_t ret_val;
+    const char *name;
+    size_t name_length;
+    char md5_hex[0x21], sha1_hex[0x29];
+    char line[MAX_PATH_LEN + 0x40];
+
+    cwk_path_get_basename(iso_path, &name, &name_length);
+    if (name == NULL) {
+        name = iso_path;
+        name_length = strlen(iso_path);
+    }
+
+    hex_string(md5_hex, digest->md5_sum, 0x10);
+    hex_string(sha1_hex, digest->sha1_sum, 0x14);
+
+    printf("\n< Digests >\n");
+    printf("\tSize: %lld\n", (long long) digest->length);
+    printf("\tCRC32: %08lx\n", digest->crc);
+    printf("\tMD5: %s\n", md5_hex);
+    printf("\tSHA-1: %s\n\n", sha1_hex);
+
+    // A streamed ISO has nowhere to put them
+    if (strcmp(iso_path, "-") == 0) {
+        return EXIT_OK;
+    }
+
+    snprintf(line, sizeof(line), "%s  %.*s\n", md5_hex, (int) name_length, name);
+    ret_val = write_sidecar(iso_path, "md5", line);
+    if (ret_val != EXIT_OK) {
+        return ret_val;
+    }
+
+    snprintf(line, sizeof(line), "%s  %.*s\n", sha1_hex, (int) name_length, name);
+    ret_val = write_sidecar(iso_path, "sha1", line);
+    if (ret_val != EXIT_OK) {
+        return ret_val;
+    }
+
+    snprintf(line, sizeof(line), "%.*s %08lX\n", (int) name_length, name, digest->crc);
+    return write_sidecar(iso_path, "sfv", line);
+}
+
+// Sidecars that no longer describe the ISO are worse than none
+void remove_digests(const char *iso_path) {
+
+    const char *extensions[] = {"md5", "sha1", "sfv"};
+    char path[MAX_PATH_LEN];
+
+    for (int index = 0; index < 3; index++) {
+        if (snprintf(path, MAX_PATH_LEN, "%s.%s", iso_path, extensions[index]) < MAX_PATH_LEN) {
+            unlink(path);
+        }
+    }
+}
+
+// Whether every sidecar write_digests leaves next to the ISO is there
+bool have_digests(const char *iso_path) {
+
+    const char *extensions[] = {"md5", "sha1", "sfv"};
+    char path[MAX_PATH_LEN];
+
+    for (int index = 0; index < 3; index++) {
+        if (snprintf(path, MAX_PATH_LEN, "%s.%s", iso_path, extensions[index]) >= MAX_PATH_LEN ||
+                access(path, F_OK) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void digest_free(iso_digest_t *digest) {
+    mbedtls_md5_free(&digest->md5);
+    mbedtls_sha1_free(&digest->sha1);
+}
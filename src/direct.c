@@ -0,0 +1,387 @@
+#define _GNU_SOURCE
+#define _XOPEN_SOURCE 700
+#define _FILE_OFFSET_BITS 64
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "direct.h"
+#include "rebuild.h"
+#include "layout.h"
+#include "observe.h"
+#include "iso.h"
+#include "util.h"
+
+typedef struct {
+    dir_record_t *source;
+    int fd;
+    bool direct;
+
+} direct_source_t;
+
+static
+int open_direct(const char *path, int flags, mode_t mode, bool *direct) {
+
+    int fd;
+
+    fd = open(path, flags | O_DIRECT, mode);
+    if (fd == -1 && errno == EINVAL) {
+        // Filesystems like tmpfs refuse O_DIRECT, drop the cache by hand there
+        fd = open(path, flags, mode);
+        *direct = false;
+        return fd;
+    }
+
+    *direct = (fd != -1);
+    return fd;
+}
+
+static
+error_state_t flush_block(direct_writer_t *writer) {
+
+    error_state_t ret_val;
+
+    ret_val = write_fd_full(writer->fd, writer->buffer, writer->size, writer->base);
+    if (ret_val != EXIT_OK) {
+        return ret_val;
+    }
+
+    if (!writer->direct) {
+        fdatasync(writer->fd);
+        posix_fadvise(writer->fd, writer->base, writer->size, POSIX_FADV_DONTNEED);
+    }
+
+    writer->base += writer->size;
+    writer->used = 0;
+    return EXIT_OK;
+}
+
+static
+error_state_t append_data(direct_writer_t *writer, const char *data, size_t length) {
+
+    error_state_t ret_val;
+    size_t copy_size;
+
+    while (length > 0) {
+        copy_size = min(length, writer->size - writer->used);
+        memcpy(writer->buffer + writer->used, data, copy_size);
+
+        writer->used += copy_size;
+        data += copy_size;
+        length -= copy_size;
+
+        if (writer->used == writer->size) {
+            ret_val = flush_block(writer);
+            if (ret_val != EXIT_OK) {
+                return ret_val;
+            }
+        }
+    }
+    return EXIT_OK;
+}
+
+// Whole transfer blocks that fall inside a gap are never staged, they are
+// left as a hole or reserved as-is. A reservation the filesystem refuses is
+// zeroed through the staging buffer, the descriptor may be O_DIRECT.
+static
+error_state_t append_gap(direct_writer_t *writer, off_t length) {
+
+    error_state_t ret_val;
+    off_t skip_size;
+    size_t zero_size;
+    bool staged;
+
+    staged = (writer->gap_mode == GAP_ZERO);
+    while (length > 0) {
+        if (writer->used == 0 && length >= writer->size && !staged) {
+            skip_size = length - (length % writer->size);
+
+            if (writer->gap_mode == GAP_SPARSE ||
+                    posix_fallocate(writer->fd, writer->base, skip_size) == 0) {
+                writer->base += skip_size;
+                length -= skip_size;
+                continue;
+            }
+            staged = true;
+        }
+
+        zero_size = min(length, writer->size - writer->used);
+        memset(writer->buffer + writer->used, 0, zero_size);
+
+        writer->used += zero_size;
+        length -= zero_size;
+
+        if (writer->used == writer->size) {
+            ret_val = flush_block(writer);
+            if (ret_val != EXIT_OK) {
+                return ret_val;
+            }
+        }
+    }
+    return EXIT_OK;
+}
+
+static
+error_state_t finish_writer(direct_writer_t *writer) {
+
+    error_state_t ret_val;
+    size_t aligned;
+    int flags;
+
+    aligned = writer->used - (writer->used % DIRECT_ALIGN);
+
+    ret_val = write_fd_full(writer->fd, writer->buffer, aligned, writer->base);
+    if (ret_val != EXIT_OK) {
+        return ret_val;
+    }
+
+    // The unaligned tail can't go through O_DIRECT
+    if (writer->used > aligned && writer->direct) {
+        flags = fcntl(writer->fd, F_GETFL);
+        if (flags == -1 || fcntl(writer->fd, F_SETFL, flags & ~O_DIRECT) != 0) {
+            return F_WRITE_ERROR;
+        }
+        writer->direct = false;
+    }
+
+    ret_val = write_fd_full(writer->fd, writer->buffer + aligned,
+                    writer->used - aligned, writer->base + aligned);
+    if (ret_val != EXIT_OK) {
+        return ret_val;
+    }
+
+    if (ftruncate(writer->fd, writer->base + writer->used) != 0) {
+        return F_WRITE_ERROR;
+    }
+
+    if (fdatasync(writer->fd) != 0) {
+        return F_WRITE_ERROR;
+    }
+    posix_fadvise(writer->fd, 0, 0, POSIX_FADV_DONTNEED);
+
+    return EXIT_OK;
+}
+
+// Reads [offset, offset+length) through aligned windows, since an O_DIRECT
+// read must start and end on the device block size. Only the last window of
+// a file may come back short. record is NULL for the header and footer.
+static
+error_state_t copy_source(rebuild_job_t *job, direct_writer_t *writer, char *read_buffer,
+                    int fd, off_t offset, off_t length, dir_record_t *record) {
+
+    error_state_t ret_val;
+    ssize_t obtained;
+    off_t window, skip, remaining;
+    size_t want, avail;
+
+    window = offset - (offset % DIRECT_ALIGN);
+    skip = offset - window;
+    remaining = length;
+
+    while (remaining > 0) {
+        want = min(writer->size, skip + remaining);
+        want += (DIRECT_ALIGN - want % DIRECT_ALIGN) % DIRECT_ALIGN;
+
+        obtained = pread(fd, read_buffer, want, window);
+        if (obtained < 0 && errno == EINTR) continue;
+        if (obtained < 0) {
+            ret_val = F_READ_ERROR;
+            goto exit_normal;
+        }
+
+        if (obtained <= skip) {
+            ret_val = F_SIZE_ERROR;
+            goto exit_normal;
+        }
+
+        avail = min(obtained - skip, remaining);
+        ret_val = append_data(writer, read_buffer + skip, avail);
+        if (ret_val != EXIT_OK) {
+            goto exit_normal;
+        }
+
+        if (record == NULL) {
+            ret_val = observe_data(job, read_buffer + skip, avail);
+        } else {
+            ret_val = observe_extent(job, record, length - remaining, read_buffer + skip, avail);
+        }
+        if (ret_val != EXIT_OK) {
+            goto exit_normal;
+        }
+
+        remaining -= avail;
+        window += obtained;
+        skip = 0;
+
+        if (remaining > 0 && obtained % DIRECT_ALIGN != 0) {
+            ret_val = F_SIZE_ERROR;
+            goto exit_normal;
+        }
+    }
+
+    ret_val = EXIT_OK;
+    exit_normal:
+        return ret_val;
+}
+
+static
+void close_source(direct_source_t *source) {
+    if (source->fd == -1) return;
+    if (!source->direct) {
+        posix_fadvise(source->fd, 0, 0, POSIX_FADV_DONTNEED);
+    }
+    close(source->fd);
+    source->fd = -1;
+    source->source = NULL;
+}
+
+static
+error_state_t open_source(direct_source_t *source, rebuild_job_t *job,
+                    dir_record_t *record, char *path) {
+
+    error_state_t ret_val;
+    dir_record_t *lead;
+
+    lead = (record->lead_extent != NULL)? record->lead_extent : record;
+    if (source->source == lead) {
+        ret_val = EXIT_OK;
+        goto exit_normal;
+    }
+    close_source(source);
+
+    ret_val = build_full_path(path, MAX_PATH_LEN, job->folder_path, record);
+    if (ret_val != EXIT_OK) {
+        goto exit_normal;
+    }
+
+    source->fd = open_direct(path, O_RDONLY, 0, &source->direct);
+    if (source->fd == -1) {
+        ret_val = F_OPEN_ERROR;
+        goto exit_normal;
+    }
+    source->source = lead;
+
+    ret_val = EXIT_OK;
+    exit_normal:
+        return ret_val;
+}
+
+static
+error_state_t write_segments(rebuild_job_t *job, direct_writer_t *writer,
+                    char *read_buffer, char *path) {
+
+    error_state_t ret_val;
+    iso_segment_t *segment;
+    direct_source_t source;
+
+    source.fd = -1;
+    source.source = NULL;
+
+    for (int index = 0; index < job->layout->length; index++) {
+        segment = &job->layout->segments[index];
+
+        switch (segment->kind) {
+            case SEG_HEADER:
+                ret_val = copy_source(job, writer, read_buffer, fileno(job->info->header),
+                                0, segment->length, NULL);
+                break;
+            case SEG_FOOTER:
+                ret_val = copy_source(job, writer, read_buffer, fileno(job->info->footer),
+                                0, segment->length, NULL);
+                break;
+            case SEG_GAP:
+                ret_val = observe_gap(job, segment->length);
+                if (ret_val != EXIT_OK) break;
+
+                ret_val = append_gap(writer, segment->length);
+                break;
+            case SEG_EXTENT:
+                printf("%s\n", segment->record->file_id);
+                ret_val = open_source(&source, job, segment->record, path);
+                if (ret_val != EXIT_OK) break;
+
+                ret_val = copy_source(job, writer, read_buffer, source.fd,
+                                segment->record->file_offset, segment->length,
+                                segment->record);
+                break;
+        }
+
+        if (ret_val != EXIT_OK) {
+            goto exit_normal;
+        }
+    }
+
+    ret_val = finish_writer(writer);
+
+    exit_normal:
+        close_source(&source);
+        return ret_val;
+}
+
+error_state_t direct_rebuild(rebuild_job_t *job, char *output_path) {
+
+    error_state_t ret_val;
+    direct_writer_t writer;
+    char *read_buffer, *path;
+
+    if (job == NULL || output_path == NULL || job->layout == NULL) {
+        ret_val = ARG_ERROR;
+        goto exit_early;
+    }
+
+    writer.size = job->opts->transfer_size;
+    if (writer.size == 0 || writer.size % DIRECT_ALIGN != 0) {
+        ret_val = ARG_ERROR;
+        goto exit_early;
+    }
+
+    writer.used = 0;
+    writer.base = 0;
+    writer.gap_mode = job->opts->gap_mode;
+
+    path = malloc(MAX_PATH_LEN);
+    if (path == NULL) {
+        ret_val = ALLOC_ERROR;
+        goto exit_early;
+    }
+
+    if (posix_memalign((void **) &writer.buffer, DIRECT_ALIGN, writer.size) != 0) {
+        ret_val = ALLOC_ERROR;
+        goto exit_path;
+    }
+
+    if (posix_memalign((void **) &read_buffer, DIRECT_ALIGN, writer.size) != 0) {
+        ret_val = ALLOC_ERROR;
+        goto exit_writer;
+    }
+
+    writer.fd = open_direct(output_path, O_WRONLY | O_CREAT | O_TRUNC, 0666, &writer.direct);
+    if (writer.fd == -1) {
+        ret_val = F_OPEN_ERROR;
+        goto exit_read;
+    }
+
+    ret_val = write_segments(job, &writer, read_buffer, path);
+
+    if (close(writer.fd) != 0 && ret_val == EXIT_OK) {
+        ret_val = F_WRITE_ERROR;
+    }
+
+    exit_read:
+        free(read_buffer);
+    exit_writer:
+        free(writer.buffer);
+    exit_path:
+        free(path);
+    exit_early:
+        return ret_val;
+}
@@ -37,6 +37,24 @@ const char *error_info[ERROR_COUNT] = {
     "Path buffer error",
     "File list buffer error",
 
+    "Thread creation error",
+
+    "io_uring setup error",
+    "io_uring submission error",
+
+    "SHA-1 initialization error",
+    "SHA-1 update error",
+    "SHA-1 finalization error",
+
+    "Malformed region table",
+    "Output doesn't match the IRD region hashes",
+
+    "Unusable checkpoint journal",
+    "Unusable rebuild manifest",
+    "Can't mount the virtual ISO",
+    "Network server error",
+    "Files don't match the IRD",
+
 };
 
 void get_error_message(char **msg, error_state_t error_state) {
@@ -45,9 +63,5 @@ void get_error_message(char **msg, error_state_t error_state) {
         error_state = UNKNOWN_ERROR;
     }
 
-    for (int i = 0; i < ERROR_COUNT; i++) {
-        printf("%d: %s\n", i, error_info[i]);
-    }
-
     *msg = (char *) error_info[error_state];
 }
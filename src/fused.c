@@ -0,0 +1,215 @@
+#define _XOPEN_SOURCE 700
+#define _FILE_OFFSET_BITS 64
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "fused.h"
+#include "rebuild.h"
+#include "iso.h"
+#include "util.h"
+#include "hash.h"
+
+static
+void drop_context(dir_record_t *lead) {
+    if (lead->ctx == NULL) return;
+    hash_md5_free(lead->ctx);
+    free(lead->ctx);
+    lead->ctx = NULL;
+}
+
+static
+error_state_t start_context(dir_record_t *lead) {
+
+    error_state_t ret_val;
+
+    lead->ctx = malloc(sizeof(*lead->ctx));
+    if (lead->ctx == NULL) {
+        ret_val = ALLOC_ERROR;
+        goto exit_normal;
+    }
+
+    ret_val = hash_md5_init(lead->ctx);
+    if (ret_val != EXIT_OK) {
+        free(lead->ctx);
+        lead->ctx = NULL;
+        goto exit_normal;
+    }
+
+    ret_val = EXIT_OK;
+    exit_normal:
+        return ret_val;
+}
+
+static
+void settle_record(dir_record_t *lead, const uint8_t *checksum) {
+    lead->state = (memcmp(checksum, lead->hash, 0x10) == 0)? VERIFIED : MD5_MISMATCH;
+}
+
+// Size checks are cheap and decide which files are worth hashing at all
+error_state_t fused_begin(file_table_t *ft, const char *folder_path, bool *all_ok) {
+
+    error_state_t ret_val;
+    struct stat st;
+    dir_record_t *cur;
+    char *full_path;
+
+    if (ft == NULL || folder_path == NULL || all_ok == NULL) {
+        ret_val = ARG_ERROR;
+        goto exit_normal;
+    }
+
+    full_path = malloc(MAX_PATH_LEN);
+    if (full_path == NULL) {
+        ret_val = ALLOC_ERROR;
+        goto exit_normal;
+    }
+
+    *all_ok = true;
+
+    for (int index = 0; index < ft->length; index++) {
+        cur = ft->table[index];
+        if (cur->lead_extent != NULL) continue;
+
+        cur->ctx_offset = 0;
+
+        ret_val = build_full_path(full_path, MAX_PATH_LEN, folder_path, cur);
+        if (ret_val != EXIT_OK) {
+            goto exit_full;
+        }
+
+        if (stat(full_path, &st) == -1 || !S_ISREG(st.st_mode)) {
+            cur->state = MISSING;
+            *all_ok = false;
+            continue;
+        }
+
+        if (st.st_size != cur->total_length) {
+            cur->state = SZ_MISMATCH;
+            *all_ok = false;
+            continue;
+        }
+        cur->state = EMPTY;
+    }
+
+    ret_val = EXIT_OK;
+    exit_full:
+        free(full_path);
+    exit_normal:
+        return ret_val;
+}
+
+// offset is relative to the start of the extent. Data that doesn't continue
+// the running digest of its file gives up on the digest, that file is hashed
+// from disk by fused_finish instead.
+error_state_t fused_update(dir_record_t *record, off_t offset, const char *data, size_t length) {
+
+    error_state_t ret_val;
+    dir_record_t *lead;
+    uint8_t checksum[0x10];
+
+    lead = (record->lead_extent != NULL)? record->lead_extent : record;
+    if (lead->state != EMPTY || lead->ctx_offset < 0) {
+        ret_val = EXIT_OK;
+        goto exit_normal;
+    }
+
+    if (record->file_offset + offset != lead->ctx_offset) {
+        drop_context(lead);
+        lead->ctx_offset = -1;
+        ret_val = EXIT_OK;
+        goto exit_normal;
+    }
+
+    if (lead->ctx == NULL) {
+        ret_val = start_context(lead);
+        if (ret_val != EXIT_OK) {
+            goto exit_normal;
+        }
+    }
+
+    ret_val = hash_md5_update(lead->ctx, data, length);
+    if (ret_val != EXIT_OK) {
+        goto exit_normal;
+    }
+    lead->ctx_offset += length;
+
+    if (lead->ctx_offset < lead->total_length) {
+        ret_val = EXIT_OK;
+        goto exit_normal;
+    }
+
+    ret_val = hash_md5_finish(lead->ctx, checksum);
+    if (ret_val != EXIT_OK) {
+        goto exit_context;
+    }
+    settle_record(lead, checksum);
+    ret_val = EXIT_OK;
+
+    exit_context:
+        drop_context(lead);
+    exit_normal:
+        return ret_val;
+}
+
+error_state_t fused_finish(file_table_t *ft, const char *folder_path, bool *all_ok) {
+
+    error_state_t ret_val;
+    uint8_t checksum[0x10];
+    dir_record_t *cur;
+    char *full_path;
+
+    if (ft == NULL || folder_path == NULL || all_ok == NULL) {
+        ret_val = ARG_ERROR;
+        goto exit_normal;
+    }
+
+    full_path = malloc(MAX_PATH_LEN);
+    if (full_path == NULL) {
+        ret_val = ALLOC_ERROR;
+        goto exit_normal;
+    }
+
+    for (int index = 0; index < ft->length; index++) {
+        cur = ft->table[index];
+        if (cur->lead_extent != NULL) continue;
+
+        if (cur->state == EMPTY) {
+            drop_context(cur);
+
+            ret_val = build_full_path(full_path, MAX_PATH_LEN, folder_path, cur);
+            if (ret_val != EXIT_OK) {
+                goto exit_full;
+            }
+
+            ret_val = calc_checksum(checksum, full_path);
+            if (ret_val != EXIT_OK) {
+                goto exit_full;
+            }
+            settle_record(cur, checksum);
+        }
+
+        if (cur->state != VERIFIED) {
+            *all_ok = false;
+        }
+    }
+
+    ret_val = EXIT_OK;
+    exit_full:
+        free(full_path);
+    exit_normal:
+        return ret_val;
+}
+
+void fused_free(file_table_t *ft) {
+    for (int index = 0; index < ft->length; index++) {
+        drop_context(ft->table[index]);
+    }
+}
@@ -0,0 +1,259 @@
+#define _XOPEN_SOURCE 700
+#define _FILE_OFFSET_BITS 64
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <mbedtls/md5.h>
+
+#ifdef HAVE_OPENSSL
+#include <openssl/evp.h>
+#endif
+
+#include "hash.h"
+#include "md5.h"
+#include "md5mb.h"
+#include "util.h"
+
+// Picked once at startup, before any thread hashes anything
+static hash_backend_t selected = HASH_MBEDTLS;
+static bool lanes = true;
+
+bool hash_available(hash_backend_t backend) {
+    switch (backend) {
+        case HASH_AUTO:
+        case HASH_MBEDTLS:
+        case HASH_BUILTIN:
+            return true;
+        case HASH_OPENSSL:
+#ifdef HAVE_OPENSSL
+            return true;
+#else
+            return false;
+#endif
+    }
+    return false;
+}
+
+const char *hash_name(hash_backend_t backend) {
+    switch (backend) {
+        case HASH_AUTO:
+            return "auto";
+        case HASH_MBEDTLS:
+            return "mbedtls";
+        case HASH_OPENSSL:
+            return "openssl";
+        case HASH_BUILTIN:
+            return "builtin";
+    }
+    return "unknown";
+}
+
+hash_backend_t hash_backend(void) {
+    return selected;
+}
+
+// Whether verification spreads many files over the built-in SIMD lanes
+// instead of hashing them one stream at a time on the selected backend
+bool hash_lanes(void) {
+    return lanes;
+}
+
+static
+double elapsed(struct timespec *start) {
+
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static
+error_state_t measure(hash_backend_t backend, const char *buffer, double *rate) {
+
+    error_state_t ret_val;
+    hash_md5_t hash;
+    uint8_t checksum[0x10];
+    struct timespec start;
+    double seconds;
+
+    selected = backend;
+
+    // Left out of the timing, OpenSSL loads its provider on the first init
+    ret_val = hash_md5_init(&hash);
+    if (ret_val != EXIT_OK) {
+        return ret_val;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int round = 0; round < HASH_BENCH_ROUNDS; round++) {
+        ret_val = hash_md5_update(&hash, buffer, HASH_BENCH_SIZE);
+        if (ret_val != EXIT_OK) {
+            goto exit_hash;
+        }
+    }
+
+    ret_val = hash_md5_finish(&hash, checksum);
+    if (ret_val != EXIT_OK) {
+        goto exit_hash;
+    }
+
+    seconds = elapsed(&start);
+    *rate = (double) HASH_BENCH_SIZE * HASH_BENCH_ROUNDS / ((seconds > 0)? seconds : 1e-9);
+
+    exit_hash:
+        hash_md5_free(&hash);
+        return ret_val;
+}
+
+// A forced backend is used for everything. Otherwise every backend this
+// build has hashes the same buffer, the fastest one is kept, and the lanes
+// stay on for verification as long as they beat it per core.
+error_state_t hash_select(hash_backend_t requested) {
+
+    error_state_t ret_val;
+    hash_backend_t best;
+    double rate, best_rate, lane_rate;
+    char *buffer;
+
+    if (requested != HASH_AUTO) {
+        if (!hash_available(requested)) {
+            return ARG_ERROR;
+        }
+        selected = requested;
+        lanes = (requested == HASH_BUILTIN);
+        return EXIT_OK;
+    }
+
+    buffer = malloc(HASH_BENCH_SIZE);
+    if (buffer == NULL) {
+        return ALLOC_ERROR;
+    }
+    for (size_t index = 0; index < HASH_BENCH_SIZE; index++) {
+        buffer[index] = (char) (index * 0x9E3779B1 >> 24);
+    }
+
+    best = HASH_MBEDTLS;
+    best_rate = 0;
+    for (hash_backend_t backend = HASH_MBEDTLS; backend <= HASH_BUILTIN; backend++) {
+        if (!hash_available(backend)) continue;
+
+        ret_val = measure(backend, buffer, &rate);
+        if (ret_val != EXIT_OK) {
+            goto exit_buffer;
+        }
+        if (rate > best_rate) {
+            best = backend;
+            best_rate = rate;
+        }
+    }
+    selected = best;
+
+    ret_val = md5mb_measure(&lane_rate);
+    if (ret_val != EXIT_OK) {
+        goto exit_buffer;
+    }
+    lanes = (lane_rate > best_rate);
+
+    printf("Hashing with %s (%.0f MiB/s)", hash_name(best), best_rate / 0x100000);
+    if (lanes) {
+        printf(", verifying on %d MD5 lanes (%.0f MiB/s)", md5mb_lanes(), lane_rate / 0x100000);
+    }
+    printf("\n");
+
+    exit_buffer:
+        free(buffer);
+        return ret_val;
+}
+
+error_state_t hash_md5_init(hash_md5_t *hash) {
+
+    hash->backend = selected;
+
+    switch (hash->backend) {
+        case HASH_BUILTIN:
+            md5_builtin_init(&hash->ctx.builtin);
+            return EXIT_OK;
+
+#ifdef HAVE_OPENSSL
+        case HASH_OPENSSL:
+            hash->ctx.openssl = EVP_MD_CTX_new();
+            if (hash->ctx.openssl == NULL) {
+                return ALLOC_ERROR;
+            }
+            if (EVP_DigestInit_ex(hash->ctx.openssl, EVP_md5(), NULL) != 1) {
+                EVP_MD_CTX_free(hash->ctx.openssl);
+                hash->ctx.openssl = NULL;
+                return MD5_START_ERROR;
+            }
+            return EXIT_OK;
+#endif
+
+        default:
+            hash->backend = HASH_MBEDTLS;
+            mbedtls_md5_init(&hash->ctx.mbedtls);
+            if (mbedtls_md5_starts_ret(&hash->ctx.mbedtls) != 0) {
+                mbedtls_md5_free(&hash->ctx.mbedtls);
+                return MD5_START_ERROR;
+            }
+            return EXIT_OK;
+    }
+}
+
+error_state_t hash_md5_update(hash_md5_t *hash, const void *data, size_t length) {
+    switch (hash->backend) {
+        case HASH_BUILTIN:
+            md5_builtin_update(&hash->ctx.builtin, data, length);
+            return EXIT_OK;
+
+#ifdef HAVE_OPENSSL
+        case HASH_OPENSSL:
+            return (EVP_DigestUpdate(hash->ctx.openssl, data, length) == 1)? EXIT_OK : MD5_UPDT_ERROR;
+#endif
+
+        default:
+            return (mbedtls_md5_update_ret(&hash->ctx.mbedtls, data, length) == 0)? EXIT_OK : MD5_UPDT_ERROR;
+    }
+}
+
+error_state_t hash_md5_finish(hash_md5_t *hash, uint8_t *checksum) {
+    switch (hash->backend) {
+        case HASH_BUILTIN:
+            md5_builtin_finish(&hash->ctx.builtin, checksum);
+            return EXIT_OK;
+
+#ifdef HAVE_OPENSSL
+        case HASH_OPENSSL:
+            return (EVP_DigestFinal_ex(hash->ctx.openssl, checksum, NULL) == 1)? EXIT_OK : MD5_END_ERROR;
+#endif
+
+        default:
+            return (mbedtls_md5_finish_ret(&hash->ctx.mbedtls, checksum) == 0)? EXIT_OK : MD5_END_ERROR;
+    }
+}
+
+void hash_md5_free(hash_md5_t *hash) {
+    switch (hash->backend) {
+        case HASH_BUILTIN:
+            break;
+
+#ifdef HAVE_OPENSSL
+        case HASH_OPENSSL:
+            EVP_MD_CTX_free(hash->ctx.openssl);
+            hash->ctx.openssl = NULL;
+            break;
+#endif
+
+        default:
+            mbedtls_md5_free(&hash->ctx.mbedtls);
+            break;
+    }
+}
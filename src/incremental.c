@@ -0,0 +1,202 @@
+#define _XOPEN_SOURCE 700
+#define _FILE_OFFSET_BITS 64
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "incremental.h"
+#include "rebuild.h"
+#include "manifest.h"
+#include "fused.h"
+#include "iso.h"
+#include "util.h"
+
+static
+int compare_pointers(const void *a, const void *b) {
+    uintptr_t left = (uintptr_t) *(dir_record_t * const *) a;
+    uintptr_t right = (uintptr_t) *(dir_record_t * const *) b;
+    return (left > right) - (left < right);
+}
+
+// Gathers every extent of the files whose stats moved since the manifest,
+// keeping the sorted order of ft.
+error_state_t collect_changed(file_table_t *changed, file_table_t *ft,
+                    manifest_t *previous, manifest_t *current) {
+
+    error_state_t ret_val;
+    dir_record_t **leads, *lead;
+    uint32_t lead_count;
+
+    if (changed == NULL || ft == NULL || previous == NULL || current == NULL) {
+        ret_val = ARG_ERROR;
+        goto exit_normal;
+    }
+
+    changed->length = 0;
+    changed->table = malloc(sizeof(*changed->table) * (ft->length + 1));
+    if (changed->table == NULL) {
+        ret_val = ALLOC_ERROR;
+        goto exit_normal;
+    }
+
+    leads = malloc(sizeof(*leads) * (current->length + 1));
+    if (leads == NULL) {
+        ret_val = ALLOC_ERROR;
+        goto exit_early;
+    }
+
+    lead_count = 0;
+    for (uint32_t index = 0; index < current->length; index++) {
+        if (manifest_changed(previous, current, index)) {
+            leads[lead_count] = ft->table[current->entries[index].record];
+            lead_count += 1;
+        }
+    }
+    qsort(leads, lead_count, sizeof(*leads), compare_pointers);
+
+    for (uint32_t index = 0; index < ft->length; index++) {
+        lead = ft->table[index];
+        if (lead->lead_extent != NULL) lead = lead->lead_extent;
+
+        if (bsearch(&lead, leads, lead_count, sizeof(*leads), compare_pointers) != NULL) {
+            changed->table[changed->length] = ft->table[index];
+            changed->length += 1;
+        }
+    }
+
+    free(leads);
+    ret_val = EXIT_OK;
+    goto exit_normal;
+
+    exit_early:
+        free(changed->table);
+        changed->table = NULL;
+    exit_normal:
+        return ret_val;
+}
+
+static
+error_state_t open_lead(rebuild_job_t *job, dir_record_t *record, dir_record_t **source,
+                    int *fd, char *path) {
+
+    error_state_t ret_val;
+    dir_record_t *lead;
+
+    lead = (record->lead_extent != NULL)? record->lead_extent : record;
+    if (*source == lead) {
+        return EXIT_OK;
+    }
+
+    if (*fd != -1) {
+        close(*fd);
+        *fd = -1;
+        *source = NULL;
+    }
+
+    ret_val = build_full_path(path, MAX_PATH_LEN, job->folder_path, record);
+    if (ret_val != EXIT_OK) {
+        return ret_val;
+    }
+
+    *fd = open(path, O_RDONLY);
+    if (*fd == -1) {
+        return F_OPEN_ERROR;
+    }
+
+    *source = lead;
+    return EXIT_OK;
+}
+
+// Rewrites the extents in place, the rest of the ISO is left untouched. The
+// data also goes through the fused digests so the rewritten files are checked
+// against the IRD on the way.
+error_state_t patch_extents(rebuild_job_t *job, file_table_t *changed, int iso_fd, off_t *written) {
+
+    error_state_t ret_val;
+    dir_record_t *record, *source;
+    off_t offset, target;
+    ssize_t obtained;
+    size_t length;
+    char *buffer, *path;
+    int fd;
+
+    if (job == NULL || changed == NULL || written == NULL) {
+        ret_val = ARG_ERROR;
+        goto exit_normal;
+    }
+
+    buffer = malloc(PATCH_CHUNK_SIZE);
+    if (buffer == NULL) {
+        ret_val = ALLOC_ERROR;
+        goto exit_normal;
+    }
+
+    path = malloc(MAX_PATH_LEN);
+    if (path == NULL) {
+        ret_val = ALLOC_ERROR;
+        goto exit_buffer;
+    }
+
+    fd = -1;
+    source = NULL;
+    *written = 0;
+
+    for (uint32_t index = 0; index < changed->length; index++) {
+        record = changed->table[index];
+        printf("%s\n", record->file_id);
+
+        ret_val = open_lead(job, record, &source, &fd, path);
+        if (ret_val != EXIT_OK) {
+            goto exit_source;
+        }
+
+        target = extent_position(record, job->block_size);
+
+        for (offset = 0; offset < record->extent_length; offset += obtained) {
+            length = min(PATCH_CHUNK_SIZE, record->extent_length - offset);
+
+            obtained = pread(fd, buffer, length, record->file_offset + offset);
+            if (obtained < 0 && errno == EINTR) {
+                obtained = 0;
+                continue;
+            }
+            if (obtained < 0) {
+                ret_val = F_READ_ERROR;
+                goto exit_source;
+            }
+            if (obtained == 0) {
+                ret_val = F_SIZE_ERROR;
+                goto exit_source;
+            }
+
+            ret_val = write_fd_full(iso_fd, buffer, obtained, target + offset);
+            if (ret_val != EXIT_OK) {
+                goto exit_source;
+            }
+
+            ret_val = fused_update(record, offset, buffer, obtained);
+            if (ret_val != EXIT_OK) {
+                goto exit_source;
+            }
+            *written += obtained;
+        }
+    }
+
+    ret_val = EXIT_OK;
+    exit_source:
+        if (fd != -1) close(fd);
+        free(path);
+    exit_buffer:
+        free(buffer);
+    exit_normal:
+        return ret_val;
+}
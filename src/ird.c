@@ -11,11 +11,31 @@
 #include <string.h>
 #include <assert.h>
 #include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <zlib.h>
 
 #include "ird.h"
 #include "iso.h"
 #include "util.h"
+#include "rebuild.h"
+#include "pipeline.h"
+#include "uring.h"
+#include "zcopy.h"
+#include "layout.h"
+#include "direct.h"
+#include "fused.h"
+#include "observe.h"
+#include "digest.h"
+#include "region.h"
+#include "journal.h"
+#include "manifest.h"
+#include "incremental.h"
+#include "cso.h"
+#include "tee.h"
+#include "source.h"
+#include "verify.h"
+#include "vcache.h"
 #include "cwalk.h"
 
 static
@@ -116,20 +136,23 @@ error_state_t handle_ird_compressed(gzFile ird_file, const char *tmp_path,
 
     ret_val = decompress_to_path(ird_file, out_path, *length, &written);
     if (ret_val != EXIT_OK) {
-        goto exit_path;
+        goto exit_unlink;
     }
 
     if (written != *length) {
         ret_val = F_SIZE_ERROR;
-        goto exit_path;
+        goto exit_unlink;
     }
 
     out_file = gzopen(out_path, "r");
     if (out_file == NULL) {
         ret_val = FG_OPEN_ERROR;
-        goto exit_path;
+        goto exit_unlink;
     }
 
+    // Still readable through out_file, only the plain copy is kept
+    unlink(out_path);
+
     out_path[path_len-1] = '\0';
     ret_val = decompress_to_path(out_file, out_path, INT64_MAX, &written);
     if (ret_val != EXIT_OK) {
@@ -144,6 +167,8 @@ error_state_t handle_ird_compressed(gzFile ird_file, const char *tmp_path,
 
     exit_file:
         gzclose(out_file);
+    exit_unlink:
+        unlink(out_path);
     exit_path:
         free(out_path);
     exit_normal:
@@ -315,8 +340,10 @@ error_state_t load_ird(ird_t *ird, const char *ird_path, const char *tmp_path) {
     exit_reg:
         free(region_hashes);
     exit_footer:
+        unlink(footer_path);
         free(footer_path);
     exit_header:
+        unlink(header_path);
         free(header_path);
     exit_title:
         free(title);
@@ -326,6 +353,24 @@ error_state_t load_ird(ird_t *ird, const char *ird_path, const char *tmp_path) {
         return ret_val;
 }
 
+// Batch mode loads one IRD per disc, so nothing of it may outlive the disc
+void free_ird(ird_t *ird) {
+    free(ird->title);
+    free(ird->region_hashes);
+    free(ird->file_hashes);
+
+    if (ird->header_path != NULL) unlink(ird->header_path);
+    if (ird->footer_path != NULL) unlink(ird->footer_path);
+    free(ird->header_path);
+    free(ird->footer_path);
+
+    ird->title = NULL;
+    ird->region_hashes = NULL;
+    ird->file_hashes = NULL;
+    ird->header_path = NULL;
+    ird->footer_path = NULL;
+}
+
 static
 error_state_t attach_checksums(ird_t *ird, file_table_t *ft) {
 
@@ -365,95 +410,6 @@ error_state_t attach_checksums(ird_t *ird, file_table_t *ft) {
         return ret_val;
 }
 
-static
-error_state_t verify_files(parse_info_t *info, file_table_t *ft,
-                  char *folder_path, bool *verified) {
-
-    error_state_t ret_val;
-    int stat_ret;
-    bool all_ok;
-    struct stat st;
-    uint8_t checksum [0x10];
-
-    dir_record_t *cur;
-    char *rel_path, *full_path;
-
-    if (info == NULL || ft == NULL || folder_path == NULL || verified == NULL) {
-        ret_val = -1;
-        goto exit_normal;
-    }
-
-    all_ok = true;
-
-    for (int index = 0; index < ft->length; index++) {
-        cur = ft->table[index];
-
-        if (cur->lead_extent != NULL) continue;
-
-        rel_path = malloc(MAX_PATH_LEN);
-        if (rel_path == NULL) {
-            ret_val = ALLOC_ERROR;
-            goto exit_normal;
-        }
-
-        ret_val = build_path(rel_path, MAX_PATH_LEN, cur);
-        if (ret_val != EXIT_OK) {
-            goto exit_rel;
-        }
-
-        full_path = malloc(MAX_PATH_LEN);
-        if (full_path == NULL) {
-            ret_val = ALLOC_ERROR;
-            goto exit_rel;
-        }
-
-        cwk_path_join(folder_path, rel_path, full_path, MAX_PATH_LEN);
-        free(rel_path);
-
-        stat_ret = stat(full_path, &st);
-        
-        if (stat_ret == -1 || !S_ISREG(st.st_mode)) {
-            cur->state = MISSING;
-            free(full_path);
-            all_ok = false;
-            continue;
-        }
-
-        if (st.st_size != cur->total_length) {
-            cur->state = SZ_MISMATCH;
-            free(full_path);
-            all_ok = false;
-            continue;
-        }
-
-        ret_val = calc_checksum(checksum, full_path);
-        if (ret_val != EXIT_OK) {
-            goto exit_full;
-        }
-        free(full_path);
-
-        if (memcmp(checksum, &cur->hash, 0x10) != 0) {
-            cur->state = MD5_MISMATCH;
-            all_ok = false;
-            continue;
-        }
-        cur->state = VERIFIED;
-    }
-
-    *verified = all_ok;
-    ret_val = EXIT_OK;
-    goto exit_normal;
-
-    exit_rel:
-        free(rel_path);
-        goto exit_normal;
-    exit_full:
-        free(full_path);
-        goto exit_normal;
-    exit_normal:
-        return ret_val;
-}
-
 error_state_t print_iso_list(ird_t *ird) {
 
     error_state_t ret_val;
@@ -481,7 +437,7 @@ error_state_t print_iso_list(ird_t *ird) {
         printf("\t%u %s\n", cur_record->block_offset, cur_record->dir_id);
     }
 
-    ret_val = build_file_list(&ft, &info, &dt, ird->file_count);
+    ret_val = build_file_list(&ft, &info, &dt, ird->file_count*2);
     if (ret_val != -1) {
         goto exit_normal;
     }
@@ -515,7 +471,10 @@ error_state_t print_validity_report(file_table_t *ft) {
         dir_record_t *cur = ft->table[index];
         if (cur->lead_extent != NULL) continue;
 
-        if (cur->state != VERIFIED) {
+        // Files that were never checked, like after an aborted fused rebuild
+        if (cur->state == EMPTY) continue;
+
+        if (!verify_passed(cur->state)) {
             path = malloc(MAX_PATH_LEN);
             if (path == NULL) {
                 ret_val = ALLOC_ERROR;
@@ -542,15 +501,16 @@ error_state_t print_validity_report(file_table_t *ft) {
         return ret_val;
 }
 
-error_state_t print_verification(ird_t *ird, char *folder_path) {
+error_state_t print_verification(ird_t *ird, char *folder_path, verify_opts_t *opts, bool *passed) {
 
     error_state_t ret_val;
     parse_info_t info;
     dir_table_t dt;
     file_table_t ft;
-    bool all_ok;
+    vcache_t cache;
+    bool all_ok, complete;
 
-    if (ird == NULL || folder_path == NULL) {
+    if (ird == NULL || folder_path == NULL || opts == NULL) {
         ret_val = ARG_ERROR;
         goto exit_normal;
     }
@@ -562,183 +522,716 @@ error_state_t print_verification(ird_t *ird, char *folder_path) {
 
     ret_val = build_dir_list(&dt, &info);
     if (ret_val != EXIT_OK) {
-        goto exit_normal;
+        goto exit_traverse;
     }
     sort_dir_list(&dt);
 
-    ret_val = build_file_list(&ft, &info, &dt, ird->file_count);
+    ret_val = build_file_list(&ft, &info, &dt, ird->file_count*2);
     if (ret_val != EXIT_OK) {
-        goto exit_normal;
+        goto exit_dirs;
     }
     sort_file_list(&ft);
 
     ret_val = attach_checksums(ird, &ft);
     if (ret_val != EXIT_OK) {
-        goto exit_normal;
+        goto exit_files;
+    }
+
+    if (opts->cache_path != NULL) {
+        ret_val = vcache_init(&cache, opts->cache_path, ird->uid, ird->crc, folder_path);
+        if (ret_val != EXIT_OK) {
+            goto exit_files;
+        }
     }
 
-    ret_val = verify_files(&info, &ft, folder_path, &all_ok);
+    ret_val = verify_files(&ft, folder_path, opts, (opts->cache_path != NULL)? &cache : NULL,
+                    &all_ok, &complete);
     if (ret_val != EXIT_OK) {
         printf("F5\n");
-        goto exit_normal;
+        goto exit_cache;
+    }
+
+    // A cache that can't be written only costs the next run its shortcut
+    if (opts->cache_path != NULL) {
+        printf("%u files unchanged since their last check, not read again\n", cache.hits);
+        if (vcache_save(&cache, complete) != EXIT_OK) {
+            printf("Can't update the verification cache %s\n", opts->cache_path);
+        }
+    }
+
+    if (passed != NULL) {
+        *passed = all_ok;
     }
 
     if (all_ok) {
-        printf("\n< No issues to report >\n\n");
+        printf("\n< No issues to report >\n");
+        if (opts->mode == VERIFY_SAMPLE) {
+            printf("Large files were only sampled\n");
+        } else if (opts->mode == VERIFY_SIZE) {
+            printf("Only presence and sizes were checked\n");
+        }
+        printf("\n");
         ret_val = EXIT_OK;
-        goto exit_normal;
+        goto exit_cache;
     }
 
     ret_val = print_validity_report(&ft);
     if (ret_val != EXIT_OK) {
         printf("F6\n");
-        goto exit_normal;
+        goto exit_cache;
+    }
+
+    if (opts->fail_fast) {
+        printf("Stopped at the first problem, the remaining files weren't checked\n");
     }
 
     ret_val = EXIT_OK;
+    exit_cache:
+        if (opts->cache_path != NULL) {
+            vcache_free(&cache);
+        }
+    exit_files:
+        free_file_list(&ft);
+    exit_dirs:
+        free_dir_list(&dt);
+    exit_traverse:
+        free_traverse(&info);
     exit_normal:
         return ret_val;
 }
 
-error_state_t rebuild_iso(ird_t *ird, char *folder_path, char *output_path) {
+// Sources come from the cache, so a file split over several extents is
+// opened once and read front to back while its data is scattered in order.
+static
+error_state_t copy_extents(rebuild_job_t *job, FILE *iso_file) {
 
     error_state_t ret_val;
-    uint16_t block_size;
-    parse_info_t info;
-    dir_table_t dt;
-    file_table_t ft;
-    off_t obtained;
-    int str_ret;
+    off_t obtained, gap, position;
+    observe_cursor_t cursor;
+    source_cache_t cache;
 
-    char *full_path, *rel_path;
     dir_record_t *cur_record;
-    FILE *iso_file, *cur_file;
+    FILE *cur_file;
 
-    if (ird == NULL || folder_path == NULL || output_path == NULL) {
-        ret_val = ARG_ERROR;
+    ret_val = source_init(&cache, job->ft, job->folder_path);
+    if (ret_val != EXIT_OK) {
+        goto exit_cache;
+    }
+
+    position = job->start_offset;
+    for (int index = job->first_record; index < job->ft->length; index++) {
+        cur_record = job->ft->table[index];
+
+        ret_val = journal_tick(job->journal, iso_file, index, position);
+        if (ret_val != EXIT_OK) {
+            goto exit_cache;
+        }
+
+        printf("%s\n", cur_record->file_id);
+
+        gap = extent_position(cur_record, job->block_size) - position;
+
+        ret_val = observe_gap(job, gap);
+        if (ret_val != EXIT_OK) {
+            goto exit_cache;
+        }
+
+        ret_val = fill_gap_file(iso_file, gap, job->opts->gap_mode);
+        if (ret_val != EXIT_OK) {
+            goto exit_cache;
+        }
+
+        ret_val = source_get(&cache, index, &cur_file);
+        if (ret_val != EXIT_OK) {
+            goto exit_cache;
+        }
+
+        cursor.job = job;
+        cursor.record = cur_record;
+        cursor.offset = 0;
+        ret_val = tap_file_to_file(cur_file, iso_file, cur_record->extent_length, &obtained,
+                        observing(job)? observe_tap : NULL, &cursor);
+        if (ret_val != EXIT_OK) {
+            goto exit_cache;
+        }
+
+        if (obtained != cur_record->extent_length) {
+            ret_val = F_SIZE_ERROR;
+            goto exit_cache;
+        }
+        position += gap + obtained;
+
+        source_done(&cache, index, obtained);
+    }
+
+    ret_val = EXIT_OK;
+
+    exit_cache:
+        source_free(&cache);
+        return ret_val;
+}
+
+static
+error_state_t write_blob(rebuild_job_t *job, FILE *blob, FILE *iso_file) {
+
+    error_state_t ret_val;
+    off_t obtained;
+    observe_cursor_t cursor;
+
+    if (fseeko(blob, 0L, SEEK_SET) != 0) {
+        ret_val = F_SEEK_ERROR;
         goto exit_normal;
     }
 
-    ret_val = init_traverse(&info, ird->header_path, ird->footer_path);
-    if (ret_val != EXIT_OK) {
+    if (job->opts->backend == IO_COPY || job->opts->backend == IO_REFLINK) {
+        ret_val = zcopy_blob(blob, iso_file);
+    } else {
+        cursor.job = job;
+        cursor.record = NULL;
+        cursor.offset = 0;
+        ret_val = tap_file_to_file(blob, iso_file, INT64_MAX, &obtained,
+                        observing(job)? observe_tap : NULL, &cursor);
+    }
+
+    exit_normal:
+        return ret_val;
+}
+
+static
+error_state_t copy_with_backend(rebuild_job_t *job, FILE *iso_file) {
+
+    error_state_t ret_val;
+
+    if (job->opts->backend == IO_URING) {
+        ret_val = uring_copy(job, iso_file);
+        if (ret_val != URING_SETUP_ERROR) {
+            return ret_val;
+        }
+        printf("io_uring is unavailable, falling back to stdio\n");
+    }
+
+    if (job->opts->positional) {
+        return pipeline_positional(job, iso_file);
+    }
+
+    if (job->opts->backend == IO_COPY || job->opts->backend == IO_REFLINK) {
+        return zcopy_copy(job, iso_file);
+    }
+
+    if (job->opts->threads > 0) {
+        return pipeline_copy(job, iso_file);
+    }
+    return copy_extents(job, iso_file);
+}
+
+// Compression runs on its own pool, -j sizes it when given
+static
+int cso_threads(rebuild_opts_t *opts) {
+
+    long online;
+
+    if (opts->threads > 0) {
+        return opts->threads;
+    }
+
+    online = sysconf(_SC_NPROCESSORS_ONLN);
+    return (online > 0)? min(online, MAX_THREADS) : 1;
+}
+
+static
+error_state_t write_iso(rebuild_job_t *job, char *output_path) {
+
+    error_state_t ret_val;
+    cso_writer_t *cso;
+    tee_writer_t *tee;
+    FILE *iso_file;
+    char *paths[TEE_MAX_TARGETS];
+
+    if (job->opts->direct) {
+        ret_val = direct_rebuild(job, output_path);
         goto exit_normal;
     }
 
-    block_size = info.desc->block_size;
+    cso = NULL;
+    tee = NULL;
+    if (job->opts->tee_count > 0) {
+        paths[0] = output_path;
+        memcpy(paths + 1, job->opts->tee_paths, job->opts->tee_count * sizeof(*paths));
 
-    ret_val = build_dir_list(&dt, &info);
+        ret_val = tee_open(&tee, paths, job->opts->tee_count + 1);
+        if (ret_val != EXIT_OK) {
+            goto exit_normal;
+        }
+        iso_file = tee_stream(tee);
+    } else if (job->opts->cso_path != NULL) {
+        ret_val = cso_open(&cso, job->opts->cso_path, job->layout->total_size, cso_threads(job->opts));
+        if (ret_val != EXIT_OK) {
+            goto exit_normal;
+        }
+        iso_file = cso_stream(cso);
+    } else if (job->opts->stream && strcmp(output_path, "-") == 0) {
+        iso_file = fdopen(job->opts->stream_fd, "w");
+    } else if (job->resume_offset > 0) {
+        iso_file = fopen(output_path, "r+");
+    } else {
+        iso_file = fopen(output_path, "w");
+    }
+    if (iso_file == NULL) {
+        ret_val = F_OPEN_ERROR;
+        goto exit_cso;
+    };
+
+    if (job->resume_offset > 0) {
+        ret_val = (fseeko(iso_file, job->resume_offset, SEEK_SET) == 0)? EXIT_OK : F_SEEK_ERROR;
+        job->start_offset = job->resume_offset;
+    } else {
+        ret_val = write_blob(job, job->info->header, iso_file);
+        job->start_offset = job->layout->header_size;
+    }
+    if (ret_val != EXIT_OK) {
+        goto exit_iso;
+    }
+
+    ret_val = copy_with_backend(job, iso_file);
+    if (ret_val != EXIT_OK) {
+        goto exit_iso;
+    }
+
+    ret_val = write_blob(job, job->info->footer, iso_file);
     if (ret_val != EXIT_OK) {
+        goto exit_iso;
+    }
+
+    if (fflush(iso_file) != 0) {
+        ret_val = F_WRITE_ERROR;
+        goto exit_iso;
+    }
+
+    // A trailing hole left by seeking is only materialized by the truncate
+    if (!job->opts->stream && ftruncate(fileno(iso_file), ftello(iso_file)) != 0) {
+        ret_val = F_WRITE_ERROR;
+        goto exit_iso;
+    }
+
+    if (fclose(iso_file) != 0) {
+        ret_val = F_WRITE_ERROR;
+        goto exit_cso;
+    }
+
+    if (cso != NULL) {
+        ret_val = cso_finish(cso);
+    } else if (tee != NULL) {
+        ret_val = tee_finish(tee);
+    } else {
+        ret_val = EXIT_OK;
+    }
+    goto exit_cso;
+
+    exit_iso:
+        fclose(iso_file);
+    exit_cso:
+        if (cso != NULL) cso_free(cso);
+        if (tee != NULL) tee_free(tee);
+    exit_normal:
+        return ret_val;
+}
+
+// In fused mode the checksums come out of the copy itself, so the folder is
+// only read once. The report is still printed when the rebuild fails if the
+// size checks already explain why.
+static
+error_state_t report_fused(file_table_t *ft, char *folder_path,
+                    error_state_t rebuild_val, bool all_ok) {
+
+    error_state_t ret_val;
+
+    if (rebuild_val != EXIT_OK) {
+        fused_free(ft);
+        if (!all_ok) {
+            print_validity_report(ft);
+        }
+        return rebuild_val;
+    }
+
+    ret_val = fused_finish(ft, folder_path, &all_ok);
+    if (ret_val != EXIT_OK) {
+        fused_free(ft);
+        return ret_val;
+    }
+
+    if (all_ok) {
+        printf("\n< No issues to report >\n\n");
+        return EXIT_OK;
+    }
+    return print_validity_report(ft);
+}
+
+// Only the engines that write strictly in order have a single durable point
+static
+bool journal_supported(rebuild_opts_t *opts) {
+    return ordered_backend(opts) && !opts->direct && !opts->stream;
+}
+
+// A fresh rebuild drops any stale journal. A journal that doesn't fit this
+// rebuild or the ISO on disk is ignored and the rebuild starts over.
+static
+error_state_t resume_point(rebuild_job_t *job, bool resume) {
+
+    error_state_t ret_val;
+
+    if (!resume) {
+        journal_remove(job->journal);
+        return EXIT_OK;
+    }
+
+    ret_val = journal_load(job->journal, &job->first_record, &job->resume_offset);
+    if (ret_val == JOURNAL_ERROR) {
+        printf("No usable checkpoint journal, rebuilding from the start\n");
+        return EXIT_OK;
+    }
+
+    if (ret_val == EXIT_OK) {
+        printf("Resuming at record %u (offset %lld)\n", job->first_record,
+                (long long) job->resume_offset);
+    }
+    return ret_val;
+}
+
+// Rewrites the extents of the files that changed since the last rebuild into
+// the existing ISO. Everything else on disk is assumed to still match the
+// manifest, an ISO of the wrong size sends the caller back to a full rebuild.
+// *rewritten is the number of extents that were written again.
+static
+error_state_t update_in_place(rebuild_job_t *job, ird_t *ird, manifest_t *previous,
+                    manifest_t *current, char *output_path, uint32_t *rewritten) {
+
+    error_state_t ret_val;
+    file_table_t changed;
+    dir_record_t *record;
+    uint32_t file_count;
+    off_t written;
+    struct stat st;
+    bool all_ok;
+    int iso_fd;
+
+    *rewritten = 0;
+
+    if (stat(output_path, &st) != 0 || st.st_size != job->layout->total_size) {
+        ret_val = MANIFEST_ERROR;
         goto exit_normal;
     }
-    sort_dir_list(&dt);
 
-    ret_val = build_file_list(&ft, &info, &dt, ird->file_count*2);
+    ret_val = collect_changed(&changed, job->ft, previous, current);
     if (ret_val != EXIT_OK) {
         goto exit_normal;
     }
-    sort_file_list(&ft);
 
-    iso_file = fopen(output_path, "w");
-    if (iso_file == NULL) {
+    file_count = 0;
+    for (uint32_t index = 0; index < changed.length; index++) {
+        if (changed.table[index]->lead_extent == NULL) file_count += 1;
+    }
+    printf("%u of %u files changed\n", file_count, current->length);
+
+    if (changed.length == 0) {
+        if (job->regions != NULL) region_skip_pending(job->regions);
+        ret_val = EXIT_OK;
+        goto exit_changed;
+    }
+
+    ret_val = attach_checksums(ird, job->ft);
+    if (ret_val != EXIT_OK) {
+        goto exit_changed;
+    }
+
+    ret_val = fused_begin(&changed, job->folder_path, &all_ok);
+    if (ret_val != EXIT_OK) {
+        goto exit_changed;
+    }
+
+    iso_fd = open(output_path, O_RDWR);
+    if (iso_fd == -1) {
         ret_val = F_OPEN_ERROR;
+        goto exit_fused;
+    }
+
+    ret_val = patch_extents(job, &changed, iso_fd, &written);
+    if (ret_val == EXIT_OK && fdatasync(iso_fd) != 0) {
+        ret_val = F_WRITE_ERROR;
+    }
+
+    // Only the regions something was written to are read back
+    for (uint32_t index = 0; ret_val == EXIT_OK && job->regions != NULL && index < changed.length; index++) {
+        record = changed.table[index];
+        ret_val = region_verify_span(job->regions, iso_fd,
+                        extent_position(record, job->block_size),
+                        extent_position(record, job->block_size) + record->extent_length);
+    }
+    if (ret_val == EXIT_OK && job->regions != NULL) {
+        region_skip_pending(job->regions);
+    }
+
+    if (close(iso_fd) != 0 && ret_val == EXIT_OK) {
+        ret_val = F_WRITE_ERROR;
+    }
+
+    if (ret_val == EXIT_OK) {
+        printf("Rewrote %lld bytes in place\n", (long long) written);
+        *rewritten = changed.length;
+    }
+
+    ret_val = report_fused(&changed, job->folder_path, ret_val, all_ok);
+    goto exit_changed;
+
+    exit_fused:
+        fused_free(&changed);
+    exit_changed:
+        free(changed.table);
+    exit_normal:
+        return ret_val;
+}
+
+// The folder is checked with verify before a full rebuild. An ISO patched
+// in place skips that pass, its rewritten files are checked while copying
+// and the others were checked by the rebuild that saved the manifest.
+error_state_t rebuild_iso(ird_t *ird, char *folder_path, char *output_path,
+                    rebuild_opts_t *opts, verify_opts_t *verify) {
+
+    error_state_t ret_val;
+    parse_info_t info;
+    dir_table_t dt;
+    file_table_t ft;
+    iso_layout_t layout;
+    rebuild_job_t job;
+    iso_digest_t digest;
+    region_check_t regions;
+    journal_t journal;
+    manifest_t current, previous;
+    uint32_t rewritten;
+    bool all_ok, patched, kept_digests;
+
+    if (ird == NULL || folder_path == NULL || output_path == NULL || opts == NULL) {
+        ret_val = ARG_ERROR;
         goto exit_normal;
-    };
+    }
 
-    if (fseeko(info.header, 0L, SEEK_SET) != 0) {
-        ret_val = F_SEEK_ERROR;
+    if (opts->fused && !ordered_backend(opts)) {
+        ret_val = ARG_ERROR;
         goto exit_normal;
-    };
+    }
 
-    ret_val = write_file_to_file(info.header, iso_file, INT64_MAX, &obtained);
+    if (opts->resume && !journal_supported(opts)) {
+        ret_val = ARG_ERROR;
+        goto exit_normal;
+    }
+
+    // Nothing can be seeked, read back or patched afterwards
+    if (opts->stream && (!ordered_backend(opts) || opts->direct || opts->incremental ||
+            opts->gap_mode != GAP_ZERO)) {
+        ret_val = ARG_ERROR;
+        goto exit_normal;
+    }
+
+    // The copies share one ordered stream, they can't sit next to a CSO
+    if (opts->tee_count > 0 && (!opts->stream || opts->cso_path != NULL ||
+            opts->tee_count + 1 > TEE_MAX_TARGETS)) {
+        ret_val = ARG_ERROR;
+        goto exit_normal;
+    }
+
+    ret_val = init_traverse(&info, ird->header_path, ird->footer_path);
     if (ret_val != EXIT_OK) {
         goto exit_normal;
     }
 
-    for (int index = 0; index < ft.length; index++) {
-        cur_record = ft.table[index];
-        printf("%s\n", cur_record->file_id);
+    ret_val = build_dir_list(&dt, &info);
+    if (ret_val != EXIT_OK) {
+        goto exit_traverse;
+    }
+    sort_dir_list(&dt);
+
+    ret_val = build_file_list(&ft, &info, &dt, ird->file_count*2);
+    if (ret_val != EXIT_OK) {
+        goto exit_dirs;
+    }
+    sort_file_list(&ft);
+
+    ret_val = build_layout(&layout, &info, &ft);
+    if (ret_val != EXIT_OK) {
+        goto exit_files;
+    }
 
-        ret_val = zero_out_file(iso_file, cur_record->block_offset*block_size - ftell(iso_file));
+    job.info = &info;
+    job.ft = &ft;
+    job.layout = &layout;
+    job.folder_path = folder_path;
+    job.block_size = info.desc->block_size;
+    job.opts = opts;
+    job.digest = NULL;
+    job.regions = NULL;
+    job.journal = NULL;
+    job.first_record = 0;
+    job.resume_offset = 0;
+    job.start_offset = 0;
+    patched = false;
+    rewritten = 0;
+
+    if (opts->digests) {
+        ret_val = digest_init(&digest);
         if (ret_val != EXIT_OK) {
-            goto exit_normal;
+            goto exit_layout;
         }
+    }
 
-        assert(cur_record->block_offset*block_size == ftell(iso_file));
-
-        rel_path = malloc(MAX_PATH_LEN);
-        if (rel_path == NULL) {
-            ret_val = ALLOC_ERROR;
-            goto exit_normal;
+    if (opts->regions) {
+        ret_val = region_init(&regions, info.header, job.block_size,
+                        (const uint8_t *) ird->region_hashes, ird->region_count);
+        if (ret_val != EXIT_OK) {
+            goto exit_digest;
         }
+    }
 
-        ret_val = build_path(rel_path, MAX_PATH_LEN, cur_record);
+    if (opts->incremental) {
+        ret_val = manifest_scan(&current, &ft, folder_path, output_path,
+                        ird->uid, ird->crc, layout.total_size);
         if (ret_val != EXIT_OK) {
-            goto exit_rel;
+            goto exit_regions;
         }
 
-        full_path = malloc(MAX_PATH_LEN);
-        if (full_path == NULL) {
-            ret_val = ALLOC_ERROR;
-            goto exit_rel;
+        ret_val = manifest_load(&previous, &current);
+        if (ret_val == EXIT_OK) {
+            job.regions = opts->regions? &regions : NULL;
+            ret_val = update_in_place(&job, ird, &previous, &current, output_path, &rewritten);
+            job.regions = NULL;
+            manifest_free(&previous);
+            patched = (ret_val == EXIT_OK);
         }
 
-        str_ret = snprintf(full_path, MAX_PATH_LEN, "%s/%s", folder_path, rel_path);
+        // The manifest goes away until a full rebuild succeeds again
+        if (ret_val == MANIFEST_ERROR) {
+            printf("No usable manifest, rebuilding everything\n");
+            unlink(current.path);
+            ret_val = EXIT_OK;
+        }
+        if (ret_val != EXIT_OK) {
+            goto exit_manifest;
+        }
+    }
 
-        if (str_ret < 0) {
-            ret_val = ENCODING_ERROR;
-            goto exit_full;
+    if (verify != NULL && !patched) {
+        ret_val = print_verification(ird, folder_path, verify, NULL);
+        if (ret_val != EXIT_OK) {
+            goto exit_manifest;
         }
+    }
+
+    // Unordered engines get their output replayed once it has been written
+    if (ordered_backend(opts) && !patched) {
+        job.digest = opts->digests? &digest : NULL;
+        job.regions = opts->regions? &regions : NULL;
+    }
 
-        if (str_ret >= MAX_PATH_LEN) {
-            ret_val = PATH_BUFFER_ERROR;
-            goto exit_full;
+    if (journal_supported(opts) && !patched) {
+        ret_val = journal_init(&journal, output_path, ird->uid, ird->crc,
+                        layout.total_size, ft.length);
+        if (ret_val != EXIT_OK) {
+            goto exit_manifest;
         }
+        journal.digest = job.digest;
+        journal.regions = job.regions;
+        job.journal = &journal;
 
-        cur_file = fopen(full_path, "r");
-        if (cur_file == NULL) {
-            ret_val = F_OPEN_ERROR;
-            goto exit_full;
+        ret_val = resume_point(&job, opts->resume);
+        if (ret_val != EXIT_OK) {
+            goto exit_journal;
         }
+    }
 
-        if (fseeko(cur_file, cur_record->file_offset, SEEK_SET) != 0) {
-            ret_val = F_SEEK_ERROR;
-            goto exit_file;
+    if (opts->fused && !patched) {
+        ret_val = attach_checksums(ird, &ft);
+        if (ret_val != EXIT_OK) {
+            goto exit_journal;
         }
 
-        ret_val = write_file_to_file(cur_file, iso_file, cur_record->extent_length, &obtained);
+        ret_val = fused_begin(&ft, folder_path, &all_ok);
         if (ret_val != EXIT_OK) {
-            goto exit_file;
+            goto exit_journal;
         }
-        
-        if (obtained != cur_record->extent_length) {
-            ret_val = F_SIZE_ERROR;
-            goto exit_file;
+    }
+
+    if (!patched) {
+        if (opts->cso_path == NULL && strcmp(output_path, "-") != 0) {
+            manifest_remove(output_path);
+        }
+        ret_val = write_iso(&job, output_path);
+
+        // A failed rebuild keeps its journal for --resume
+        if (ret_val == EXIT_OK && job.journal != NULL) {
+            journal_remove(job.journal);
         }
 
-        fclose(cur_file);
-        free(full_path);
-        free(rel_path);
+        if (opts->fused) {
+            ret_val = report_fused(&ft, folder_path, ret_val, all_ok);
+        }
     }
 
-    if (fseeko(info.footer, 0L, SEEK_SET) != 0) {
-        ret_val = F_SEEK_ERROR;
-        goto exit_normal;
+    // Sidecars of an ISO nothing was written to still describe it
+    kept_digests = patched && rewritten == 0 && opts->digests && have_digests(output_path);
+    if (kept_digests) {
+        printf("Nothing was rewritten, keeping the existing digests\n");
     }
 
-    ret_val = write_file_to_file(info.footer, iso_file, INT64_MAX, &obtained);
-    if (ret_val != EXIT_OK) {
-        goto exit_normal;
+    // MD5 and SHA-1 can't be patched, the whole ISO is hashed again
+    if (ret_val == EXIT_OK && patched && opts->digests && !kept_digests) {
+        job.digest = &digest;
+
+        printf("Reading the updated ISO back\n");
+        ret_val = observe_file(&job, output_path);
+    } else if (ret_val == EXIT_OK && patched && rewritten > 0 && !opts->digests) {
+        remove_digests(output_path);
+    } else if (ret_val == EXIT_OK && !patched && !ordered_backend(opts) && (opts->digests || opts->regions)) {
+        job.digest = opts->digests? &digest : NULL;
+        job.regions = opts->regions? &regions : NULL;
+
+        printf("Reading the written ISO back\n");
+        ret_val = observe_file(&job, output_path);
     }
 
-    ret_val = EXIT_OK;
-    goto exit_normal;
+    if (ret_val == EXIT_OK && opts->digests && !kept_digests) {
+        ret_val = digest_finish(&digest);
+        if (ret_val == EXIT_OK) {
+            ret_val = write_digests(&digest, output_path);
+        }
+        for (int index = 0; ret_val == EXIT_OK && index < opts->tee_count; index++) {
+            ret_val = write_digests(&digest, opts->tee_paths[index]);
+        }
+    }
 
-    exit_file:
-        fclose(cur_file);
-    exit_rel:
-        free(rel_path);
-    exit_full:
-        free(full_path);
+    // A region mismatch fails the rebuild, the ISO is not a faithful copy
+    if (ret_val == EXIT_OK && opts->regions) {
+        ret_val = region_report(&regions);
+    }
+
+    // Saved last, a manifest must never describe an ISO that wasn't finished
+    if (ret_val == EXIT_OK && opts->incremental) {
+        ret_val = manifest_save(&current);
+    }
+
+    exit_journal:
+        if (job.journal != NULL) journal_free(job.journal);
+    exit_manifest:
+        if (opts->incremental) manifest_free(&current);
+    exit_regions:
+        if (opts->regions) region_free(&regions);
+    exit_digest:
+        if (opts->digests) digest_free(&digest);
+    exit_layout:
+        free_layout(&layout);
+    exit_files:
+        free_file_list(&ft);
+    exit_dirs:
+        free_dir_list(&dt);
+    exit_traverse:
+        free_traverse(&info);
     exit_normal:
         return ret_val;
 }
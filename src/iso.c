@@ -13,7 +13,7 @@
 #include "util.h"
 #include "iso.h"
 
-const char *state_info[5] = { "", "Missing", "Size Mismatch", "Checksum Mismatch", "Verified"};
+const char *state_info[7] = { "", "Missing", "Size Mismatch", "Checksum Mismatch", "Verified", "Sampled", "Present"};
 
 uint32_t ecma_int32(uint8_t *iso_num) {
     return (uint32_t) ((iso_num[0] & 0xff)
@@ -85,6 +85,7 @@ error_state_t ecma_to_dir(dir_record_t *record, ecma119_dir_record_t *ecma_recor
 
     record->file_offset = 0;
     record->block_offset = ecma_int32(&ecma_record->block[0]);
+    record->last_index = 0;
     record->extent_length = ecma_int32(&ecma_record->length[0]);
     record->total_length = 0;
 
@@ -95,6 +96,7 @@ error_state_t ecma_to_dir(dir_record_t *record, ecma119_dir_record_t *ecma_recor
 
     record->file_id = NULL;
     record->ctx = NULL;
+    record->ctx_offset = 0;
     record->state = EMPTY;
 
     return EXIT_OK;
@@ -341,6 +343,15 @@ error_state_t init_traverse(parse_info_t *info,
         return ret_val;
 }
 
+void free_traverse(parse_info_t *info) {
+    fclose(info->header);
+    fclose(info->footer);
+    free(info->desc);
+    info->header = NULL;
+    info->footer = NULL;
+    info->desc = NULL;
+}
+
 error_state_t build_path(char *buffer, int buffer_size, dir_record_t *record) {
 
     error_state_t ret_val;
@@ -421,6 +432,39 @@ error_state_t build_path(char *buffer, int buffer_size, dir_record_t *record) {
         return ret_val;
 }
 
+error_state_t build_full_path(char *buffer, int buffer_size,
+                    const char *folder_path, dir_record_t *record) {
+
+    error_state_t ret_val;
+    int str_ret;
+
+    if (buffer == NULL || folder_path == NULL || record == NULL) {
+        ret_val = ARG_ERROR;
+        goto exit_normal;
+    }
+
+    str_ret = snprintf(buffer, buffer_size, "%s/", folder_path);
+
+    if (str_ret < 0) {
+        ret_val = ENCODING_ERROR;
+        goto exit_normal;
+    }
+
+    if (str_ret >= buffer_size) {
+        ret_val = PATH_BUFFER_ERROR;
+        goto exit_normal;
+    }
+
+    ret_val = build_path(buffer + str_ret, buffer_size - str_ret, record);
+
+    exit_normal:
+        return ret_val;
+}
+
+off_t extent_position(dir_record_t *record, uint16_t block_size) {
+    return (off_t) record->block_offset * block_size;
+}
+
 static
 int compare_path_records(const void *a, const void *b) {
     path_table_record_t *rec_a = *((path_table_record_t **) a);
@@ -477,7 +521,7 @@ error_state_t handle_extent_record(parse_info_t *info, path_table_record_t *pare
     list_index = 0;
     block_size = info->desc->block_size;
     relative_offset = lead_extent->extent_length;
-    cur_offset = *header_position + lead_extent->extent_length;
+    cur_offset = *header_position + lead_extent->record_length;
 
     do {
         if (list_index >= max_extent_count) {
@@ -514,7 +558,7 @@ error_state_t handle_extent_record(parse_info_t *info, path_table_record_t *pare
     } while (ecma_has_extent(cur_record));
 
     *num_extents = list_index;
-    *header_position += cur_offset;
+    *header_position = cur_offset;
 
     ret_val = EXIT_OK;
     goto exit_normal;
@@ -557,12 +601,16 @@ error_state_t build_single_dir(parse_info_t *info, path_table_record_t *path_rec
 
     ret_val = retrieve_dir_record(dir_record, info, current_offset);
     if (ret_val != EXIT_OK) {
+        free(dir_record);
         goto exit_normal;
     }
 
+    // Only the extent of the folder is needed from its own record
     current_offset = dir_record->block_offset * block_size;
     target_offset = current_offset + dir_record->extent_length;
     list_index = 0;
+    free_dir_record(dir_record);
+    free(dir_record);
 
     while (current_offset < target_offset) {
 
@@ -575,18 +623,23 @@ error_state_t build_single_dir(parse_info_t *info, path_table_record_t *path_rec
         ret_val = retrieve_dir_record(cur_record, info, current_offset);
         if (ret_val == RECORD_FIT_ERROR) {
             current_offset += block_size - (current_offset % block_size);
+            free(cur_record);
             continue;
         } else if (ret_val != EXIT_OK) {
+            free(cur_record);
             goto exit_early;
         }
 
         if (ecma_is_dir(cur_record)) {
             current_offset += cur_record->record_length;
             free_dir_record(cur_record);
+            free(cur_record);
             continue;
         }
 
         if (list_index >= max_file_count) {
+            free_dir_record(cur_record);
+            free(cur_record);
             ret_val = FILE_LIST_BUFFER_ERROR;
             goto exit_early;
         }
@@ -606,6 +659,7 @@ error_state_t build_single_dir(parse_info_t *info, path_table_record_t *path_rec
             if (ret_val != EXIT_OK) {
                 goto exit_early;
             }
+            list_index += num_extents;
 
         } else {
             current_offset += cur_record->record_length;
@@ -741,3 +795,19 @@ void free_path_record(path_table_record_t *rec) {
 void free_dir_record(dir_record_t *rec) {
     if (rec->file_id != NULL) free(rec->file_id);
 }
+
+void free_dir_list(dir_table_t *table_wrapper) {
+    if (table_wrapper->table == NULL) return;
+    free_list_items(table_wrapper->table, table_wrapper->length, free_path_record);
+    free(table_wrapper->table);
+    table_wrapper->table = NULL;
+    table_wrapper->length = 0;
+}
+
+void free_file_list(file_table_t *table_wrapper) {
+    if (table_wrapper->table == NULL) return;
+    free_list_items(table_wrapper->table, table_wrapper->length, free_dir_record);
+    free(table_wrapper->table);
+    table_wrapper->table = NULL;
+    table_wrapper->length = 0;
+}
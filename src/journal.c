@@ -0,0 +1,302 @@
+#define _XOPEN_SOURCE 700
+#define _FILE_OFFSET_BITS 64
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "journal.h"
+#include "digest.h"
+#include "region.h"
+#include "util.h"
+
+error_state_t journal_init(journal_t *journal, const char *iso_path, uint32_t uid, uint32_t crc,
+                    off_t total_size, uint32_t record_count) {
+
+    error_state_t ret_val;
+
+    if (journal == NULL || iso_path == NULL) {
+        ret_val = ARG_ERROR;
+        goto exit_normal;
+    }
+
+    memset(journal, 0, sizeof(*journal));
+    journal->iso_path = iso_path;
+    journal->uid = uid;
+    journal->crc = crc;
+    journal->total_size = total_size;
+    journal->record_count = record_count;
+
+    journal->path = malloc(MAX_PATH_LEN);
+    if (journal->path == NULL) {
+        ret_val = ALLOC_ERROR;
+        goto exit_normal;
+    }
+
+    journal->tmp_path = malloc(MAX_PATH_LEN);
+    if (journal->tmp_path == NULL) {
+        ret_val = ALLOC_ERROR;
+        goto exit_path;
+    }
+
+    if (snprintf(journal->path, MAX_PATH_LEN, "%s.journal", iso_path) >= MAX_PATH_LEN ||
+            snprintf(journal->tmp_path, MAX_PATH_LEN, "%s.journal.tmp", iso_path) >= MAX_PATH_LEN) {
+        ret_val = PATH_BUFFER_ERROR;
+        goto exit_tmp;
+    }
+
+    ret_val = EXIT_OK;
+    goto exit_normal;
+
+    exit_tmp:
+        free(journal->tmp_path);
+        journal->tmp_path = NULL;
+    exit_path:
+        free(journal->path);
+        journal->path = NULL;
+    exit_normal:
+        return ret_val;
+}
+
+static
+void fill_head(journal_t *journal, journal_head_t *head, uint32_t record, off_t offset) {
+    memset(head, 0, sizeof(*head));
+    memcpy(head->magic, JOURNAL_MAGIC, sizeof(head->magic));
+    head->digest_size = sizeof(iso_digest_t);
+    head->context_size = sizeof(mbedtls_md5_context);
+
+    head->uid = journal->uid;
+    head->crc = journal->crc;
+    head->total_size = journal->total_size;
+    head->record_count = journal->record_count;
+
+    head->record = record;
+    head->offset = offset;
+
+    head->has_digest = (journal->digest != NULL);
+    head->has_regions = (journal->regions != NULL);
+}
+
+static
+error_state_t write_state(journal_t *journal, FILE *file, uint32_t record, off_t offset) {
+
+    journal_head_t head;
+    region_check_t *regions;
+    uint8_t state;
+
+    fill_head(journal, &head, record, offset);
+    if (fwrite(&head, sizeof(head), 1, file) != 1) {
+        return F_WRITE_ERROR;
+    }
+
+    if (journal->digest != NULL &&
+            fwrite(journal->digest, sizeof(*journal->digest), 1, file) != 1) {
+        return F_WRITE_ERROR;
+    }
+
+    if (journal->regions == NULL) {
+        return EXIT_OK;
+    }
+
+    regions = journal->regions;
+    if (fwrite(&regions->count, sizeof(regions->count), 1, file) != 1 ||
+            fwrite(&regions->current, sizeof(regions->current), 1, file) != 1 ||
+            fwrite(&regions->position, sizeof(regions->position), 1, file) != 1 ||
+            fwrite(&regions->ctx, sizeof(regions->ctx), 1, file) != 1) {
+        return F_WRITE_ERROR;
+    }
+
+    for (uint32_t index = 0; index < regions->count; index++) {
+        state = regions->regions[index].state;
+        if (fwrite(&state, sizeof(state), 1, file) != 1) {
+            return F_WRITE_ERROR;
+        }
+    }
+    return EXIT_OK;
+}
+
+// Everything before offset is made durable first, then the journal is
+// replaced atomically so a crash leaves either the old or the new one.
+static
+error_state_t checkpoint(journal_t *journal, FILE *iso_file, uint32_t record, off_t offset) {
+
+    error_state_t ret_val;
+    FILE *file;
+
+    if (fflush(iso_file) != 0 || fdatasync(fileno(iso_file)) != 0) {
+        ret_val = F_WRITE_ERROR;
+        goto exit_normal;
+    }
+
+    file = fopen(journal->tmp_path, "w");
+    if (file == NULL) {
+        ret_val = F_OPEN_ERROR;
+        goto exit_normal;
+    }
+
+    ret_val = write_state(journal, file, record, offset);
+    if (ret_val != EXIT_OK) {
+        goto exit_file;
+    }
+
+    if (fflush(file) != 0 || fsync(fileno(file)) != 0) {
+        ret_val = F_WRITE_ERROR;
+        goto exit_file;
+    }
+
+    if (fclose(file) != 0) {
+        ret_val = F_WRITE_ERROR;
+        goto exit_normal;
+    }
+
+    if (rename(journal->tmp_path, journal->path) != 0) {
+        ret_val = F_WRITE_ERROR;
+        goto exit_normal;
+    }
+
+    journal->last_offset = offset;
+    ret_val = EXIT_OK;
+    goto exit_normal;
+
+    exit_file:
+        fclose(file);
+    exit_normal:
+        return ret_val;
+}
+
+// Called at record boundaries, offset being where the record's padding starts
+error_state_t journal_tick(journal_t *journal, FILE *iso_file, uint32_t record, off_t offset) {
+    if (journal == NULL || offset - journal->last_offset < JOURNAL_INTERVAL) {
+        return EXIT_OK;
+    }
+    return checkpoint(journal, iso_file, record, offset);
+}
+
+static
+bool head_matches(journal_t *journal, journal_head_t *head) {
+
+    struct stat st;
+
+    if (memcmp(head->magic, JOURNAL_MAGIC, sizeof(head->magic)) != 0) return false;
+    if (head->digest_size != sizeof(iso_digest_t)) return false;
+    if (head->context_size != sizeof(mbedtls_md5_context)) return false;
+
+    if (head->uid != journal->uid || head->crc != journal->crc) return false;
+    if (head->total_size != journal->total_size) return false;
+    if (head->record_count != journal->record_count) return false;
+    if (head->record > head->record_count) return false;
+
+    if (head->has_digest != (journal->digest != NULL)) return false;
+    if (head->has_regions != (journal->regions != NULL)) return false;
+
+    // The ISO must still hold everything the journal vouches for
+    if (stat(journal->iso_path, &st) != 0 || (uint64_t) st.st_size < head->offset) return false;
+
+    return true;
+}
+
+// Nothing is restored unless the whole journal checks out
+error_state_t journal_load(journal_t *journal, uint32_t *record, off_t *offset) {
+
+    error_state_t ret_val;
+    journal_head_t head;
+    iso_digest_t digest;
+    region_check_t regions;
+    uint8_t *states;
+    FILE *file;
+
+    if (journal == NULL || record == NULL || offset == NULL) {
+        ret_val = ARG_ERROR;
+        goto exit_normal;
+    }
+
+    file = fopen(journal->path, "r");
+    if (file == NULL) {
+        ret_val = JOURNAL_ERROR;
+        goto exit_normal;
+    }
+
+    states = NULL;
+
+    if (fread(&head, sizeof(head), 1, file) != 1 || !head_matches(journal, &head)) {
+        ret_val = JOURNAL_ERROR;
+        goto exit_file;
+    }
+
+    if (head.has_digest && fread(&digest, sizeof(digest), 1, file) != 1) {
+        ret_val = JOURNAL_ERROR;
+        goto exit_file;
+    }
+
+    if (head.has_regions) {
+        if (fread(&regions.count, sizeof(regions.count), 1, file) != 1 ||
+                fread(&regions.current, sizeof(regions.current), 1, file) != 1 ||
+                fread(&regions.position, sizeof(regions.position), 1, file) != 1 ||
+                fread(&regions.ctx, sizeof(regions.ctx), 1, file) != 1) {
+            ret_val = JOURNAL_ERROR;
+            goto exit_file;
+        }
+
+        if (regions.count != journal->regions->count || regions.current > regions.count) {
+            ret_val = JOURNAL_ERROR;
+            goto exit_file;
+        }
+
+        states = malloc(regions.count);
+        if (states == NULL) {
+            ret_val = ALLOC_ERROR;
+            goto exit_file;
+        }
+
+        if (fread(states, sizeof(*states), regions.count, file) != regions.count) {
+            ret_val = JOURNAL_ERROR;
+            goto exit_states;
+        }
+    }
+
+    if (head.has_digest) {
+        memcpy(journal->digest, &digest, sizeof(digest));
+    }
+
+    if (head.has_regions) {
+        journal->regions->current = regions.current;
+        journal->regions->position = regions.position;
+        memcpy(&journal->regions->ctx, &regions.ctx, sizeof(regions.ctx));
+
+        for (uint32_t index = 0; index < regions.count; index++) {
+            journal->regions->regions[index].state = states[index];
+        }
+    }
+
+    *record = head.record;
+    *offset = head.offset;
+    journal->last_offset = head.offset;
+
+    ret_val = EXIT_OK;
+    exit_states:
+        free(states);
+    exit_file:
+        fclose(file);
+    exit_normal:
+        return ret_val;
+}
+
+void journal_remove(journal_t *journal) {
+    if (journal == NULL) return;
+    unlink(journal->path);
+    unlink(journal->tmp_path);
+}
+
+void journal_free(journal_t *journal) {
+    free(journal->path);
+    free(journal->tmp_path);
+    journal->path = NULL;
+    journal->tmp_path = NULL;
+}
@@ -0,0 +1,116 @@
+#define _XOPEN_SOURCE 700
+#define _FILE_OFFSET_BITS 64
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "layout.h"
+#include "iso.h"
+#include "util.h"
+
+static
+error_state_t blob_size(FILE *blob, off_t *size) {
+
+    struct stat st;
+
+    if (fstat(fileno(blob), &st) != 0) {
+        return F_SIZE_ERROR;
+    }
+
+    *size = st.st_size;
+    return EXIT_OK;
+}
+
+static
+void add_segment(iso_layout_t *layout, enum segment_kind kind,
+                off_t offset, off_t length, dir_record_t *record) {
+
+    iso_segment_t *segment;
+
+    segment = &layout->segments[layout->length];
+    segment->kind = kind;
+    segment->offset = offset;
+    segment->length = length;
+    segment->record = record;
+
+    layout->length += 1;
+}
+
+// Mirrors the sequential rebuild: header, then every extent of the sorted
+// table at its block with zero gaps in between, then the footer right
+// after the last extent.
+error_state_t build_layout(iso_layout_t *layout, parse_info_t *info, file_table_t *ft) {
+
+    error_state_t ret_val;
+    off_t position, target;
+    dir_record_t *cur_record;
+
+    if (layout == NULL || info == NULL || ft == NULL) {
+        ret_val = ARG_ERROR;
+        goto exit_normal;
+    }
+
+    memset(layout, 0, sizeof(*layout));
+
+    ret_val = blob_size(info->header, &layout->header_size);
+    if (ret_val != EXIT_OK) {
+        goto exit_normal;
+    }
+
+    ret_val = blob_size(info->footer, &layout->footer_size);
+    if (ret_val != EXIT_OK) {
+        goto exit_normal;
+    }
+
+    layout->segments = malloc(sizeof(*layout->segments) * (ft->length*2 + 2));
+    if (layout->segments == NULL) {
+        ret_val = ALLOC_ERROR;
+        goto exit_normal;
+    }
+
+    add_segment(layout, SEG_HEADER, 0, layout->header_size, NULL);
+    position = layout->header_size;
+
+    for (int index = 0; index < ft->length; index++) {
+        cur_record = ft->table[index];
+        target = extent_position(cur_record, info->desc->block_size);
+
+        if (target < position) {
+            ret_val = RECORD_ECMA_ERROR;
+            goto exit_early;
+        }
+
+        if (target > position) {
+            add_segment(layout, SEG_GAP, position, target - position, NULL);
+        }
+
+        add_segment(layout, SEG_EXTENT, target, cur_record->extent_length, cur_record);
+        position = target + cur_record->extent_length;
+    }
+
+    layout->footer_offset = position;
+    add_segment(layout, SEG_FOOTER, position, layout->footer_size, NULL);
+    layout->total_size = position + layout->footer_size;
+
+    ret_val = EXIT_OK;
+    goto exit_normal;
+
+    exit_early:
+        free(layout->segments);
+        layout->segments = NULL;
+    exit_normal:
+        return ret_val;
+}
+
+void free_layout(iso_layout_t *layout) {
+    free(layout->segments);
+    layout->segments = NULL;
+    layout->length = 0;
+}
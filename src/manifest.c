@@ -0,0 +1,272 @@
+#define _XOPEN_SOURCE 700
+#define _FILE_OFFSET_BITS 64
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "manifest.h"
+#include "iso.h"
+#include "util.h"
+
+static
+void stat_entry(manifest_entry_t *entry, const char *path) {
+
+    struct stat st;
+
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+        // Never matches a real file, so a missing file always counts as changed
+        entry->size = UINT64_MAX;
+        return;
+    }
+
+    entry->size = st.st_size;
+    entry->mtime_sec = st.st_mtim.tv_sec;
+    entry->mtime_nsec = st.st_mtim.tv_nsec;
+    entry->ctime_sec = st.st_ctim.tv_sec;
+    entry->ctime_nsec = st.st_ctim.tv_nsec;
+    entry->dev = st.st_dev;
+    entry->ino = st.st_ino;
+}
+
+static
+bool stat_differs(manifest_entry_t *old, manifest_entry_t *new) {
+    return new->size == UINT64_MAX || old->size != new->size ||
+           old->mtime_sec != new->mtime_sec || old->mtime_nsec != new->mtime_nsec ||
+           old->ctime_sec != new->ctime_sec || old->ctime_nsec != new->ctime_nsec ||
+           old->dev != new->dev || old->ino != new->ino;
+}
+
+// Stats are taken before anything is copied, so a file modified during the
+// rebuild shows up as changed next time.
+error_state_t manifest_scan(manifest_t *manifest, file_table_t *ft, const char *folder_path,
+                    const char *iso_path, uint32_t uid, uint32_t crc, off_t total_size) {
+
+    error_state_t ret_val;
+    manifest_entry_t *entry;
+    dir_record_t *cur;
+    char *full_path;
+
+    if (manifest == NULL || ft == NULL || folder_path == NULL || iso_path == NULL) {
+        ret_val = ARG_ERROR;
+        goto exit_normal;
+    }
+
+    memset(manifest, 0, sizeof(*manifest));
+    manifest->uid = uid;
+    manifest->crc = crc;
+    manifest->total_size = total_size;
+    manifest->record_count = ft->length;
+
+    manifest->path = malloc(MAX_PATH_LEN);
+    if (manifest->path == NULL) {
+        ret_val = ALLOC_ERROR;
+        goto exit_normal;
+    }
+
+    if (snprintf(manifest->path, MAX_PATH_LEN, "%s.manifest", iso_path) >= MAX_PATH_LEN) {
+        ret_val = PATH_BUFFER_ERROR;
+        goto exit_early;
+    }
+
+    manifest->iso_path = strdup(iso_path);
+    if (manifest->iso_path == NULL) {
+        ret_val = ALLOC_ERROR;
+        goto exit_early;
+    }
+
+    manifest->entries = calloc(ft->length, sizeof(*manifest->entries));
+    if (manifest->entries == NULL) {
+        ret_val = ALLOC_ERROR;
+        goto exit_early;
+    }
+
+    full_path = malloc(MAX_PATH_LEN);
+    if (full_path == NULL) {
+        ret_val = ALLOC_ERROR;
+        goto exit_early;
+    }
+
+    for (uint32_t index = 0; index < ft->length; index++) {
+        cur = ft->table[index];
+        if (cur->lead_extent != NULL) continue;
+
+        ret_val = build_full_path(full_path, MAX_PATH_LEN, folder_path, cur);
+        if (ret_val != EXIT_OK) {
+            free(full_path);
+            goto exit_early;
+        }
+
+        entry = &manifest->entries[manifest->length];
+        entry->record = index;
+        entry->block = cur->block_offset;
+        stat_entry(entry, full_path);
+
+        manifest->length += 1;
+    }
+
+    free(full_path);
+    ret_val = EXIT_OK;
+    goto exit_normal;
+
+    exit_early:
+        manifest_free(manifest);
+    exit_normal:
+        return ret_val;
+}
+
+// The previous manifest only counts if it describes the same disc and the
+// same file table as the current scan, and the ISO wasn't touched since.
+// Anything else may have left the ISO half written.
+error_state_t manifest_load(manifest_t *previous, manifest_t *current) {
+
+    error_state_t ret_val;
+    manifest_head_t head;
+    manifest_entry_t iso;
+    FILE *file;
+
+    if (previous == NULL || current == NULL) {
+        ret_val = ARG_ERROR;
+        goto exit_normal;
+    }
+
+    memset(previous, 0, sizeof(*previous));
+
+    file = fopen(current->path, "r");
+    if (file == NULL) {
+        ret_val = MANIFEST_ERROR;
+        goto exit_normal;
+    }
+
+    if (fread(&head, sizeof(head), 1, file) != 1 ||
+            memcmp(head.magic, MANIFEST_MAGIC, sizeof(head.magic)) != 0 ||
+            head.uid != current->uid || head.crc != current->crc ||
+            head.total_size != current->total_size ||
+            head.record_count != current->record_count ||
+            head.entry_count != current->length) {
+        ret_val = MANIFEST_ERROR;
+        goto exit_file;
+    }
+
+    memset(&iso, 0, sizeof(iso));
+    stat_entry(&iso, current->iso_path);
+    if (stat_differs(&head.iso, &iso)) {
+        ret_val = MANIFEST_ERROR;
+        goto exit_file;
+    }
+
+    previous->entries = calloc(head.entry_count, sizeof(*previous->entries));
+    if (previous->entries == NULL) {
+        ret_val = ALLOC_ERROR;
+        goto exit_file;
+    }
+
+    if (fread(previous->entries, sizeof(*previous->entries), head.entry_count, file) != head.entry_count) {
+        ret_val = MANIFEST_ERROR;
+        goto exit_entries;
+    }
+
+    for (uint32_t index = 0; index < head.entry_count; index++) {
+        if (previous->entries[index].record != current->entries[index].record ||
+                previous->entries[index].block != current->entries[index].block) {
+            ret_val = MANIFEST_ERROR;
+            goto exit_entries;
+        }
+    }
+
+    previous->length = head.entry_count;
+    previous->uid = head.uid;
+    previous->crc = head.crc;
+    previous->total_size = head.total_size;
+    previous->record_count = head.record_count;
+
+    ret_val = EXIT_OK;
+    goto exit_file;
+
+    exit_entries:
+        free(previous->entries);
+        previous->entries = NULL;
+    exit_file:
+        fclose(file);
+    exit_normal:
+        return ret_val;
+}
+
+error_state_t manifest_save(manifest_t *manifest) {
+
+    error_state_t ret_val;
+    manifest_head_t head;
+    FILE *file;
+
+    memset(&head, 0, sizeof(head));
+    memcpy(head.magic, MANIFEST_MAGIC, sizeof(head.magic));
+    head.uid = manifest->uid;
+    head.crc = manifest->crc;
+    head.total_size = manifest->total_size;
+    head.record_count = manifest->record_count;
+    head.entry_count = manifest->length;
+    stat_entry(&head.iso, manifest->iso_path);
+
+    file = fopen(manifest->path, "w");
+    if (file == NULL) {
+        ret_val = F_OPEN_ERROR;
+        goto exit_normal;
+    }
+
+    if (fwrite(&head, sizeof(head), 1, file) != 1 ||
+            fwrite(manifest->entries, sizeof(*manifest->entries), manifest->length, file) != manifest->length) {
+        ret_val = F_WRITE_ERROR;
+        goto exit_file;
+    }
+
+    if (fclose(file) != 0) {
+        ret_val = F_WRITE_ERROR;
+        goto exit_normal;
+    }
+
+    ret_val = EXIT_OK;
+    goto exit_normal;
+
+    exit_file:
+        fclose(file);
+    exit_normal:
+        return ret_val;
+}
+
+bool manifest_changed(manifest_t *previous, manifest_t *current, uint32_t entry) {
+
+    manifest_entry_t *old, *new;
+
+    old = &previous->entries[entry];
+    new = &current->entries[entry];
+
+    return stat_differs(old, new);
+}
+
+void manifest_free(manifest_t *manifest) {
+    free(manifest->path);
+    free(manifest->iso_path);
+    free(manifest->entries);
+    manifest->path = NULL;
+    manifest->iso_path = NULL;
+    manifest->entries = NULL;
+    manifest->length = 0;
+}
+
+// Called before an ISO is written from scratch, a rebuild that doesn't
+// finish must not leave a manifest behind that still matches it
+void manifest_remove(const char *iso_path) {
+
+    char path[MAX_PATH_LEN];
+
+    if (snprintf(path, MAX_PATH_LEN, "%s.manifest", iso_path) < MAX_PATH_LEN) {
+        unlink(path);
+    }
+}
@@ -0,0 +1,103 @@
+#define _XOPEN_SOURCE 700
+#define _FILE_OFFSET_BITS 64
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "md5.h"
+
+void md5_blocks(uint32_t *state, const uint8_t *data, size_t blocks) {
+
+    uint32_t a, b, c, d, m[16];
+
+    a = state[0];
+    b = state[1];
+    c = state[2];
+    d = state[3];
+
+    for (size_t block = 0; block < blocks; block++) {
+        for (int word = 0; word < 16; word++) {
+            m[word] = load_le32(data + block * 64 + word * 4);
+        }
+
+        MD5_ROUNDS(a, b, c, d, m);
+
+        a += state[0];
+        b += state[1];
+        c += state[2];
+        d += state[3];
+
+        state[0] = a;
+        state[1] = b;
+        state[2] = c;
+        state[3] = d;
+    }
+}
+
+void md5_builtin_init(md5_builtin_t *ctx) {
+    ctx->state[0] = 0x67452301;
+    ctx->state[1] = 0xefcdab89;
+    ctx->state[2] = 0x98badcfe;
+    ctx->state[3] = 0x10325476;
+    ctx->length = 0;
+    ctx->filled = 0;
+}
+
+// Whole blocks go straight from data, only a partial one is buffered
+void md5_builtin_update(md5_builtin_t *ctx, const uint8_t *data, size_t length) {
+
+    size_t take;
+
+    ctx->length += length;
+
+    if (ctx->filled > 0) {
+        take = (length < 64 - ctx->filled)? length : 64 - ctx->filled;
+        memcpy(ctx->buffer + ctx->filled, data, take);
+        ctx->filled += take;
+        data += take;
+        length -= take;
+
+        if (ctx->filled < 64) return;
+        md5_blocks(ctx->state, ctx->buffer, 1);
+        ctx->filled = 0;
+    }
+
+    if (length >= 64) {
+        md5_blocks(ctx->state, data, length / 64);
+        data += length - length % 64;
+        length %= 64;
+    }
+
+    memcpy(ctx->buffer, data, length);
+    ctx->filled = length;
+}
+
+void md5_builtin_finish(md5_builtin_t *ctx, uint8_t *checksum) {
+
+    uint64_t bits;
+
+    bits = ctx->length * 8;
+
+    ctx->buffer[ctx->filled++] = 0x80;
+    if (ctx->filled > 56) {
+        memset(ctx->buffer + ctx->filled, 0, 64 - ctx->filled);
+        md5_blocks(ctx->state, ctx->buffer, 1);
+        ctx->filled = 0;
+    }
+    memset(ctx->buffer + ctx->filled, 0, 56 - ctx->filled);
+    for (int byte = 0; byte < 8; byte++) {
+        ctx->buffer[56 + byte] = (uint8_t) (bits >> (byte * 8));
+    }
+    md5_blocks(ctx->state, ctx->buffer, 1);
+
+    for (int word = 0; word < 4; word++) {
+        for (int byte = 0; byte < 4; byte++) {
+            checksum[word * 4 + byte] = (uint8_t) (ctx->state[word] >> (byte * 8));
+        }
+    }
+}
@@ -0,0 +1,374 @@
+#define _XOPEN_SOURCE 700
+#define _FILE_OFFSET_BITS 64
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "md5mb.h"
+#include "md5.h"
+#include "hash.h"
+#include "util.h"
+
+// One kernel per vector width, the message words of every lane are gathered
+// into one vector per word and all lanes go through the 64 steps together
+#define MD5MB_KERNEL(name, width, attributes)                                       \
+attributes static                                                                   \
+void name(uint32_t *state, const uint8_t **data, size_t blocks) {                   \
+                                                                                    \
+    typedef uint32_t vec_t __attribute__((vector_size((width) * 4)));               \
+    vec_t a, b, c, d, aa, bb, cc, dd, m[16];                                        \
+    uint32_t words[16][width] __attribute__((aligned((width) * 4)));                \
+                                                                                    \
+    memcpy(&a, state + 0 * (width), sizeof(vec_t));                                 \
+    memcpy(&b, state + 1 * (width), sizeof(vec_t));                                 \
+    memcpy(&c, state + 2 * (width), sizeof(vec_t));                                 \
+    memcpy(&d, state + 3 * (width), sizeof(vec_t));                                 \
+                                                                                    \
+    for (size_t block = 0; block < blocks; block++) {                               \
+        for (int lane = 0; lane < (width); lane++) {                                \
+            for (int word = 0; word < 16; word++) {                                 \
+                words[word][lane] = load_le32(data[lane] + block * 64 + word * 4);  \
+            }                                                                       \
+        }                                                                           \
+        for (int word = 0; word < 16; word++) {                                     \
+            memcpy(&m[word], words[word], sizeof(vec_t));                           \
+        }                                                                           \
+                                                                                    \
+        aa = a; bb = b; cc = c; dd = d;                                             \
+        MD5_ROUNDS(a, b, c, d, m);                                                  \
+        a += aa; b += bb; c += cc; d += dd;                                         \
+    }                                                                               \
+                                                                                    \
+    memcpy(state + 0 * (width), &a, sizeof(vec_t));                                 \
+    memcpy(state + 1 * (width), &b, sizeof(vec_t));                                 \
+    memcpy(state + 2 * (width), &c, sizeof(vec_t));                                 \
+    memcpy(state + 3 * (width), &d, sizeof(vec_t));                                 \
+}
+
+// SSE2 is part of x86-64, so the 4 lane kernel needs no dispatch
+MD5MB_KERNEL(md5_x4, 4, )
+
+#if defined(__x86_64__) || defined(__i386__)
+MD5MB_KERNEL(md5_x8, 8, __attribute__((target("avx2"))))
+MD5MB_KERNEL(md5_x16, 16, __attribute__((target("avx512f"))))
+#endif
+
+// The widest kernel this CPU can run
+int md5mb_lanes(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return 16;
+    if (__builtin_cpu_supports("avx2")) return 8;
+#endif
+    return 4;
+}
+
+error_state_t md5mb_init(md5mb_t *mb) {
+
+    if (mb == NULL) {
+        return ARG_ERROR;
+    }
+
+    memset(mb, 0, sizeof(*mb));
+
+    mb->lanes = md5mb_lanes();
+    switch (mb->lanes) {
+#if defined(__x86_64__) || defined(__i386__)
+        case 16:
+            mb->kernel = md5_x16;
+            break;
+        case 8:
+            mb->kernel = md5_x8;
+            break;
+#endif
+        default:
+            mb->kernel = md5_x4;
+            break;
+    }
+
+    // Room for the padding, which can spill one block past a full chunk
+    mb->idle = calloc(1, MD5MB_CHUNK_SIZE + 128);
+    if (mb->idle == NULL) {
+        return ALLOC_ERROR;
+    }
+
+    for (int index = 0; index < mb->lanes; index++) {
+        mb->lane[index].fd = -1;
+        mb->lane[index].buffer = malloc(MD5MB_CHUNK_SIZE + 128);
+        if (mb->lane[index].buffer == NULL) {
+            md5mb_free(mb);
+            return ALLOC_ERROR;
+        }
+    }
+
+    return EXIT_OK;
+}
+
+static
+void lane_reset(md5mb_t *mb, int index) {
+
+    static const uint32_t iv[4] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+
+    for (int word = 0; word < 4; word++) {
+        mb->state[word * mb->lanes + index] = iv[word];
+    }
+}
+
+static
+void lane_digest(md5mb_t *mb, int index, uint8_t *checksum) {
+
+    uint32_t value;
+
+    for (int word = 0; word < 4; word++) {
+        value = mb->state[word * mb->lanes + index];
+        for (int byte = 0; byte < 4; byte++) {
+            checksum[word * 4 + byte] = (uint8_t) (value >> (byte * 8));
+        }
+    }
+}
+
+// The 0x80 marker, zeroes up to the last 8 bytes of a block and the length
+// in bits, right after the file's last bytes
+static
+void lane_pad(md5mb_lane_t *lane) {
+
+    uint64_t bits;
+
+    bits = lane->length * 8;
+
+    lane->buffer[lane->filled++] = 0x80;
+    while (lane->filled % 64 != 56) {
+        lane->buffer[lane->filled++] = 0;
+    }
+    for (int byte = 0; byte < 8; byte++) {
+        lane->buffer[lane->filled++] = (uint8_t) (bits >> (byte * 8));
+    }
+    lane->padded = true;
+}
+
+static
+error_state_t lane_fill(md5mb_lane_t *lane) {
+
+    ssize_t obtained;
+
+    lane->filled = 0;
+    lane->offset = 0;
+
+    while (lane->filled < MD5MB_CHUNK_SIZE) {
+        obtained = read(lane->fd, lane->buffer + lane->filled, MD5MB_CHUNK_SIZE - lane->filled);
+        if (obtained == -1) {
+            if (errno == EINTR) continue;
+            return F_READ_ERROR;
+        }
+        if (obtained == 0) {
+            lane_pad(lane);
+            break;
+        }
+        lane->filled += obtained;
+        lane->length += obtained;
+    }
+
+    return EXIT_OK;
+}
+
+static
+error_state_t lane_open(md5mb_t *mb, int index, md5mb_next_t next, void *opaque) {
+
+    error_state_t ret_val;
+    md5mb_lane_t *lane;
+    const char *path;
+
+    lane = &mb->lane[index];
+    lane->tag = NULL;
+    path = NULL;
+
+    ret_val = next(opaque, &path, &lane->tag);
+    if (ret_val != EXIT_OK) {
+        return ret_val;
+    }
+    if (path == NULL) {
+        mb->drained = true;
+        return EXIT_OK;
+    }
+
+    lane->fd = open(path, O_RDONLY);
+    if (lane->fd == -1) {
+        return F_OPEN_ERROR;
+    }
+    posix_fadvise(lane->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    lane->filled = 0;
+    lane->offset = 0;
+    lane->length = 0;
+    lane->padded = false;
+    lane->active = true;
+    lane_reset(mb, index);
+
+    return EXIT_OK;
+}
+
+// Brings a lane to a point where it has blocks to hash, or nothing left to do
+static
+error_state_t lane_advance(md5mb_t *mb, int index, md5mb_next_t next, md5mb_done_t done, void *opaque) {
+
+    error_state_t ret_val;
+    md5mb_lane_t *lane;
+    uint8_t checksum[0x10];
+
+    lane = &mb->lane[index];
+
+    while (true) {
+        if (!lane->active) {
+            if (mb->drained) {
+                return EXIT_OK;
+            }
+            ret_val = lane_open(mb, index, next, opaque);
+            if (ret_val != EXIT_OK || !lane->active) {
+                return ret_val;
+            }
+            continue;
+        }
+
+        if (lane->offset < lane->filled) {
+            return EXIT_OK;
+        }
+
+        if (lane->padded) {
+            lane_digest(mb, index, checksum);
+            close(lane->fd);
+            lane->fd = -1;
+            lane->active = false;
+
+            ret_val = done(opaque, lane->tag, checksum);
+            if (ret_val != EXIT_OK) {
+                return ret_val;
+            }
+            continue;
+        }
+
+        ret_val = lane_fill(lane);
+        if (ret_val != EXIT_OK) {
+            return ret_val;
+        }
+    }
+}
+
+// Hashes every file next hands out and reports each one to done. On an error
+// *failed is the tag of the file it happened on.
+error_state_t md5mb_run(md5mb_t *mb, md5mb_next_t next, md5mb_done_t done, md5mb_stop_t stop,
+                    void *opaque, void **failed) {
+
+    error_state_t ret_val;
+    const uint8_t *data[MD5MB_MAX_LANES];
+    md5mb_lane_t *lane;
+    size_t blocks;
+    bool running;
+
+    if (mb == NULL || next == NULL || done == NULL || failed == NULL) {
+        return ARG_ERROR;
+    }
+
+    *failed = NULL;
+    mb->drained = false;
+
+    while (true) {
+        running = false;
+        blocks = SIZE_MAX;
+
+        for (int index = 0; index < mb->lanes; index++) {
+            lane = &mb->lane[index];
+
+            ret_val = lane_advance(mb, index, next, done, opaque);
+            if (ret_val != EXIT_OK) {
+                *failed = lane->tag;
+                goto exit_lanes;
+            }
+
+            if (!lane->active) {
+                data[index] = mb->idle;
+                continue;
+            }
+
+            data[index] = lane->buffer + lane->offset;
+            if ((lane->filled - lane->offset) / 64 < blocks) {
+                blocks = (lane->filled - lane->offset) / 64;
+            }
+            running = true;
+        }
+
+        if (!running || (stop != NULL && stop(opaque))) break;
+
+        mb->kernel(mb->state, data, blocks);
+
+        for (int index = 0; index < mb->lanes; index++) {
+            if (mb->lane[index].active) {
+                mb->lane[index].offset += blocks * 64;
+            }
+        }
+    }
+
+    ret_val = EXIT_OK;
+
+    exit_lanes:
+        for (int index = 0; index < mb->lanes; index++) {
+            lane = &mb->lane[index];
+            if (lane->fd != -1) {
+                close(lane->fd);
+                lane->fd = -1;
+            }
+            lane->active = false;
+        }
+        return ret_val;
+}
+
+void md5mb_free(md5mb_t *mb) {
+    for (int index = 0; index < MD5MB_MAX_LANES; index++) {
+        free(mb->lane[index].buffer);
+        mb->lane[index].buffer = NULL;
+    }
+    free(mb->idle);
+    mb->idle = NULL;
+}
+
+// Bytes per second one core gets through with every lane of the widest kernel busy
+error_state_t md5mb_measure(double *rate) {
+
+    error_state_t ret_val;
+    md5mb_t mb;
+    const uint8_t *data[MD5MB_MAX_LANES];
+    struct timespec start, end;
+    double seconds;
+    int rounds;
+
+    ret_val = md5mb_init(&mb);
+    if (ret_val != EXIT_OK) {
+        return ret_val;
+    }
+
+    for (int index = 0; index < mb.lanes; index++) {
+        data[index] = mb.idle;
+    }
+    rounds = HASH_BENCH_SIZE * HASH_BENCH_ROUNDS / MD5MB_CHUNK_SIZE / mb.lanes;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int round = 0; round < rounds; round++) {
+        mb.kernel(mb.state, data, MD5MB_CHUNK_SIZE / 64);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    *rate = (double) rounds * mb.lanes * MD5MB_CHUNK_SIZE / ((seconds > 0)? seconds : 1e-9);
+
+    md5mb_free(&mb);
+    return EXIT_OK;
+}
@@ -0,0 +1,159 @@
+#define _XOPEN_SOURCE 700
+#define _FILE_OFFSET_BITS 64
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mount.h"
+#include "viso.h"
+#include "ird.h"
+#include "util.h"
+
+#ifdef HAVE_FUSE
+
+#define FUSE_USE_VERSION 31
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <fuse.h>
+
+typedef struct {
+    viso_t *viso;
+    char iso_path[MAX_PATH_LEN];
+
+} mount_ctx_t;
+
+static
+mount_ctx_t *current_ctx(void) {
+    return fuse_get_context()->private_data;
+}
+
+static
+int mount_getattr(const char *path, struct stat *st, struct fuse_file_info *fi) {
+
+    mount_ctx_t *ctx = current_ctx();
+
+    memset(st, 0, sizeof(*st));
+    if (strcmp(path, "/") == 0) {
+        st->st_mode = S_IFDIR | 0555;
+        st->st_nlink = 2;
+        return 0;
+    }
+
+    if (strcmp(path, ctx->iso_path) == 0) {
+        st->st_mode = S_IFREG | 0444;
+        st->st_nlink = 1;
+        st->st_size = viso_size(ctx->viso);
+        st->st_blksize = ctx->viso->block_size;
+        return 0;
+    }
+    return -ENOENT;
+}
+
+static
+int mount_readdir(const char *path, void *buffer, fuse_fill_dir_t filler, off_t offset,
+                struct fuse_file_info *fi, enum fuse_readdir_flags flags) {
+
+    if (strcmp(path, "/") != 0) {
+        return -ENOENT;
+    }
+
+    filler(buffer, ".", NULL, 0, 0);
+    filler(buffer, "..", NULL, 0, 0);
+    filler(buffer, current_ctx()->iso_path + 1, NULL, 0, 0);
+    return 0;
+}
+
+static
+int mount_open(const char *path, struct fuse_file_info *fi) {
+
+    if (strcmp(path, current_ctx()->iso_path) != 0) {
+        return -ENOENT;
+    }
+
+    if ((fi->flags & O_ACCMODE) != O_RDONLY) {
+        return -EACCES;
+    }
+
+    // Contents never change while mounted
+    fi->keep_cache = 1;
+    return 0;
+}
+
+static
+int mount_read(const char *path, char *buffer, size_t size, off_t offset,
+                struct fuse_file_info *fi) {
+
+    size_t obtained;
+
+    if (viso_pread(current_ctx()->viso, buffer, size, offset, &obtained) != EXIT_OK) {
+        return -EIO;
+    }
+    return obtained;
+}
+
+static const struct fuse_operations mount_ops = {
+    .getattr = mount_getattr,
+    .readdir = mount_readdir,
+    .open = mount_open,
+    .read = mount_read,
+};
+
+// Runs in the foreground until the mount point is unmounted
+error_state_t mount_iso(ird_t *ird, char *folder_path, const char *mount_point,
+                    const char *iso_name) {
+
+    error_state_t ret_val;
+    mount_ctx_t *ctx;
+    char *argv[] = {"ps3_rebuild", "-f", "-o", "ro,fsname=ps3_rebuild", (char *) mount_point, NULL};
+
+    if (ird == NULL || folder_path == NULL || mount_point == NULL || iso_name == NULL) {
+        ret_val = ARG_ERROR;
+        goto exit_normal;
+    }
+
+    ctx = malloc(sizeof(*ctx));
+    if (ctx == NULL) {
+        ret_val = ALLOC_ERROR;
+        goto exit_normal;
+    }
+
+    if (snprintf(ctx->iso_path, MAX_PATH_LEN, "/%s", iso_name) >= MAX_PATH_LEN) {
+        ret_val = PATH_BUFFER_ERROR;
+        goto exit_ctx;
+    }
+
+    ret_val = viso_open(&ctx->viso, ird, folder_path);
+    if (ret_val != EXIT_OK) {
+        goto exit_ctx;
+    }
+
+    printf("Serving %s (%lld bytes) at %s\n", iso_name,
+            (long long) viso_size(ctx->viso), mount_point);
+    fflush(stdout);
+
+    ret_val = (fuse_main(5, argv, &mount_ops, ctx) == 0)? EXIT_OK : MOUNT_ERROR;
+
+    viso_close(ctx->viso);
+    exit_ctx:
+        free(ctx);
+    exit_normal:
+        return ret_val;
+}
+
+#else
+
+error_state_t mount_iso(ird_t *ird, char *folder_path, const char *mount_point,
+                    const char *iso_name) {
+    printf("This build has no FUSE support, rebuild with 'make fuse'\n");
+    return MOUNT_ERROR;
+}
+
+#endif
@@ -14,6 +14,19 @@
 #include "sfo.h"
 #include "fault.h"
 
+// curl_global_init isn't thread safe, it has to run once before any worker
+// starts downloading.
+error_state_t net_init(void) {
+    if (curl_global_init(CURL_GLOBAL_DEFAULT) != CURLE_OK) {
+        return CURL_INIT_ERROR;
+    }
+    return EXIT_OK;
+}
+
+void net_cleanup(void) {
+    curl_global_cleanup();
+}
+
 static
 size_t memory_callback(void *ptr, size_t size, size_t nmemb, void *data) {
 
@@ -121,6 +134,7 @@ error_state_t download_ird(sfo_t *sfo, char *ird_path) {
     int obtained;
     char *url;
     memory_wrapper_t *url_wrapper;
+    char *save_ptr;
 
     if (sfo == NULL || ird_path == NULL) {
         ret_val = ARG_ERROR;
@@ -156,7 +170,7 @@ error_state_t download_ird(sfo_t *sfo, char *ird_path) {
         goto exit_normal;
     }
 
-    obtained = snprintf(url, MAX_PATH_LEN, "%s/%s", IRD_LINK, strtok(url_wrapper->memory, "\n"));
+    obtained = snprintf(url, MAX_PATH_LEN, "%s/%s", IRD_LINK, strtok_r(url_wrapper->memory, "\n", &save_ptr));
     if (obtained < 0) {
         ret_val = PATH_BUFFER_ERROR;
         goto exit_normal;
@@ -0,0 +1,453 @@
+#define _XOPEN_SOURCE 700
+#define _FILE_OFFSET_BITS 64
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "netsrv.h"
+#include "viso.h"
+#include "bcache.h"
+#include "ird.h"
+#include "util.h"
+
+typedef struct client_s client_t;
+
+typedef struct {
+    viso_t *viso;
+    const char *iso_name;
+    time_t mtime;
+
+    // Connected clients, the viso can't be closed while any is left
+    pthread_mutex_t lock;
+    pthread_cond_t idle;
+    client_t *clients;
+
+} netsrv_t;
+
+struct client_s {
+    netsrv_t *server;
+    int fd;
+    char address[INET_ADDRSTRLEN];
+
+    bool open;
+    bcache_t cache;
+    char *buffer;
+
+    client_t *next;
+
+};
+
+static
+uint16_t get_be16(const uint8_t *data) {
+    return ((uint16_t) data[0] << 8) | data[1];
+}
+
+static
+uint32_t get_be32(const uint8_t *data) {
+    return ((uint32_t) get_be16(data) << 16) | get_be16(data + 2);
+}
+
+static
+uint64_t get_be64(const uint8_t *data) {
+    return ((uint64_t) get_be32(data) << 32) | get_be32(data + 4);
+}
+
+static
+void put_be32(uint8_t *data, uint32_t value) {
+    for (int index = 3; index >= 0; index--) {
+        data[index] = value & 0xFF;
+        value >>= 8;
+    }
+}
+
+static
+void put_be64(uint8_t *data, uint64_t value) {
+    put_be32(data, value >> 32);
+    put_be32(data + 4, value & 0xFFFFFFFF);
+}
+
+static
+bool recv_full(int fd, void *buffer, size_t length) {
+
+    ssize_t obtained;
+
+    while (length > 0) {
+        obtained = recv(fd, buffer, length, 0);
+        if (obtained < 0 && errno == EINTR) continue;
+        if (obtained <= 0) return false;
+
+        buffer = (char *) buffer + obtained;
+        length -= obtained;
+    }
+    return true;
+}
+
+static
+bool send_full(int fd, const void *buffer, size_t length) {
+
+    ssize_t sent;
+
+    while (length > 0) {
+        sent = send(fd, buffer, length, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent <= 0) return false;
+
+        buffer = (const char *) buffer + sent;
+        length -= sent;
+    }
+    return true;
+}
+
+// Path commands carry the path length in the command and the path after it
+static
+bool recv_path(client_t *client, const uint8_t *cmd, char *path) {
+
+    uint16_t length;
+
+    length = get_be16(cmd + 2);
+    if (length >= MAX_PATH_LEN || !recv_full(client->fd, path, length)) {
+        return false;
+    }
+    path[length] = '\0';
+    return true;
+}
+
+// Any folder the console browses to finds the ISO under its own name
+static
+bool names_iso(netsrv_t *server, const char *path) {
+
+    const char *name;
+
+    name = strrchr(path, '/');
+    name = (name != NULL)? name + 1 : path;
+    return strcmp(name, server->iso_name) == 0;
+}
+
+static
+bool names_dir(const char *path) {
+    return strcmp(path, "/") == 0 || strcmp(path, "") == 0 ||
+           strcmp(path, NETSRV_ISO_DIR) == 0 || strcmp(path, NETSRV_ISO_DIR "/") == 0;
+}
+
+static
+bool handle_open(client_t *client, const uint8_t *cmd) {
+
+    char path[MAX_PATH_LEN];
+    uint8_t result[16];
+
+    if (!recv_path(client, cmd, path)) {
+        return false;
+    }
+
+    client->open = names_iso(client->server, path);
+    put_be64(result, client->open? (uint64_t) viso_size(client->server->viso) : UINT64_MAX);
+    put_be64(result + 8, client->server->mtime);
+    return send_full(client->fd, result, sizeof(result));
+}
+
+static
+bool handle_stat(client_t *client, const uint8_t *cmd) {
+
+    char path[MAX_PATH_LEN];
+    uint8_t result[33];
+    uint64_t size;
+    bool is_dir;
+
+    if (!recv_path(client, cmd, path)) {
+        return false;
+    }
+
+    is_dir = names_dir(path);
+    if (is_dir) {
+        size = 0;
+    } else if (names_iso(client->server, path)) {
+        size = viso_size(client->server->viso);
+    } else {
+        size = UINT64_MAX;
+    }
+
+    put_be64(result, size);
+    put_be64(result + 8, client->server->mtime);
+    put_be64(result + 16, client->server->mtime);
+    put_be64(result + 24, client->server->mtime);
+    result[32] = is_dir;
+    return send_full(client->fd, result, sizeof(result));
+}
+
+// The critical reads have no status, a read that can't be served in full
+// drops the connection like ps3netsrv does.
+static
+bool handle_read(client_t *client, uint16_t opcode, const uint8_t *cmd) {
+
+    uint64_t offset, requested;
+    uint32_t length;
+    uint8_t status[4];
+    size_t obtained;
+    error_state_t ret_val;
+
+    // Sector counts are scaled in 64 bits so a huge one can't wrap past the check
+    if (opcode == NETSRV_READ_CD_2048) {
+        offset = (uint64_t) get_be32(cmd + 4) * NETSRV_SECTOR_SIZE;
+        requested = (uint64_t) get_be32(cmd + 8) * NETSRV_SECTOR_SIZE;
+    } else {
+        requested = get_be32(cmd + 4);
+        offset = get_be64(cmd + 8);
+    }
+
+    if (!client->open || requested > NETSRV_MAX_READ || offset > INT64_MAX) {
+        return false;
+    }
+    length = (uint32_t) requested;
+
+    ret_val = bcache_read(&client->cache, client->buffer, offset, length, &obtained);
+
+    if (opcode == NETSRV_READ_FILE) {
+        put_be32(status, (ret_val == EXIT_OK)? obtained : UINT32_MAX);
+        if (!send_full(client->fd, status, sizeof(status))) return false;
+        return ret_val != EXIT_OK || send_full(client->fd, client->buffer, obtained);
+    }
+
+    if (ret_val != EXIT_OK || obtained != length) {
+        return false;
+    }
+    return send_full(client->fd, client->buffer, obtained);
+}
+
+static
+void *client_thread(void *arg) {
+
+    client_t *client = arg;
+    uint8_t cmd[16];
+    uint16_t opcode;
+    bool alive;
+
+    printf("Client %s connected\n", client->address);
+    fflush(stdout);
+
+    alive = true;
+    while (alive && recv_full(client->fd, cmd, sizeof(cmd))) {
+        opcode = get_be16(cmd);
+
+        switch (opcode) {
+            case NETSRV_OPEN_FILE:
+                alive = handle_open(client, cmd);
+                break;
+            case NETSRV_STAT_FILE:
+                alive = handle_stat(client, cmd);
+                break;
+            case NETSRV_READ_FILE_CRITICAL:
+            case NETSRV_READ_CD_2048:
+            case NETSRV_READ_FILE:
+                alive = handle_read(client, opcode, cmd);
+                break;
+            default:
+                printf("Client %s sent unsupported command 0x%04X\n", client->address, opcode);
+                alive = false;
+                break;
+        }
+    }
+
+    printf("Client %s disconnected\n", client->address);
+    fflush(stdout);
+
+    // The cache's helper reads the viso, it has to stop before the server
+    // may see this client gone
+    bcache_free(&client->cache);
+
+    pthread_mutex_lock(&client->server->lock);
+    for (client_t **link = &client->server->clients; *link != NULL; link = &(*link)->next) {
+        if (*link == client) {
+            *link = client->next;
+            break;
+        }
+    }
+    pthread_cond_signal(&client->server->idle);
+    pthread_mutex_unlock(&client->server->lock);
+
+    close(client->fd);
+    free(client->buffer);
+    free(client);
+    return NULL;
+}
+
+static
+error_state_t start_client(netsrv_t *server, int fd, struct sockaddr_in *peer) {
+
+    error_state_t ret_val;
+    client_t *client;
+    pthread_t thread;
+
+    client = calloc(1, sizeof(*client));
+    if (client == NULL) {
+        ret_val = ALLOC_ERROR;
+        goto exit_normal;
+    }
+
+    client->server = server;
+    client->fd = fd;
+    inet_ntop(AF_INET, &peer->sin_addr, client->address, sizeof(client->address));
+
+    client->buffer = malloc(NETSRV_MAX_READ);
+    if (client->buffer == NULL) {
+        ret_val = ALLOC_ERROR;
+        goto exit_client;
+    }
+
+    ret_val = bcache_init(&client->cache, server->viso);
+    if (ret_val != EXIT_OK) {
+        goto exit_buffer;
+    }
+
+    // Listed before the thread starts, it unlinks itself when it's done
+    pthread_mutex_lock(&server->lock);
+    client->next = server->clients;
+    server->clients = client;
+    pthread_mutex_unlock(&server->lock);
+
+    if (pthread_create(&thread, NULL, client_thread, client) != 0) {
+        pthread_mutex_lock(&server->lock);
+        server->clients = client->next;
+        pthread_mutex_unlock(&server->lock);
+        ret_val = THREAD_ERROR;
+        goto exit_cache;
+    }
+    pthread_detach(thread);
+
+    ret_val = EXIT_OK;
+    goto exit_normal;
+
+    exit_cache:
+        bcache_free(&client->cache);
+    exit_buffer:
+        free(client->buffer);
+    exit_client:
+        free(client);
+    exit_normal:
+        return ret_val;
+}
+
+// Running out of descriptors or buffers, or a network hiccup on the
+// pending connection, doesn't stop the server
+static
+bool accept_retryable(int error) {
+    return error == EINTR || error == ECONNABORTED || error == EMFILE || error == ENFILE ||
+           error == ENOBUFS || error == ENOMEM || error == EPROTO || error == EPERM ||
+           error == ENETDOWN || error == ENETUNREACH || error == EHOSTDOWN ||
+           error == EHOSTUNREACH || error == ENONET || error == ENOPROTOOPT || error == EOPNOTSUPP;
+}
+
+// Clients still reading from the viso are woken up and waited for
+static
+void drain_clients(netsrv_t *server) {
+
+    pthread_mutex_lock(&server->lock);
+    for (client_t *client = server->clients; client != NULL; client = client->next) {
+        shutdown(client->fd, SHUT_RDWR);
+    }
+    while (server->clients != NULL) {
+        pthread_cond_wait(&server->idle, &server->lock);
+    }
+    pthread_mutex_unlock(&server->lock);
+}
+
+// Serves until killed, every console gets its own thread and cache
+error_state_t serve_iso(ird_t *ird, char *folder_path, uint16_t port, const char *iso_name) {
+
+    error_state_t ret_val;
+    netsrv_t server;
+    struct sockaddr_in address, peer;
+    socklen_t peer_length;
+    struct stat st;
+    struct timespec backoff;
+    int listen_fd, client_fd, reuse;
+
+    if (ird == NULL || folder_path == NULL || iso_name == NULL) {
+        ret_val = ARG_ERROR;
+        goto exit_normal;
+    }
+
+    ret_val = viso_open(&server.viso, ird, folder_path);
+    if (ret_val != EXIT_OK) {
+        goto exit_normal;
+    }
+
+    server.iso_name = iso_name;
+    server.mtime = (stat(folder_path, &st) == 0)? st.st_mtime : time(NULL);
+    server.clients = NULL;
+    pthread_mutex_init(&server.lock, NULL);
+    pthread_cond_init(&server.idle, NULL);
+
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd == -1) {
+        ret_val = SOCKET_ERROR;
+        goto exit_viso;
+    }
+
+    reuse = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+
+    if (bind(listen_fd, (struct sockaddr *) &address, sizeof(address)) != 0 ||
+            listen(listen_fd, 8) != 0) {
+        ret_val = SOCKET_ERROR;
+        goto exit_socket;
+    }
+
+    printf("Serving %s/%s (%lld bytes) on port %u\n", NETSRV_ISO_DIR, iso_name,
+            (long long) viso_size(server.viso), port);
+    fflush(stdout);
+
+    while (true) {
+        peer_length = sizeof(peer);
+        client_fd = accept(listen_fd, (struct sockaddr *) &peer, &peer_length);
+        if (client_fd == -1) {
+            if (!accept_retryable(errno)) {
+                ret_val = SOCKET_ERROR;
+                goto exit_socket;
+            }
+
+            // Give clients time to hang up and free what accept needs
+            if (errno != EINTR && errno != ECONNABORTED) {
+                printf("Can't accept a client (%s), retrying\n", strerror(errno));
+                fflush(stdout);
+                backoff.tv_sec = 0;
+                backoff.tv_nsec = NETSRV_ACCEPT_BACKOFF;
+                nanosleep(&backoff, NULL);
+            }
+            continue;
+        }
+
+        ret_val = start_client(&server, client_fd, &peer);
+        if (ret_val != EXIT_OK) {
+            close(client_fd);
+        }
+    }
+
+    exit_socket:
+        close(listen_fd);
+    exit_viso:
+        drain_clients(&server);
+        pthread_cond_destroy(&server.idle);
+        pthread_mutex_destroy(&server.lock);
+        viso_close(server.viso);
+    exit_normal:
+        return ret_val;
+}
@@ -0,0 +1,145 @@
+#define _XOPEN_SOURCE 700
+#define _FILE_OFFSET_BITS 64
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "observe.h"
+#include "rebuild.h"
+#include "fused.h"
+#include "digest.h"
+#include "region.h"
+#include "util.h"
+
+static const char zero_block[OBSERVE_ZERO_SIZE];
+
+// The ordered writers (sequential, pipelined and direct) report every byte of
+// the ISO here in output order, so checks can run on data already in memory.
+// Engines that complete extents out of order or never see the data in
+// userspace can't feed running digests, their output is read back once by
+// observe_file instead.
+bool ordered_backend(rebuild_opts_t *opts) {
+    return opts->backend == IO_STDIO && !opts->positional;
+}
+
+bool observing(rebuild_job_t *job) {
+    return job->opts->fused || job->digest != NULL || job->regions != NULL;
+}
+
+error_state_t observe_data(rebuild_job_t *job, const char *data, size_t length) {
+
+    error_state_t ret_val;
+
+    if (job->digest != NULL) {
+        ret_val = digest_update(job->digest, data, length);
+        if (ret_val != EXIT_OK) {
+            return ret_val;
+        }
+    }
+
+    if (job->regions != NULL) {
+        ret_val = region_update(job->regions, data, length);
+        if (ret_val != EXIT_OK) {
+            return ret_val;
+        }
+    }
+    return EXIT_OK;
+}
+
+// Gaps are never materialized in memory, the same zero block is fed repeatedly
+error_state_t observe_gap(rebuild_job_t *job, off_t length) {
+
+    error_state_t ret_val;
+    size_t take;
+
+    if (job->digest == NULL && job->regions == NULL) {
+        return EXIT_OK;
+    }
+
+    while (length > 0) {
+        take = min(length, OBSERVE_ZERO_SIZE);
+        ret_val = observe_data(job, zero_block, take);
+        if (ret_val != EXIT_OK) {
+            return ret_val;
+        }
+        length -= take;
+    }
+    return EXIT_OK;
+}
+
+// offset is relative to the start of the extent
+error_state_t observe_extent(rebuild_job_t *job, dir_record_t *record, off_t offset,
+                    const char *data, size_t length) {
+
+    error_state_t ret_val;
+
+    if (job->opts->fused) {
+        ret_val = fused_update(record, offset, data, length);
+        if (ret_val != EXIT_OK) {
+            return ret_val;
+        }
+    }
+
+    return observe_data(job, data, length);
+}
+
+// Tap for tap_file_to_file, a cursor without a record stands for a blob
+error_state_t observe_tap(void *opaque, const char *data, size_t length) {
+
+    error_state_t ret_val;
+    observe_cursor_t *cursor = opaque;
+
+    if (cursor->record == NULL) {
+        ret_val = observe_data(cursor->job, data, length);
+    } else {
+        ret_val = observe_extent(cursor->job, cursor->record, cursor->offset, data, length);
+    }
+
+    cursor->offset += length;
+    return ret_val;
+}
+
+error_state_t observe_file(rebuild_job_t *job, const char *path) {
+
+    error_state_t ret_val;
+    size_t obtained;
+    char *buffer;
+    FILE *file;
+
+    file = fopen(path, "r");
+    if (file == NULL) {
+        ret_val = F_OPEN_ERROR;
+        goto exit_normal;
+    }
+
+    buffer = malloc(OBSERVE_READ_SIZE);
+    if (buffer == NULL) {
+        ret_val = ALLOC_ERROR;
+        goto exit_file;
+    }
+
+    while ((obtained = fread(buffer, sizeof(char), OBSERVE_READ_SIZE, file)) > 0) {
+        ret_val = observe_data(job, buffer, obtained);
+        if (ret_val != EXIT_OK) {
+            goto exit_buffer;
+        }
+    }
+
+    if (ferror(file)) {
+        ret_val = F_READ_ERROR;
+        goto exit_buffer;
+    }
+
+    ret_val = EXIT_OK;
+    exit_buffer:
+        free(buffer);
+    exit_file:
+        fclose(file);
+    exit_normal:
+        return ret_val;
+}
@@ -0,0 +1,570 @@
+#define _XOPEN_SOURCE 700
+#define _FILE_OFFSET_BITS 64
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "pipeline.h"
+#include "rebuild.h"
+#include "iso.h"
+#include "util.h"
+#include "layout.h"
+#include "zcopy.h"
+#include "observe.h"
+
+typedef struct {
+    rebuild_job_t *job;
+
+    dir_record_t *source;
+    int fd;
+    char *path;
+
+} pipe_reader_t;
+
+static
+uint64_t count_chunks(file_table_t *ft, uint32_t first) {
+    uint64_t total;
+    uint32_t length;
+
+    total = 0;
+    for (int index = first; index < ft->length; index++) {
+        length = ft->table[index]->extent_length;
+        total += (length == 0)? 1 : (length + PIPE_CHUNK_SIZE - 1) / PIPE_CHUNK_SIZE;
+    }
+    return total;
+}
+
+static
+void set_error(pipeline_t *pipe, error_state_t error) {
+    pthread_mutex_lock(&pipe->lock);
+    if (pipe->error == EXIT_OK) {
+        pipe->error = error;
+    }
+    pthread_cond_broadcast(&pipe->slot_free);
+    pthread_cond_broadcast(&pipe->slot_ready);
+    pthread_mutex_unlock(&pipe->lock);
+}
+
+// Hands out the next chunk in ISO order, blocking while the queue is full.
+static
+pipe_slot_t *claim_slot(pipeline_t *pipe) {
+
+    pipe_slot_t *slot;
+    dir_record_t *record;
+
+    pthread_mutex_lock(&pipe->lock);
+    while (pipe->error == EXIT_OK && pipe->claim_seq < pipe->total_seq &&
+            pipe->claim_seq - pipe->write_seq >= pipe->depth) {
+        pthread_cond_wait(&pipe->slot_free, &pipe->lock);
+    }
+
+    if (pipe->error != EXIT_OK || pipe->claim_seq >= pipe->total_seq) {
+        pthread_mutex_unlock(&pipe->lock);
+        return NULL;
+    }
+
+    record = pipe->job->ft->table[pipe->claim_record];
+    slot = &pipe->slots[pipe->claim_seq % pipe->depth];
+
+    slot->record = pipe->claim_record;
+    slot->offset = pipe->claim_offset;
+    slot->length = min(PIPE_CHUNK_SIZE, record->extent_length - pipe->claim_offset);
+    slot->filled = 0;
+    slot->ready = false;
+
+    pipe->claim_seq += 1;
+    pipe->claim_offset += slot->length;
+    if (pipe->claim_offset >= record->extent_length) {
+        pipe->claim_record += 1;
+        pipe->claim_offset = 0;
+    }
+
+    pthread_mutex_unlock(&pipe->lock);
+    return slot;
+}
+
+static
+error_state_t open_source(pipe_reader_t *reader, dir_record_t *record) {
+
+    error_state_t ret_val;
+    dir_record_t *source;
+
+    source = (record->lead_extent != NULL)? record->lead_extent : record;
+    if (reader->source == source) {
+        ret_val = EXIT_OK;
+        goto exit_normal;
+    }
+
+    if (reader->fd != -1) {
+        close(reader->fd);
+        reader->fd = -1;
+        reader->source = NULL;
+    }
+
+    ret_val = build_full_path(reader->path, MAX_PATH_LEN,
+                    reader->job->folder_path, record);
+    if (ret_val != EXIT_OK) {
+        goto exit_normal;
+    }
+
+    reader->fd = open(reader->path, O_RDONLY);
+    if (reader->fd == -1) {
+        ret_val = F_OPEN_ERROR;
+        goto exit_normal;
+    }
+    reader->source = source;
+
+    ret_val = EXIT_OK;
+    exit_normal:
+        return ret_val;
+}
+
+static
+error_state_t read_source(pipe_reader_t *reader, dir_record_t *record, char *buffer,
+                    off_t offset, size_t length, size_t *filled) {
+
+    error_state_t ret_val;
+    ssize_t obtained;
+
+    ret_val = open_source(reader, record);
+    if (ret_val != EXIT_OK) {
+        goto exit_normal;
+    }
+
+    *filled = 0;
+    while (*filled < length) {
+        obtained = pread(reader->fd, buffer + *filled, length - *filled,
+                        record->file_offset + offset + *filled);
+        if (obtained < 0 && errno == EINTR) continue;
+        if (obtained < 0) {
+            ret_val = F_READ_ERROR;
+            goto exit_normal;
+        }
+        if (obtained == 0) break;
+        *filled += obtained;
+    }
+
+    ret_val = EXIT_OK;
+    exit_normal:
+        return ret_val;
+}
+
+static
+error_state_t fill_slot(pipe_reader_t *reader, pipe_slot_t *slot) {
+    return read_source(reader, reader->job->ft->table[slot->record], slot->buffer,
+                    slot->offset, slot->length, &slot->filled);
+}
+
+static
+void *reader_thread(void *arg) {
+
+    error_state_t ret_val;
+    pipeline_t *pipe;
+    pipe_reader_t reader;
+    pipe_slot_t *slot;
+
+    pipe = (pipeline_t *) arg;
+    reader.job = pipe->job;
+    reader.source = NULL;
+    reader.fd = -1;
+
+    reader.path = malloc(MAX_PATH_LEN);
+    if (reader.path == NULL) {
+        set_error(pipe, ALLOC_ERROR);
+        goto exit_normal;
+    }
+
+    while ((slot = claim_slot(pipe)) != NULL) {
+        ret_val = fill_slot(&reader, slot);
+        if (ret_val != EXIT_OK) {
+            set_error(pipe, ret_val);
+            break;
+        }
+
+        pthread_mutex_lock(&pipe->lock);
+        slot->ready = true;
+        pthread_cond_broadcast(&pipe->slot_ready);
+        pthread_mutex_unlock(&pipe->lock);
+    }
+
+    if (reader.fd != -1) close(reader.fd);
+    free(reader.path);
+    exit_normal:
+        return NULL;
+}
+
+// Drains the queue strictly in sequence, padding up to each extent's block.
+static
+error_state_t drain_slots(pipeline_t *pipe, FILE *iso_file) {
+
+    error_state_t ret_val;
+    size_t obtained;
+    off_t position, target;
+    pipe_slot_t *slot;
+    dir_record_t *record;
+
+    position = pipe->job->start_offset;
+    while (pipe->write_seq < pipe->total_seq) {
+        slot = &pipe->slots[pipe->write_seq % pipe->depth];
+
+        pthread_mutex_lock(&pipe->lock);
+        while (pipe->error == EXIT_OK && !slot->ready) {
+            pthread_cond_wait(&pipe->slot_ready, &pipe->lock);
+        }
+        ret_val = pipe->error;
+        pthread_mutex_unlock(&pipe->lock);
+
+        if (ret_val != EXIT_OK) {
+            goto exit_normal;
+        }
+
+        record = pipe->job->ft->table[slot->record];
+
+        if (slot->offset == 0) {
+            ret_val = journal_tick(pipe->job->journal, iso_file, slot->record, position);
+            if (ret_val != EXIT_OK) {
+                goto exit_normal;
+            }
+
+            printf("%s\n", record->file_id);
+
+            target = extent_position(record, pipe->job->block_size);
+            if (target < position) {
+                ret_val = RECORD_ECMA_ERROR;
+                goto exit_normal;
+            }
+
+            ret_val = observe_gap(pipe->job, target - position);
+            if (ret_val != EXIT_OK) {
+                goto exit_normal;
+            }
+
+            ret_val = fill_gap_file(iso_file, target - position, pipe->job->opts->gap_mode);
+            if (ret_val != EXIT_OK) {
+                goto exit_normal;
+            }
+            position = target;
+        }
+
+        if (slot->filled != slot->length) {
+            ret_val = F_SIZE_ERROR;
+            goto exit_normal;
+        }
+
+        obtained = fwrite(slot->buffer, sizeof(char), slot->filled, iso_file);
+        if (obtained != slot->filled) {
+            ret_val = F_WRITE_ERROR;
+            goto exit_normal;
+        }
+        position += slot->filled;
+
+        ret_val = observe_extent(pipe->job, record, slot->offset, slot->buffer, slot->filled);
+        if (ret_val != EXIT_OK) {
+            goto exit_normal;
+        }
+
+        pthread_mutex_lock(&pipe->lock);
+        slot->ready = false;
+        pipe->write_seq += 1;
+        pthread_cond_broadcast(&pipe->slot_free);
+        pthread_mutex_unlock(&pipe->lock);
+    }
+
+    ret_val = EXIT_OK;
+    exit_normal:
+        return ret_val;
+}
+
+error_state_t pipeline_copy(rebuild_job_t *job, FILE *iso_file) {
+
+    error_state_t ret_val;
+    int thread_count, started;
+    pipeline_t pipe;
+    pthread_t threads[MAX_THREADS];
+
+    if (job == NULL || iso_file == NULL) {
+        ret_val = ARG_ERROR;
+        goto exit_early;
+    }
+
+    thread_count = min(max(job->opts->threads, 1), MAX_THREADS);
+
+    memset(&pipe, 0, sizeof(pipe));
+    pipe.job = job;
+    pipe.depth = PIPE_QUEUE_DEPTH;
+    pipe.total_seq = count_chunks(job->ft, job->first_record);
+    pipe.claim_record = job->first_record;
+    pipe.error = EXIT_OK;
+
+    pipe.slots = calloc(pipe.depth, sizeof(*pipe.slots));
+    if (pipe.slots == NULL) {
+        ret_val = ALLOC_ERROR;
+        goto exit_early;
+    }
+
+    for (int index = 0; index < pipe.depth; index++) {
+        pipe.slots[index].buffer = malloc(PIPE_CHUNK_SIZE);
+        if (pipe.slots[index].buffer == NULL) {
+            ret_val = ALLOC_ERROR;
+            goto exit_slots;
+        }
+    }
+
+    pthread_mutex_init(&pipe.lock, NULL);
+    pthread_cond_init(&pipe.slot_free, NULL);
+    pthread_cond_init(&pipe.slot_ready, NULL);
+
+    for (started = 0; started < thread_count; started++) {
+        if (pthread_create(&threads[started], NULL, reader_thread, &pipe) != 0) {
+            set_error(&pipe, THREAD_ERROR);
+            break;
+        }
+    }
+
+    ret_val = drain_slots(&pipe, iso_file);
+    if (ret_val != EXIT_OK) {
+        set_error(&pipe, ret_val);
+    }
+
+    for (int index = 0; index < started; index++) {
+        pthread_join(threads[index], NULL);
+    }
+
+    if (ret_val == EXIT_OK) {
+        ret_val = pipe.error;
+    }
+
+    pthread_cond_destroy(&pipe.slot_ready);
+    pthread_cond_destroy(&pipe.slot_free);
+    pthread_mutex_destroy(&pipe.lock);
+
+    exit_slots:
+        for (int index = 0; index < pipe.depth; index++) {
+            free(pipe.slots[index].buffer);
+        }
+        free(pipe.slots);
+    exit_early:
+        return ret_val;
+}
+
+static
+void set_positional_error(positional_t *pos, error_state_t error) {
+    pthread_mutex_lock(&pos->lock);
+    if (pos->error == EXIT_OK) {
+        pos->error = error;
+    }
+    pthread_mutex_unlock(&pos->lock);
+}
+
+// Hands out the next gap or extent chunk, in no particular completion order.
+static
+iso_segment_t *claim_task(positional_t *pos, off_t *offset, size_t *length) {
+
+    iso_segment_t *segment;
+    iso_layout_t *layout;
+
+    layout = pos->job->layout;
+    segment = NULL;
+
+    pthread_mutex_lock(&pos->lock);
+    while (pos->error == EXIT_OK && pos->claim_segment < layout->length) {
+        segment = &layout->segments[pos->claim_segment];
+
+        if (pos->claim_offset >= segment->length ||
+                segment->kind == SEG_HEADER || segment->kind == SEG_FOOTER ||
+                (segment->kind == SEG_GAP && pos->job->opts->gap_mode == GAP_SPARSE)) {
+            pos->claim_segment += 1;
+            pos->claim_offset = 0;
+            segment = NULL;
+            continue;
+        }
+
+        if (segment->kind == SEG_EXTENT && pos->claim_offset == 0) {
+            printf("%s\n", segment->record->file_id);
+        }
+
+        *offset = pos->claim_offset;
+        *length = min(PIPE_CHUNK_SIZE, segment->length - pos->claim_offset);
+        pos->claim_offset += *length;
+        break;
+    }
+    if (pos->error != EXIT_OK) segment = NULL;
+    pthread_mutex_unlock(&pos->lock);
+
+    return segment;
+}
+
+static
+error_state_t place_chunk(positional_t *pos, pipe_reader_t *reader, zcopy_t *zc,
+                    char *buffer, iso_segment_t *segment, off_t offset, size_t length) {
+
+    error_state_t ret_val;
+    size_t filled;
+    off_t obtained;
+    dir_record_t *record;
+
+    if (segment->kind == SEG_GAP) {
+        ret_val = fill_gap_fd(pos->iso_fd, segment->offset + offset, length,
+                        pos->job->opts->gap_mode);
+        goto exit_normal;
+    }
+
+    record = segment->record;
+
+    if (pos->job->opts->backend == IO_COPY || pos->job->opts->backend == IO_REFLINK) {
+        ret_val = open_source(reader, record);
+        if (ret_val != EXIT_OK) {
+            goto exit_normal;
+        }
+
+        ret_val = zcopy_range(zc, reader->fd, record->file_offset + offset,
+                        pos->iso_fd, segment->offset + offset, length, &obtained);
+        if (ret_val == EXIT_OK && obtained != length) {
+            ret_val = F_SIZE_ERROR;
+        }
+        goto exit_normal;
+    }
+
+    ret_val = read_source(reader, record, buffer, offset, length, &filled);
+    if (ret_val != EXIT_OK) {
+        goto exit_normal;
+    }
+
+    if (filled != length) {
+        ret_val = F_SIZE_ERROR;
+        goto exit_normal;
+    }
+
+    ret_val = write_fd_full(pos->iso_fd, buffer, length, segment->offset + offset);
+
+    exit_normal:
+        return ret_val;
+}
+
+static
+void *positional_thread(void *arg) {
+
+    error_state_t ret_val;
+    positional_t *pos;
+    pipe_reader_t reader;
+    iso_segment_t *segment;
+    zcopy_t zc;
+    char *buffer;
+    off_t offset;
+    size_t length;
+
+    pos = (positional_t *) arg;
+    reader.job = pos->job;
+    reader.source = NULL;
+    reader.fd = -1;
+    zcopy_init(&zc);
+    if (pos->job->opts->backend == IO_REFLINK) {
+        zcopy_share(&zc, pos->iso_fd, &pos->clone_off);
+    }
+
+    reader.path = malloc(MAX_PATH_LEN);
+    if (reader.path == NULL) {
+        set_positional_error(pos, ALLOC_ERROR);
+        goto exit_normal;
+    }
+
+    buffer = malloc(PIPE_CHUNK_SIZE);
+    if (buffer == NULL) {
+        set_positional_error(pos, ALLOC_ERROR);
+        goto exit_path;
+    }
+
+    while ((segment = claim_task(pos, &offset, &length)) != NULL) {
+        ret_val = place_chunk(pos, &reader, &zc, buffer, segment, offset, length);
+        if (ret_val != EXIT_OK) {
+            set_positional_error(pos, ret_val);
+            break;
+        }
+    }
+
+    if (reader.fd != -1) close(reader.fd);
+    free(buffer);
+    exit_path:
+        free(reader.path);
+    exit_normal:
+        zcopy_free(&zc);
+        return NULL;
+}
+
+// Sizes the output up front so that workers can pwrite extents into place
+// in whatever order they finish. The header is already written by then and
+// the footer follows once every worker is done.
+error_state_t pipeline_positional(rebuild_job_t *job, FILE *iso_file) {
+
+    error_state_t ret_val;
+    int thread_count, started;
+    off_t volume_size;
+    positional_t pos;
+    pthread_t threads[MAX_THREADS];
+
+    if (job == NULL || iso_file == NULL || job->layout == NULL) {
+        ret_val = ARG_ERROR;
+        goto exit_early;
+    }
+
+    if (fflush(iso_file) != 0) {
+        ret_val = F_WRITE_ERROR;
+        goto exit_early;
+    }
+
+    memset(&pos, 0, sizeof(pos));
+    pos.job = job;
+    pos.iso_fd = fileno(iso_file);
+    pos.clone_off = false;
+    pos.error = EXIT_OK;
+
+    volume_size = (off_t) job->info->desc->volume_size * job->block_size;
+    volume_size = max(volume_size, job->layout->total_size);
+
+    if (job->opts->gap_mode == GAP_SPARSE ||
+            posix_fallocate(pos.iso_fd, 0, volume_size) != 0) {
+        if (ftruncate(pos.iso_fd, volume_size) != 0) {
+            ret_val = F_WRITE_ERROR;
+            goto exit_early;
+        }
+    }
+
+    thread_count = min(max(job->opts->threads, 1), MAX_THREADS);
+    pthread_mutex_init(&pos.lock, NULL);
+
+    for (started = 0; started < thread_count; started++) {
+        if (pthread_create(&threads[started], NULL, positional_thread, &pos) != 0) {
+            set_positional_error(&pos, THREAD_ERROR);
+            break;
+        }
+    }
+
+    for (int index = 0; index < started; index++) {
+        pthread_join(threads[index], NULL);
+    }
+    pthread_mutex_destroy(&pos.lock);
+
+    ret_val = pos.error;
+    if (ret_val != EXIT_OK) {
+        goto exit_early;
+    }
+
+    if (fseeko(iso_file, job->layout->footer_offset, SEEK_SET) != 0) {
+        ret_val = F_SEEK_ERROR;
+        goto exit_early;
+    }
+
+    ret_val = EXIT_OK;
+    exit_early:
+        return ret_val;
+}
@@ -0,0 +1,297 @@
+#define _XOPEN_SOURCE 700
+#define _FILE_OFFSET_BITS 64
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "region.h"
+#include "util.h"
+
+static
+uint32_t be32(const uint8_t *data) {
+    return ((uint32_t) data[0] << 24) | ((uint32_t) data[1] << 16) |
+           ((uint32_t) data[2] << 8) | (uint32_t) data[3];
+}
+
+static
+error_state_t restart_context(region_check_t *check) {
+    mbedtls_md5_free(&check->ctx);
+    mbedtls_md5_init(&check->ctx);
+    if (mbedtls_md5_starts_ret(&check->ctx) != 0) {
+        return MD5_START_ERROR;
+    }
+    return EXIT_OK;
+}
+
+// Sector 0 holds a big endian count followed by inclusive (start, end) sector
+// pairs of the unencrypted regions, starting at offset 8. The IRD stores one
+// hash per region with the encrypted stretches in between counted as well.
+static
+error_state_t parse_table(region_check_t *check, const uint8_t *sector,
+                    const uint8_t *hashes, uint32_t hash_count) {
+
+    uint32_t plain_count, start, end, next;
+    region_t *region;
+
+    plain_count = be32(sector);
+    if (plain_count == 0 || 8 + (off_t) plain_count*8 > check->block_size) {
+        return REGION_TABLE_ERROR;
+    }
+
+    check->count = plain_count*2 - 1;
+    if (check->count != hash_count) {
+        return REGION_TABLE_ERROR;
+    }
+
+    check->regions = calloc(check->count, sizeof(*check->regions));
+    if (check->regions == NULL) {
+        return ALLOC_ERROR;
+    }
+
+    for (uint32_t index = 0; index < plain_count; index++) {
+        start = be32(sector + 8 + index*8);
+        end = be32(sector + 12 + index*8);
+
+        if (end < start || (index == 0 && start != 0)) {
+            return REGION_TABLE_ERROR;
+        }
+
+        region = &check->regions[index*2];
+        region->start = (off_t) start * check->block_size;
+        region->end = ((off_t) end + 1) * check->block_size;
+
+        if (index + 1 == plain_count) break;
+
+        next = be32(sector + 8 + (index + 1)*8);
+        if (next <= end + 1) {
+            return REGION_TABLE_ERROR;
+        }
+
+        region = &check->regions[index*2 + 1];
+        region->start = ((off_t) end + 1) * check->block_size;
+        region->end = (off_t) next * check->block_size;
+        region->encrypted = true;
+    }
+
+    for (uint32_t index = 0; index < check->count; index++) {
+        check->regions[index].hash = hashes + index*0x10;
+        check->regions[index].state = REGION_PENDING;
+    }
+    return EXIT_OK;
+}
+
+error_state_t region_init(region_check_t *check, FILE *header, uint16_t block_size,
+                    const uint8_t *hashes, uint32_t hash_count) {
+
+    error_state_t ret_val;
+    uint8_t *sector;
+
+    if (check == NULL || header == NULL || hashes == NULL || block_size < 16) {
+        ret_val = ARG_ERROR;
+        goto exit_normal;
+    }
+
+    memset(check, 0, sizeof(*check));
+    check->block_size = block_size;
+    mbedtls_md5_init(&check->ctx);
+
+    sector = malloc(block_size);
+    if (sector == NULL) {
+        ret_val = ALLOC_ERROR;
+        goto exit_normal;
+    }
+
+    if (fseeko(header, 0L, SEEK_SET) != 0) {
+        ret_val = F_SEEK_ERROR;
+        goto exit_sector;
+    }
+
+    if (fread(sector, sizeof(*sector), block_size, header) != block_size) {
+        ret_val = F_READ_ERROR;
+        goto exit_sector;
+    }
+
+    ret_val = parse_table(check, sector, hashes, hash_count);
+    if (ret_val != EXIT_OK) {
+        goto exit_check;
+    }
+
+    ret_val = restart_context(check);
+    if (ret_val != EXIT_OK) {
+        goto exit_check;
+    }
+
+    ret_val = EXIT_OK;
+    goto exit_sector;
+
+    exit_check:
+        region_free(check);
+    exit_sector:
+        free(sector);
+    exit_normal:
+        return ret_val;
+}
+
+// Data has to arrive in output order starting at offset 0
+error_state_t region_update(region_check_t *check, const char *data, size_t length) {
+
+    error_state_t ret_val;
+    uint8_t checksum[0x10];
+    region_t *region;
+    size_t take;
+
+    while (length > 0 && check->current < check->count) {
+        region = &check->regions[check->current];
+        take = min(length, region->end - check->position);
+
+        if (mbedtls_md5_update_ret(&check->ctx, (const unsigned char *) data, take) != 0) {
+            return MD5_UPDT_ERROR;
+        }
+
+        data += take;
+        length -= take;
+        check->position += take;
+
+        if (check->position < region->end) break;
+
+        if (mbedtls_md5_finish_ret(&check->ctx, checksum) != 0) {
+            return MD5_END_ERROR;
+        }
+
+        region->state = (memcmp(checksum, region->hash, 0x10) == 0)? REGION_MATCH : REGION_MISMATCH;
+        check->current += 1;
+
+        ret_val = restart_context(check);
+        if (ret_val != EXIT_OK) {
+            return ret_val;
+        }
+    }
+    return EXIT_OK;
+}
+
+static
+error_state_t hash_region(region_check_t *check, region_t *region, int fd, char *buffer) {
+
+    error_state_t ret_val;
+    uint8_t checksum[0x10];
+    off_t position;
+    ssize_t obtained;
+
+    ret_val = restart_context(check);
+    if (ret_val != EXIT_OK) {
+        return ret_val;
+    }
+
+    for (position = region->start; position < region->end; position += obtained) {
+        obtained = pread(fd, buffer, min(REGION_READ_SIZE, region->end - position), position);
+        if (obtained < 0 && errno == EINTR) {
+            obtained = 0;
+            continue;
+        }
+        if (obtained < 0) return F_READ_ERROR;
+        if (obtained == 0) return F_SIZE_ERROR;
+
+        if (mbedtls_md5_update_ret(&check->ctx, (const unsigned char *) buffer, obtained) != 0) {
+            return MD5_UPDT_ERROR;
+        }
+    }
+
+    if (mbedtls_md5_finish_ret(&check->ctx, checksum) != 0) {
+        return MD5_END_ERROR;
+    }
+
+    region->state = (memcmp(checksum, region->hash, 0x10) == 0)? REGION_MATCH : REGION_MISMATCH;
+    return EXIT_OK;
+}
+
+// Rechecks every region overlapping [start, end) of an already written ISO,
+// reading it back from fd. Regions that were settled before are not reread.
+error_state_t region_verify_span(region_check_t *check, int fd, off_t start, off_t end) {
+
+    error_state_t ret_val;
+    region_t *region;
+    char *buffer;
+
+    buffer = malloc(REGION_READ_SIZE);
+    if (buffer == NULL) {
+        return ALLOC_ERROR;
+    }
+
+    ret_val = EXIT_OK;
+    for (uint32_t index = 0; index < check->count; index++) {
+        region = &check->regions[index];
+        if (region->end <= start || region->start >= end) continue;
+        if (region->state != REGION_PENDING) continue;
+
+        ret_val = hash_region(check, region, fd, buffer);
+        if (ret_val != EXIT_OK) break;
+    }
+
+    free(buffer);
+    return ret_val;
+}
+
+// For in-place updates, regions nothing was written to keep their old result
+void region_skip_pending(region_check_t *check) {
+    for (uint32_t index = 0; index < check->count; index++) {
+        if (check->regions[index].state == REGION_PENDING) {
+            check->regions[index].state = REGION_SKIPPED;
+        }
+    }
+}
+
+// Regions the output never reached count as failures too
+error_state_t region_report(region_check_t *check) {
+
+    bool all_ok;
+    uint32_t skipped;
+    region_t *region;
+
+    all_ok = true;
+    skipped = 0;
+    for (uint32_t index = 0; index < check->count; index++) {
+        if (check->regions[index].state == REGION_SKIPPED) skipped += 1;
+        else if (check->regions[index].state != REGION_MATCH) all_ok = false;
+    }
+
+    if (all_ok && skipped > 0) {
+        printf("\n< %u rewritten regions match the IRD, %u untouched >\n\n",
+                check->count - skipped, skipped);
+        return EXIT_OK;
+    }
+
+    if (all_ok) {
+        printf("\n< All %u regions match the IRD >\n\n", check->count);
+        return EXIT_OK;
+    }
+
+    printf("\n< Region Report >\n");
+    for (uint32_t index = 0; index < check->count; index++) {
+        region = &check->regions[index];
+        if (region->state == REGION_MATCH || region->state == REGION_SKIPPED) continue;
+
+        printf("\tRegion %u (%s, sectors %lld-%lld): %s\n", index,
+                region->encrypted? "encrypted" : "plain",
+                (long long) (region->start / check->block_size),
+                (long long) (region->end / check->block_size - 1),
+                (region->state == REGION_MISMATCH)? "Checksum Mismatch" : "Incomplete");
+    }
+    printf("\n");
+
+    return REGION_HASH_ERROR;
+}
+
+void region_free(region_check_t *check) {
+    free(check->regions);
+    check->regions = NULL;
+    check->count = 0;
+    mbedtls_md5_free(&check->ctx);
+}
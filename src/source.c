@@ -0,0 +1,147 @@
+#define _XOPEN_SOURCE 700
+#define _FILE_OFFSET_BITS 64
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+
+#include "source.h"
+#include "util.h"
+
+static
+dir_record_t *lead_of(dir_record_t *record) {
+    return (record->lead_extent != NULL)? record->lead_extent : record;
+}
+
+// ft has to be sorted already, every lead learns where its file is done
+void group_extents(file_table_t *ft) {
+    for (uint32_t index = 0; index < ft->length; index++) {
+        lead_of(ft->table[index])->last_index = index;
+    }
+}
+
+error_state_t source_init(source_cache_t *cache, file_table_t *ft, const char *folder_path) {
+
+    if (cache == NULL || ft == NULL || folder_path == NULL) {
+        return ARG_ERROR;
+    }
+
+    memset(cache, 0, sizeof(*cache));
+    cache->ft = ft;
+    cache->folder_path = folder_path;
+
+    cache->path = malloc(MAX_PATH_LEN);
+    if (cache->path == NULL) {
+        return ALLOC_ERROR;
+    }
+
+    group_extents(ft);
+    return EXIT_OK;
+}
+
+static
+void close_file(source_file_t *file) {
+    if (file->file != NULL) fclose(file->file);
+    file->file = NULL;
+    file->lead = NULL;
+}
+
+// A free slot if there is one, otherwise the file needed again the latest
+static
+source_file_t *pick_slot(source_cache_t *cache) {
+
+    source_file_t *victim;
+
+    victim = &cache->files[0];
+    for (int slot = 0; slot < SOURCE_MAX_OPEN; slot++) {
+        if (cache->files[slot].lead == NULL) {
+            return &cache->files[slot];
+        }
+        if (cache->files[slot].lead->last_index > victim->lead->last_index) {
+            victim = &cache->files[slot];
+        }
+    }
+
+    close_file(victim);
+    return victim;
+}
+
+static
+source_file_t *find_slot(source_cache_t *cache, dir_record_t *lead) {
+    for (int slot = 0; slot < SOURCE_MAX_OPEN; slot++) {
+        if (cache->files[slot].lead == lead) {
+            return &cache->files[slot];
+        }
+    }
+    return NULL;
+}
+
+// Hands out the source of ft entry index positioned at its extent
+error_state_t source_get(source_cache_t *cache, uint32_t index, FILE **file) {
+
+    error_state_t ret_val;
+    dir_record_t *record, *lead;
+    source_file_t *source;
+
+    record = cache->ft->table[index];
+    lead = lead_of(record);
+
+    source = find_slot(cache, lead);
+    if (source == NULL) {
+        ret_val = build_full_path(cache->path, MAX_PATH_LEN, cache->folder_path, record);
+        if (ret_val != EXIT_OK) {
+            return ret_val;
+        }
+
+        source = pick_slot(cache);
+        source->file = fopen(cache->path, "r");
+        if (source->file == NULL) {
+            return F_OPEN_ERROR;
+        }
+        source->lead = lead;
+        source->position = 0;
+        posix_fadvise(fileno(source->file), 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+    if (source->position != record->file_offset) {
+        if (fseeko(source->file, record->file_offset, SEEK_SET) != 0) {
+            return F_SEEK_ERROR;
+        }
+        source->position = record->file_offset;
+    }
+
+    *file = source->file;
+    return EXIT_OK;
+}
+
+// Records how far the extent's read went, the file closes after its last one
+void source_done(source_cache_t *cache, uint32_t index, off_t consumed) {
+
+    dir_record_t *record, *lead;
+    source_file_t *source;
+
+    record = cache->ft->table[index];
+    lead = lead_of(record);
+
+    source = find_slot(cache, lead);
+    if (source == NULL) return;
+
+    source->position = record->file_offset + consumed;
+    if (index >= lead->last_index) {
+        close_file(source);
+    }
+}
+
+void source_free(source_cache_t *cache) {
+    for (int slot = 0; slot < SOURCE_MAX_OPEN; slot++) {
+        close_file(&cache->files[slot]);
+    }
+    free(cache->path);
+    cache->path = NULL;
+}
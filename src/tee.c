@@ -0,0 +1,282 @@
+#define _GNU_SOURCE
+#define _XOPEN_SOURCE 700
+#define _FILE_OFFSET_BITS 64
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <pthread.h>
+
+#include "tee.h"
+#include "util.h"
+
+// A target that failed keeps draining the ring without writing, so the
+// feeder never waits on it. The error stops the feeder on its next chunk.
+static
+void *tee_worker(void *arg) {
+
+    tee_target_t *target = arg;
+    tee_writer_t *tee = target->tee;
+    tee_chunk_t *chunk;
+    error_state_t ret_val;
+
+    pthread_mutex_lock(&tee->lock);
+    while (true) {
+        while (!tee->stop && target->write_seq >= tee->fill_seq) {
+            pthread_cond_wait(&tee->filled, &tee->lock);
+        }
+        if (target->write_seq >= tee->fill_seq) break;
+
+        chunk = &tee->chunks[target->write_seq % TEE_DEPTH];
+        ret_val = target->error;
+        pthread_mutex_unlock(&tee->lock);
+
+        if (ret_val == EXIT_OK) {
+            ret_val = write_fd_full(target->fd, chunk->data, chunk->filled,
+                            (off_t) target->write_seq * TEE_CHUNK_SIZE);
+        }
+
+        pthread_mutex_lock(&tee->lock);
+        target->error = ret_val;
+        target->write_seq += 1;
+        chunk->pending -= 1;
+        if (chunk->pending == 0) {
+            pthread_cond_broadcast(&tee->freed);
+        }
+    }
+    pthread_mutex_unlock(&tee->lock);
+
+    return NULL;
+}
+
+// Called with the lock held
+static
+error_state_t target_error(tee_writer_t *tee) {
+    for (int index = 0; index < tee->target_count; index++) {
+        if (tee->targets[index].error != EXIT_OK) {
+            return tee->targets[index].error;
+        }
+    }
+    return EXIT_OK;
+}
+
+static
+error_state_t submit_chunk(tee_writer_t *tee) {
+
+    error_state_t ret_val;
+    tee_chunk_t *chunk;
+
+    pthread_mutex_lock(&tee->lock);
+    tee->chunks[tee->fill_seq % TEE_DEPTH].pending = tee->started;
+    tee->fill_seq += 1;
+    pthread_cond_broadcast(&tee->filled);
+
+    // The next slot is only refilled once every target has written it
+    chunk = &tee->chunks[tee->fill_seq % TEE_DEPTH];
+    while (chunk->pending > 0) {
+        pthread_cond_wait(&tee->freed, &tee->lock);
+    }
+    chunk->filled = 0;
+
+    ret_val = target_error(tee);
+    pthread_mutex_unlock(&tee->lock);
+
+    return ret_val;
+}
+
+error_state_t tee_write(tee_writer_t *tee, const char *data, size_t length) {
+
+    error_state_t ret_val;
+    tee_chunk_t *chunk;
+    size_t take;
+
+    while (length > 0) {
+        chunk = &tee->chunks[tee->fill_seq % TEE_DEPTH];
+        take = min(length, TEE_CHUNK_SIZE - chunk->filled);
+
+        memcpy(chunk->data + chunk->filled, data, take);
+        chunk->filled += take;
+        data += take;
+        length -= take;
+
+        if (chunk->filled == TEE_CHUNK_SIZE) {
+            ret_val = submit_chunk(tee);
+            if (ret_val != EXIT_OK) {
+                return ret_val;
+            }
+        }
+    }
+    return EXIT_OK;
+}
+
+static
+ssize_t cookie_write(void *cookie, const char *data, size_t length) {
+    return (tee_write(cookie, data, length) == EXIT_OK)? (ssize_t) length : 0;
+}
+
+FILE *tee_stream(tee_writer_t *tee) {
+    return tee->stream;
+}
+
+// The same file named twice would get two writers racing over it
+static
+bool same_file(tee_writer_t *tee, int fd) {
+
+    struct stat st, other;
+
+    if (fstat(fd, &st) != 0) {
+        return false;
+    }
+
+    for (int index = 0; index < tee->target_count; index++) {
+        if (fstat(tee->targets[index].fd, &other) == 0 &&
+                st.st_dev == other.st_dev && st.st_ino == other.st_ino) {
+            return true;
+        }
+    }
+    return false;
+}
+
+error_state_t tee_open(tee_writer_t **tee_wrap, char **paths, int count) {
+
+    error_state_t ret_val;
+    tee_writer_t *tee;
+    tee_target_t *target;
+    int fd;
+    cookie_io_functions_t functions = {NULL, cookie_write, NULL, NULL};
+
+    if (tee_wrap == NULL || paths == NULL || count <= 0 || count > TEE_MAX_TARGETS) {
+        ret_val = ARG_ERROR;
+        goto exit_normal;
+    }
+
+    tee = calloc(1, sizeof(*tee));
+    if (tee == NULL) {
+        ret_val = ALLOC_ERROR;
+        goto exit_normal;
+    }
+
+    for (int slot = 0; slot < TEE_DEPTH; slot++) {
+        tee->chunks[slot].data = malloc(TEE_CHUNK_SIZE);
+        if (tee->chunks[slot].data == NULL) {
+            ret_val = ALLOC_ERROR;
+            goto exit_targets;
+        }
+    }
+
+    for (int index = 0; index < count; index++) {
+        fd = open(paths[index], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd == -1) {
+            printf("Can't open %s\n", paths[index]);
+            ret_val = F_OPEN_ERROR;
+            goto exit_targets;
+        }
+
+        if (same_file(tee, fd)) {
+            printf("%s is already one of the outputs\n", paths[index]);
+            close(fd);
+            ret_val = ARG_ERROR;
+            goto exit_targets;
+        }
+
+        target = &tee->targets[tee->target_count];
+        target->tee = tee;
+        target->fd = fd;
+        target->error = EXIT_OK;
+        tee->target_count += 1;
+    }
+
+    tee->stream = fopencookie(tee, "w", functions);
+    if (tee->stream == NULL) {
+        ret_val = ALLOC_ERROR;
+        goto exit_targets;
+    }
+    setvbuf(tee->stream, NULL, _IOFBF, TEE_CHUNK_SIZE);
+
+    pthread_mutex_init(&tee->lock, NULL);
+    pthread_cond_init(&tee->filled, NULL);
+    pthread_cond_init(&tee->freed, NULL);
+
+    for (int index = 0; index < tee->target_count; index++) {
+        target = &tee->targets[index];
+        if (pthread_create(&target->thread, NULL, tee_worker, target) != 0) {
+            fclose(tee->stream);
+            tee_free(tee);
+            ret_val = THREAD_ERROR;
+            goto exit_normal;
+        }
+        tee->started += 1;
+    }
+
+    *tee_wrap = tee;
+    ret_val = EXIT_OK;
+    goto exit_normal;
+
+    exit_targets:
+        for (int index = 0; index < tee->target_count; index++) {
+            close(tee->targets[index].fd);
+        }
+        for (int slot = 0; slot < TEE_DEPTH; slot++) {
+            free(tee->chunks[slot].data);
+        }
+        free(tee);
+    exit_normal:
+        return ret_val;
+}
+
+// The stream must have been closed already so nothing is left in its buffer.
+// Returns once every target has written everything.
+error_state_t tee_finish(tee_writer_t *tee) {
+
+    error_state_t ret_val;
+
+    if (tee->chunks[tee->fill_seq % TEE_DEPTH].filled > 0) {
+        ret_val = submit_chunk(tee);
+        if (ret_val != EXIT_OK) {
+            return ret_val;
+        }
+    }
+
+    pthread_mutex_lock(&tee->lock);
+    for (int slot = 0; slot < TEE_DEPTH; slot++) {
+        while (tee->chunks[slot].pending > 0) {
+            pthread_cond_wait(&tee->freed, &tee->lock);
+        }
+    }
+    ret_val = target_error(tee);
+    pthread_mutex_unlock(&tee->lock);
+
+    return ret_val;
+}
+
+void tee_free(tee_writer_t *tee) {
+
+    pthread_mutex_lock(&tee->lock);
+    tee->stop = true;
+    pthread_cond_broadcast(&tee->filled);
+    pthread_mutex_unlock(&tee->lock);
+
+    for (int index = 0; index < tee->started; index++) {
+        pthread_join(tee->targets[index].thread, NULL);
+    }
+
+    for (int index = 0; index < tee->target_count; index++) {
+        close(tee->targets[index].fd);
+    }
+    for (int slot = 0; slot < TEE_DEPTH; slot++) {
+        free(tee->chunks[slot].data);
+    }
+
+    pthread_cond_destroy(&tee->freed);
+    pthread_cond_destroy(&tee->filled);
+    pthread_mutex_destroy(&tee->lock);
+    free(tee);
+}
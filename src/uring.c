@@ -0,0 +1,590 @@
+#define _GNU_SOURCE
+#define _XOPEN_SOURCE 700
+#define _FILE_OFFSET_BITS 64
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "uring.h"
+#include "rebuild.h"
+#include "iso.h"
+#include "util.h"
+
+typedef struct {
+    dir_record_t *source;
+    int fd;
+    int refs;
+
+} uring_file_t;
+
+typedef struct {
+    uring_file_t *file;
+    char *buffer;
+    char *data;
+
+    off_t src_offset;
+    off_t dst_offset;
+    size_t length;
+    size_t done;
+
+    bool writing;
+    bool busy;
+
+} uring_slot_t;
+
+typedef struct {
+    rebuild_job_t *job;
+    uring_t ring;
+    int iso_fd;
+
+    uring_slot_t *slots;
+    char *zero_buffer;
+    unsigned inflight;
+
+    uint32_t rec_index;
+    off_t rec_offset;
+    off_t position;
+    uring_file_t *cur_file;
+
+    char *path;
+
+} uring_copy_t;
+
+error_state_t uring_init(uring_t *ring, unsigned entries) {
+
+    error_state_t ret_val;
+    struct io_uring_params params;
+
+    if (ring == NULL || entries == 0) {
+        ret_val = ARG_ERROR;
+        goto exit_early;
+    }
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&params, 0, sizeof(params));
+
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0) {
+        ret_val = URING_SETUP_ERROR;
+        goto exit_early;
+    }
+
+    // Plain IORING_OP_READ/WRITE arrived together with this feature bit
+    if (!(params.features & IORING_FEAT_RW_CUR_POS)) {
+        ret_val = URING_SETUP_ERROR;
+        goto exit_fd;
+    }
+
+    ring->entries = params.sq_entries;
+    ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->sq_size = max(ring->sq_size, ring->cq_size);
+        ring->cq_size = ring->sq_size;
+    }
+
+    ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED) {
+        ret_val = URING_SETUP_ERROR;
+        goto exit_fd;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ptr = ring->sq_ptr;
+    } else {
+        ring->cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED) {
+            ret_val = URING_SETUP_ERROR;
+            goto exit_sq;
+        }
+    }
+
+    ring->sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe),
+                    PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ret_val = URING_SETUP_ERROR;
+        goto exit_cq;
+    }
+
+    ring->sq_head = (unsigned *) ((char *) ring->sq_ptr + params.sq_off.head);
+    ring->sq_tail = (unsigned *) ((char *) ring->sq_ptr + params.sq_off.tail);
+    ring->sq_mask = (unsigned *) ((char *) ring->sq_ptr + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *) ((char *) ring->sq_ptr + params.sq_off.array);
+
+    ring->cq_head = (unsigned *) ((char *) ring->cq_ptr + params.cq_off.head);
+    ring->cq_tail = (unsigned *) ((char *) ring->cq_ptr + params.cq_off.tail);
+    ring->cq_mask = (unsigned *) ((char *) ring->cq_ptr + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) ((char *) ring->cq_ptr + params.cq_off.cqes);
+
+    ret_val = EXIT_OK;
+    goto exit_early;
+
+    exit_cq:
+        if (ring->cq_ptr != ring->sq_ptr) munmap(ring->cq_ptr, ring->cq_size);
+    exit_sq:
+        munmap(ring->sq_ptr, ring->sq_size);
+    exit_fd:
+        close(ring->fd);
+    exit_early:
+        return ret_val;
+}
+
+void uring_free(uring_t *ring) {
+    munmap(ring->sqes, ring->entries * sizeof(struct io_uring_sqe));
+    if (ring->cq_ptr != ring->sq_ptr) munmap(ring->cq_ptr, ring->cq_size);
+    munmap(ring->sq_ptr, ring->sq_size);
+    close(ring->fd);
+}
+
+struct io_uring_sqe *uring_get_sqe(uring_t *ring) {
+
+    unsigned head, tail, index;
+    struct io_uring_sqe *sqe;
+
+    head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    tail = *ring->sq_tail + ring->sq_pending;
+    if (tail - head >= ring->entries) {
+        return NULL;
+    }
+
+    index = tail & *ring->sq_mask;
+    sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+
+    ring->sq_array[index] = index;
+    ring->sq_pending += 1;
+    return sqe;
+}
+
+// Entries the kernel doesn't take are unpublished again and stay pending,
+// so the tail only ever covers what the kernel has
+error_state_t uring_submit(uring_t *ring, unsigned wait_count) {
+
+    int obtained;
+    unsigned flags, tail, taken;
+
+    tail = *ring->sq_tail;
+    __atomic_store_n(ring->sq_tail, tail + ring->sq_pending, __ATOMIC_RELEASE);
+    flags = (wait_count > 0)? IORING_ENTER_GETEVENTS : 0;
+
+    do {
+        obtained = syscall(__NR_io_uring_enter, ring->fd, ring->sq_pending,
+                        wait_count, flags, NULL, 0);
+    } while (obtained < 0 && errno == EINTR);
+
+    taken = (obtained < 0)? 0 : min(obtained, ring->sq_pending);
+    __atomic_store_n(ring->sq_tail, tail + taken, __ATOMIC_RELEASE);
+    ring->sq_pending -= taken;
+
+    return (obtained < 0)? URING_SUBMIT_ERROR : EXIT_OK;
+}
+
+struct io_uring_cqe *uring_peek_cqe(uring_t *ring) {
+
+    unsigned head;
+
+    head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    return &ring->cqes[head & *ring->cq_mask];
+}
+
+void uring_cqe_seen(uring_t *ring) {
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+static
+void release_file(uring_file_t *file) {
+    if (file == NULL) return;
+    file->refs -= 1;
+    if (file->refs == 0) {
+        close(file->fd);
+        free(file);
+    }
+}
+
+static
+error_state_t open_source(uring_copy_t *copy, dir_record_t *record) {
+
+    error_state_t ret_val;
+    dir_record_t *source;
+    uring_file_t *file;
+
+    source = (record->lead_extent != NULL)? record->lead_extent : record;
+    if (copy->cur_file != NULL && copy->cur_file->source == source) {
+        ret_val = EXIT_OK;
+        goto exit_normal;
+    }
+
+    ret_val = build_full_path(copy->path, MAX_PATH_LEN, copy->job->folder_path, record);
+    if (ret_val != EXIT_OK) {
+        goto exit_normal;
+    }
+
+    file = malloc(sizeof(*file));
+    if (file == NULL) {
+        ret_val = ALLOC_ERROR;
+        goto exit_normal;
+    }
+
+    file->fd = open(copy->path, O_RDONLY);
+    if (file->fd == -1) {
+        free(file);
+        ret_val = F_OPEN_ERROR;
+        goto exit_normal;
+    }
+    file->source = source;
+    file->refs = 1;
+
+    release_file(copy->cur_file);
+    copy->cur_file = file;
+
+    ret_val = EXIT_OK;
+    exit_normal:
+        return ret_val;
+}
+
+// Every busy slot holds at most one entry and the ring has room for all of
+// them, so a full ring means that bookkeeping is broken
+static
+error_state_t queue_slot(uring_copy_t *copy, uring_slot_t *slot) {
+
+    struct io_uring_sqe *sqe;
+
+    sqe = uring_get_sqe(&copy->ring);
+    if (sqe == NULL) {
+        return URING_SUBMIT_ERROR;
+    }
+
+    if (slot->writing) {
+        sqe->opcode = IORING_OP_WRITE;
+        sqe->fd = copy->iso_fd;
+        sqe->off = slot->dst_offset + slot->done;
+        sqe->addr = (uint64_t) (uintptr_t) (slot->data + slot->done);
+    } else {
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = slot->file->fd;
+        sqe->off = slot->src_offset + slot->done;
+        sqe->addr = (uint64_t) (uintptr_t) (slot->data + slot->done);
+    }
+    sqe->len = slot->length - slot->done;
+    sqe->user_data = (uint64_t) (uintptr_t) slot;
+
+    copy->inflight += 1;
+    return EXIT_OK;
+}
+
+// Turns the next gap or extent chunk into an operation on a free slot.
+static
+error_state_t next_task(uring_copy_t *copy, uring_slot_t *slot, bool *queued) {
+
+    error_state_t ret_val;
+    off_t target;
+    dir_record_t *record;
+    rebuild_job_t *job;
+
+    job = copy->job;
+    *queued = false;
+
+    while (copy->rec_index < job->ft->length) {
+        record = job->ft->table[copy->rec_index];
+        target = extent_position(record, job->block_size);
+
+        if (copy->rec_offset == 0 && copy->position > target) {
+            ret_val = RECORD_ECMA_ERROR;
+            goto exit_normal;
+        }
+
+        if (copy->rec_offset == 0 && copy->position < target &&
+                job->opts->gap_mode != GAP_ZERO) {
+            ret_val = fill_gap_fd(copy->iso_fd, copy->position,
+                            target - copy->position, job->opts->gap_mode);
+            if (ret_val != EXIT_OK) {
+                goto exit_normal;
+            }
+            copy->position = target;
+        }
+
+        if (copy->rec_offset == 0 && copy->position < target) {
+            slot->file = NULL;
+            slot->data = copy->zero_buffer;
+            slot->dst_offset = copy->position;
+            slot->length = min(URING_CHUNK_SIZE, target - copy->position);
+            slot->writing = true;
+
+            copy->position += slot->length;
+            *queued = true;
+            break;
+        }
+
+        if (copy->rec_offset == 0) {
+            printf("%s\n", record->file_id);
+        }
+
+        if (copy->rec_offset >= record->extent_length) {
+            copy->position = target + record->extent_length;
+            copy->rec_index += 1;
+            copy->rec_offset = 0;
+            continue;
+        }
+
+        ret_val = open_source(copy, record);
+        if (ret_val != EXIT_OK) {
+            goto exit_normal;
+        }
+
+        slot->file = copy->cur_file;
+        slot->file->refs += 1;
+        slot->data = slot->buffer;
+        slot->src_offset = record->file_offset + copy->rec_offset;
+        slot->dst_offset = target + copy->rec_offset;
+        slot->length = min(URING_CHUNK_SIZE, record->extent_length - copy->rec_offset);
+        slot->writing = false;
+
+        copy->rec_offset += slot->length;
+        *queued = true;
+        break;
+    }
+
+    if (*queued) {
+        slot->done = 0;
+        slot->busy = true;
+    }
+
+    ret_val = EXIT_OK;
+    exit_normal:
+        return ret_val;
+}
+
+static
+error_state_t complete_slot(uring_slot_t *slot, int result) {
+
+    if (result <= 0) {
+        release_file(slot->file);
+        slot->file = NULL;
+        slot->busy = false;
+    }
+
+    if (result < 0) {
+        return (slot->writing)? F_WRITE_ERROR : F_READ_ERROR;
+    }
+
+    if (result == 0) {
+        return (slot->writing)? F_WRITE_ERROR : F_SIZE_ERROR;
+    }
+
+    slot->done += result;
+    if (slot->done < slot->length) {
+        return EXIT_OK;
+    }
+
+    if (!slot->writing) {
+        slot->writing = true;
+        slot->done = 0;
+        return EXIT_OK;
+    }
+
+    release_file(slot->file);
+    slot->file = NULL;
+    slot->busy = false;
+    return EXIT_OK;
+}
+
+// Takes back the entries the kernel never saw and frees their slots
+static
+void drop_pending(uring_copy_t *copy) {
+
+    uring_t *ring;
+    uring_slot_t *slot;
+    struct io_uring_sqe *sqe;
+
+    ring = &copy->ring;
+
+    for (unsigned index = 0; index < ring->sq_pending; index++) {
+        sqe = &ring->sqes[(*ring->sq_tail + index) & *ring->sq_mask];
+        slot = (uring_slot_t *) (uintptr_t) sqe->user_data;
+        release_file(slot->file);
+        slot->file = NULL;
+        slot->busy = false;
+        copy->inflight -= 1;
+    }
+    ring->sq_pending = 0;
+}
+
+static
+error_state_t run_ring(uring_copy_t *copy) {
+
+    error_state_t ret_val, err_val;
+    bool queued, draining;
+    uring_slot_t *slot;
+    struct io_uring_cqe *cqe;
+
+    err_val = EXIT_OK;
+    draining = false;
+
+    do {
+        for (int index = 0; index < URING_QUEUE_DEPTH && !draining; index++) {
+            slot = &copy->slots[index];
+            if (slot->busy) continue;
+
+            ret_val = next_task(copy, slot, &queued);
+            if (ret_val != EXIT_OK) {
+                err_val = ret_val;
+                draining = true;
+                break;
+            }
+            if (!queued) {
+                draining = true;
+                break;
+            }
+
+            ret_val = queue_slot(copy, slot);
+            if (ret_val != EXIT_OK) {
+                release_file(slot->file);
+                slot->file = NULL;
+                slot->busy = false;
+                err_val = ret_val;
+                draining = true;
+                break;
+            }
+        }
+
+        if (copy->inflight == 0) break;
+
+        // The kernel may still be reading into or writing from the slots it
+        // already has, so a failed submit stops queueing but keeps reaping
+        ret_val = uring_submit(&copy->ring, 1);
+        if (ret_val != EXIT_OK) {
+            if (err_val == EXIT_OK) {
+                err_val = ret_val;
+            }
+            draining = true;
+            drop_pending(copy);
+        }
+
+        while ((cqe = uring_peek_cqe(&copy->ring)) != NULL) {
+            slot = (uring_slot_t *) (uintptr_t) cqe->user_data;
+            ret_val = complete_slot(slot, cqe->res);
+            uring_cqe_seen(&copy->ring);
+            copy->inflight -= 1;
+
+            if (ret_val != EXIT_OK && err_val == EXIT_OK) {
+                err_val = ret_val;
+                draining = true;
+            }
+
+            if (slot->busy && err_val == EXIT_OK) {
+                err_val = queue_slot(copy, slot);
+                draining = draining || err_val != EXIT_OK;
+            }
+            if (slot->busy && err_val != EXIT_OK) {
+                release_file(slot->file);
+                slot->file = NULL;
+                slot->busy = false;
+            }
+        }
+    } while (copy->inflight > 0 || !draining);
+
+    return err_val;
+}
+
+error_state_t uring_copy(rebuild_job_t *job, FILE *iso_file) {
+
+    error_state_t ret_val;
+    uring_copy_t copy;
+
+    if (job == NULL || iso_file == NULL) {
+        ret_val = ARG_ERROR;
+        goto exit_early;
+    }
+
+    memset(&copy, 0, sizeof(copy));
+    copy.job = job;
+
+    if (fflush(iso_file) != 0) {
+        ret_val = F_WRITE_ERROR;
+        goto exit_early;
+    }
+
+    copy.iso_fd = fileno(iso_file);
+    copy.position = ftello(iso_file);
+    if (copy.position == -1) {
+        ret_val = F_SEEK_ERROR;
+        goto exit_early;
+    }
+
+    ret_val = uring_init(&copy.ring, URING_QUEUE_DEPTH);
+    if (ret_val != EXIT_OK) {
+        goto exit_early;
+    }
+
+    copy.path = malloc(MAX_PATH_LEN);
+    if (copy.path == NULL) {
+        ret_val = ALLOC_ERROR;
+        goto exit_ring;
+    }
+
+    copy.zero_buffer = calloc(URING_CHUNK_SIZE, sizeof(char));
+    if (copy.zero_buffer == NULL) {
+        ret_val = ALLOC_ERROR;
+        goto exit_path;
+    }
+
+    copy.slots = calloc(URING_QUEUE_DEPTH, sizeof(*copy.slots));
+    if (copy.slots == NULL) {
+        ret_val = ALLOC_ERROR;
+        goto exit_zero;
+    }
+
+    for (int index = 0; index < URING_QUEUE_DEPTH; index++) {
+        copy.slots[index].buffer = malloc(URING_CHUNK_SIZE);
+        if (copy.slots[index].buffer == NULL) {
+            ret_val = ALLOC_ERROR;
+            goto exit_slots;
+        }
+    }
+
+    ret_val = run_ring(&copy);
+    release_file(copy.cur_file);
+
+    if (ret_val != EXIT_OK) {
+        goto exit_slots;
+    }
+
+    if (fseeko(iso_file, copy.position, SEEK_SET) != 0) {
+        ret_val = F_SEEK_ERROR;
+        goto exit_slots;
+    }
+
+    ret_val = EXIT_OK;
+
+    exit_slots:
+        for (int index = 0; index < URING_QUEUE_DEPTH; index++) {
+            free(copy.slots[index].buffer);
+        }
+        free(copy.slots);
+    exit_zero:
+        free(copy.zero_buffer);
+    exit_path:
+        free(copy.path);
+    exit_ring:
+        uring_free(&copy.ring);
+    exit_early:
+        return ret_val;
+}
@@ -9,12 +9,15 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 
-#include <mbedtls/md5.h>
 #include <zlib.h>
 
 #include "util.h"
 #include "fault.h"
+#include "hash.h"
 
 error_state_t utf16_to_utf8(uint16_t *stw, uint8_t *stb) {
 
@@ -47,11 +50,10 @@ error_state_t utf16_to_utf8(uint16_t *stw, uint8_t *stb) {
 error_state_t calc_checksum(uint8_t *checksum, char *file_path) {
 
     error_state_t ret_val;
-    int md5_val;
     size_t obtained;
     void *buffer;
     FILE *file;
-    mbedtls_md5_context ctx;
+    hash_md5_t hash;
 
     if (checksum == NULL || file_path == NULL) {
         ret_val = ARG_ERROR;
@@ -64,37 +66,33 @@ error_state_t calc_checksum(uint8_t *checksum, char *file_path) {
         goto exit_early;
     }
 
-    mbedtls_md5_init(&ctx);
-    md5_val = mbedtls_md5_starts_ret(&ctx);
-    if (md5_val != 0) {
-        ret_val = MD5_START_ERROR;
-        goto exit_early;
+    ret_val = hash_md5_init(&hash);
+    if (ret_val != EXIT_OK) {
+        goto exit_file;
     }
 
-    buffer = malloc(BUFF_SIFE);
+    buffer = malloc(CHECKSUM_BUFF_SIZE);
     if (buffer == NULL) {
         ret_val = ALLOC_ERROR;
         goto exit_md5;
     }
 
-    obtained = BUFF_SIFE;
+    obtained = CHECKSUM_BUFF_SIZE;
 
-    while (obtained == BUFF_SIFE) {
-        obtained = fread(buffer, sizeof(uint8_t), BUFF_SIFE, file);
+    while (obtained == CHECKSUM_BUFF_SIZE) {
+        obtained = fread(buffer, sizeof(uint8_t), CHECKSUM_BUFF_SIZE, file);
         if (obtained < 0) {
             ret_val = F_READ_ERROR;
             goto exit_normal;
         }
         if (obtained == 0) break;
-        md5_val = mbedtls_md5_update_ret(&ctx, buffer, obtained);
-        if (md5_val != 0) {
-            ret_val = MD5_UPDT_ERROR;
+        ret_val = hash_md5_update(&hash, buffer, obtained);
+        if (ret_val != EXIT_OK) {
             goto exit_normal;
         }
     }
-    md5_val = mbedtls_md5_finish_ret(&ctx, checksum);
-    if (md5_val != 0) {
-        ret_val = MD5_END_ERROR;
+    ret_val = hash_md5_finish(&hash, checksum);
+    if (ret_val != EXIT_OK) {
         goto exit_normal;
     }
 
@@ -103,7 +101,7 @@ error_state_t calc_checksum(uint8_t *checksum, char *file_path) {
     exit_normal:
         free(buffer);
     exit_md5:
-        mbedtls_md5_free(&ctx);
+        hash_md5_free(&hash);
     exit_file:
         fclose(file);
     exit_early:
@@ -156,7 +154,142 @@ error_state_t zero_out_file(FILE *in_file, off_t size) {
         return ret_val;
 }
 
+error_state_t zero_out_fd(int fd, off_t offset, off_t size) {
+
+    error_state_t ret_val;
+    off_t write_total;
+    ssize_t obtained;
+    char *buffer;
+
+    if (fd < 0 || size < 0) {
+        ret_val = ARG_ERROR;
+        goto exit_early;
+    }
+
+    if (size == 0) {
+        ret_val = EXIT_OK;
+        goto exit_early;
+    }
+
+    buffer = calloc(ZERO_BUFF_SIZE, sizeof(*buffer));
+    if (buffer == NULL) {
+        ret_val = ALLOC_ERROR;
+        goto exit_early;
+    }
+
+    write_total = 0;
+
+    while (write_total < size) {
+        obtained = pwrite(fd, buffer, min(ZERO_BUFF_SIZE, size - write_total),
+                        offset + write_total);
+        if (obtained < 0 && errno == EINTR) continue;
+        if (obtained <= 0) {
+            ret_val = F_WRITE_ERROR;
+            goto exit_normal;
+        }
+        write_total += obtained;
+    }
+
+    ret_val = EXIT_OK;
+
+    exit_normal:
+        free(buffer);
+    exit_early:
+        return ret_val;
+}
+
+error_state_t write_fd_full(int fd, const void *buffer, size_t size, off_t offset) {
+
+    ssize_t obtained;
+    size_t written;
+
+    written = 0;
+    while (written < size) {
+        obtained = pwrite(fd, (const char *) buffer + written, size - written, offset + written);
+        if (obtained < 0 && errno == EINTR) continue;
+        if (obtained <= 0) {
+            return F_WRITE_ERROR;
+        }
+        written += obtained;
+    }
+    return EXIT_OK;
+}
+
+// Sparse gaps are left as holes, reserved gaps are allocated without being
+// written. Both read back as zeros, so the output stays byte-identical.
+error_state_t fill_gap_fd(int fd, off_t offset, off_t size, gap_mode_t mode) {
+
+    error_state_t ret_val;
+
+    if (fd < 0 || size < 0) {
+        ret_val = ARG_ERROR;
+        goto exit_normal;
+    }
+
+    if (size == 0 || mode == GAP_SPARSE) {
+        ret_val = EXIT_OK;
+        goto exit_normal;
+    }
+
+    if (mode == GAP_RESERVE && posix_fallocate(fd, offset, size) == 0) {
+        ret_val = EXIT_OK;
+        goto exit_normal;
+    }
+
+    ret_val = zero_out_fd(fd, offset, size);
+
+    exit_normal:
+        return ret_val;
+}
+
+error_state_t fill_gap_file(FILE *out_file, off_t size, gap_mode_t mode) {
+
+    error_state_t ret_val;
+    off_t position;
+
+    if (out_file == NULL || size < 0) {
+        ret_val = ARG_ERROR;
+        goto exit_normal;
+    }
+
+    if (mode == GAP_ZERO) {
+        ret_val = zero_out_file(out_file, size);
+        goto exit_normal;
+    }
+
+    if (fflush(out_file) != 0) {
+        ret_val = F_WRITE_ERROR;
+        goto exit_normal;
+    }
+
+    position = ftello(out_file);
+    if (position == -1) {
+        ret_val = F_SEEK_ERROR;
+        goto exit_normal;
+    }
+
+    ret_val = fill_gap_fd(fileno(out_file), position, size, mode);
+    if (ret_val != EXIT_OK) {
+        goto exit_normal;
+    }
+
+    if (fseeko(out_file, position + size, SEEK_SET) != 0) {
+        ret_val = F_SEEK_ERROR;
+        goto exit_normal;
+    }
+
+    ret_val = EXIT_OK;
+    exit_normal:
+        return ret_val;
+}
+
 error_state_t write_file_to_file(FILE *in_file, FILE *out_file, off_t size, off_t *total_written) {
+    return tap_file_to_file(in_file, out_file, size, total_written, NULL, NULL);
+}
+
+// Same as write_file_to_file, but every chunk is also handed to tap in order
+error_state_t tap_file_to_file(FILE *in_file, FILE *out_file, off_t size, off_t *total_written,
+                    data_tap_t tap, void *opaque) {
 
     error_state_t ret_val;
     size_t obtained, rw_size;
@@ -196,6 +329,13 @@ error_state_t write_file_to_file(FILE *in_file, FILE *out_file, off_t size, off_
             ret_val = F_WRITE_ERROR;
             goto exit_normal;
         }
+
+        if (tap != NULL && rw_size > 0) {
+            ret_val = tap(opaque, buffer, rw_size);
+            if (ret_val != EXIT_OK) {
+                goto exit_normal;
+            }
+        }
         rw_total += rw_size;
     }
 
@@ -0,0 +1,411 @@
+#define _XOPEN_SOURCE 700
+#define _FILE_OFFSET_BITS 64
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <pthread.h>
+
+#include "vcache.h"
+#include "util.h"
+
+// fcntl locks don't keep apart the threads of one process, batch jobs
+// saving at the same time are ordered here first
+static pthread_mutex_t save_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static
+int compare_entries(const void *a, const void *b) {
+    const vcache_key_t *left = &((const vcache_entry_t *) a)->key;
+    const vcache_key_t *right = &((const vcache_entry_t *) b)->key;
+
+    if (left->dev != right->dev) {
+        return (left->dev > right->dev) - (left->dev < right->dev);
+    }
+    return (left->ino > right->ino) - (left->ino < right->ino);
+}
+
+// A missing file is an empty cache, a damaged one is dropped as a whole
+static
+error_state_t load_entries(const char *path, vcache_entry_t **entries, uint32_t *count, bool *damaged) {
+
+    error_state_t ret_val;
+    vcache_head_t head;
+    struct stat st;
+    FILE *file;
+
+    *entries = NULL;
+    *count = 0;
+    *damaged = false;
+
+    file = fopen(path, "r");
+    if (file == NULL) {
+        return (errno == ENOENT)? EXIT_OK : F_OPEN_ERROR;
+    }
+
+    if (fstat(fileno(file), &st) != 0 || fread(&head, sizeof(head), 1, file) != 1 ||
+            memcmp(head.magic, VCACHE_MAGIC, sizeof(head.magic)) != 0 ||
+            head.entry_size != sizeof(vcache_entry_t) ||
+            st.st_size != (off_t) (sizeof(head) + (uint64_t) head.count * sizeof(vcache_entry_t))) {
+        *damaged = true;
+        ret_val = EXIT_OK;
+        goto exit_file;
+    }
+
+    if (head.count == 0) {
+        ret_val = EXIT_OK;
+        goto exit_file;
+    }
+
+    *entries = malloc(sizeof(**entries) * head.count);
+    if (*entries == NULL) {
+        ret_val = ALLOC_ERROR;
+        goto exit_file;
+    }
+
+    if (fread(*entries, sizeof(**entries), head.count, file) != head.count) {
+        free(*entries);
+        *entries = NULL;
+        ret_val = F_READ_ERROR;
+        goto exit_file;
+    }
+
+    qsort(*entries, head.count, sizeof(**entries), compare_entries);
+    *count = head.count;
+    ret_val = EXIT_OK;
+
+    exit_file:
+        fclose(file);
+        return ret_val;
+}
+
+error_state_t vcache_init(vcache_t *cache, const char *path, uint32_t uid, uint32_t crc,
+                    const char *folder_path) {
+
+    error_state_t ret_val;
+    struct stat st;
+    bool damaged;
+
+    if (cache == NULL || path == NULL || folder_path == NULL) {
+        ret_val = ARG_ERROR;
+        goto exit_normal;
+    }
+
+    memset(cache, 0, sizeof(*cache));
+    cache->path = path;
+    cache->uid = uid;
+    cache->crc = crc;
+
+    if (stat(folder_path, &st) != 0) {
+        ret_val = F_OPEN_ERROR;
+        goto exit_normal;
+    }
+    cache->folder_dev = st.st_dev;
+    cache->folder_ino = st.st_ino;
+
+    cache->tmp_path = malloc(MAX_PATH_LEN);
+    if (cache->tmp_path == NULL) {
+        ret_val = ALLOC_ERROR;
+        goto exit_normal;
+    }
+
+    cache->lock_path = malloc(MAX_PATH_LEN);
+    if (cache->lock_path == NULL) {
+        ret_val = ALLOC_ERROR;
+        goto exit_tmp;
+    }
+
+    if (snprintf(cache->tmp_path, MAX_PATH_LEN, "%s.tmp", path) >= MAX_PATH_LEN ||
+            snprintf(cache->lock_path, MAX_PATH_LEN, "%s.lock", path) >= MAX_PATH_LEN) {
+        ret_val = PATH_BUFFER_ERROR;
+        goto exit_lock;
+    }
+
+    ret_val = load_entries(path, &cache->entries, &cache->count, &damaged);
+    if (ret_val != EXIT_OK) {
+        goto exit_lock;
+    }
+    if (damaged) {
+        printf("Ignoring the damaged verification cache %s\n", path);
+    }
+
+    if (pthread_mutex_init(&cache->lock, NULL) != 0) {
+        ret_val = THREAD_ERROR;
+        goto exit_entries;
+    }
+
+    ret_val = EXIT_OK;
+    goto exit_normal;
+
+    exit_entries:
+        free(cache->entries);
+        cache->entries = NULL;
+    exit_lock:
+        free(cache->lock_path);
+        cache->lock_path = NULL;
+    exit_tmp:
+        free(cache->tmp_path);
+        cache->tmp_path = NULL;
+    exit_normal:
+        return ret_val;
+}
+
+void vcache_key(vcache_key_t *key, const struct stat *st) {
+    memset(key, 0, sizeof(*key));
+    key->dev = st->st_dev;
+    key->ino = st->st_ino;
+    key->size = st->st_size;
+    key->mtime_ns = (int64_t) st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+    key->ctime_ns = (int64_t) st->st_ctim.tv_sec * 1000000000 + st->st_ctim.tv_nsec;
+}
+
+// Called with the lock held
+static
+error_state_t add_fresh(vcache_t *cache, const vcache_key_t *key, const uint8_t *hash,
+                    const uint8_t *sample) {
+
+    vcache_entry_t *fresh, *entry;
+    uint32_t size;
+
+    if (cache->fresh_count == cache->fresh_size) {
+        size = (cache->fresh_size > 0)? cache->fresh_size * 2 : 0x100;
+        fresh = realloc(cache->fresh, sizeof(*fresh) * size);
+        if (fresh == NULL) {
+            return ALLOC_ERROR;
+        }
+        cache->fresh = fresh;
+        cache->fresh_size = size;
+    }
+
+    entry = &cache->fresh[cache->fresh_count];
+    memset(entry, 0, sizeof(*entry));
+    entry->key = *key;
+    memcpy(entry->hash, hash, sizeof(entry->hash));
+    if (sample != NULL) {
+        memcpy(entry->sample, sample, sizeof(entry->sample));
+    }
+    entry->uid = cache->uid;
+    entry->crc = cache->crc;
+    entry->folder_dev = cache->folder_dev;
+    entry->folder_ino = cache->folder_ino;
+    cache->fresh_count += 1;
+
+    return EXIT_OK;
+}
+
+// Gives the MD5 the file had when it was last read, if nothing changed since
+bool vcache_lookup(vcache_t *cache, const vcache_key_t *key, uint8_t *hash) {
+
+    vcache_entry_t probe, *entry;
+    bool found;
+
+    probe.key = *key;
+    entry = bsearch(&probe, cache->entries, cache->count, sizeof(*cache->entries), compare_entries);
+    if (entry == NULL || memcmp(&entry->key, key, sizeof(*key)) != 0) {
+        return false;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    found = (add_fresh(cache, key, entry->hash, entry->sample) == EXIT_OK);
+    if (found) cache->hits += 1;
+    pthread_mutex_unlock(&cache->lock);
+
+    if (found) {
+        memcpy(hash, entry->hash, sizeof(entry->hash));
+    }
+    return found;
+}
+
+// The last full check of a file that has been touched since, as long as its
+// size is still the same and a sample was taken back then
+bool vcache_reference(vcache_t *cache, const vcache_key_t *key, uint8_t *hash, uint8_t *sample) {
+
+    static const uint8_t none[0x10] = {0};
+    vcache_entry_t probe, *entry;
+
+    probe.key = *key;
+    entry = bsearch(&probe, cache->entries, cache->count, sizeof(*cache->entries), compare_entries);
+    if (entry == NULL || entry->key.size != key->size ||
+            memcmp(entry->sample, none, sizeof(none)) == 0) {
+        return false;
+    }
+
+    memcpy(hash, entry->hash, sizeof(entry->hash));
+    memcpy(sample, entry->sample, sizeof(entry->sample));
+    return true;
+}
+
+error_state_t vcache_store(vcache_t *cache, const vcache_key_t *key, const uint8_t *hash,
+                    const uint8_t *sample) {
+
+    error_state_t ret_val;
+
+    pthread_mutex_lock(&cache->lock);
+    ret_val = add_fresh(cache, key, hash, sample);
+    pthread_mutex_unlock(&cache->lock);
+
+    return ret_val;
+}
+
+// This run's files, then whatever the cache on disk knows about other discs.
+// After a complete full check, entries of this IRD and folder that weren't
+// seen again belong to files that are gone.
+static
+error_state_t merge_entries(vcache_t *cache, vcache_entry_t *stored, uint32_t stored_count,
+                    bool complete, vcache_entry_t **merged, uint32_t *merged_count) {
+
+    vcache_entry_t *result;
+    uint32_t count;
+
+    result = malloc(sizeof(*result) * ((uint64_t) cache->fresh_count + stored_count + 1));
+    if (result == NULL) {
+        return ALLOC_ERROR;
+    }
+
+    qsort(cache->fresh, cache->fresh_count, sizeof(*cache->fresh), compare_entries);
+
+    // Hard links show up once per name
+    count = 0;
+    for (uint32_t index = 0; index < cache->fresh_count; index++) {
+        if (count > 0 && compare_entries(&result[count - 1], &cache->fresh[index]) == 0) continue;
+        result[count] = cache->fresh[index];
+        count += 1;
+    }
+
+    for (uint32_t index = 0; index < stored_count; index++) {
+        if (complete && stored[index].uid == cache->uid && stored[index].crc == cache->crc &&
+                stored[index].folder_dev == cache->folder_dev &&
+                stored[index].folder_ino == cache->folder_ino) continue;
+        if (cache->fresh_count > 0 && bsearch(&stored[index], cache->fresh, cache->fresh_count,
+                sizeof(*cache->fresh), compare_entries) != NULL) continue;
+        result[count] = stored[index];
+        count += 1;
+    }
+
+    qsort(result, count, sizeof(*result), compare_entries);
+
+    *merged = result;
+    *merged_count = count;
+    return EXIT_OK;
+}
+
+static
+error_state_t write_entries(vcache_t *cache, vcache_entry_t *entries, uint32_t count) {
+
+    error_state_t ret_val;
+    vcache_head_t head;
+    FILE *file;
+
+    file = fopen(cache->tmp_path, "w");
+    if (file == NULL) {
+        ret_val = F_OPEN_ERROR;
+        goto exit_normal;
+    }
+
+    memset(&head, 0, sizeof(head));
+    memcpy(head.magic, VCACHE_MAGIC, sizeof(head.magic));
+    head.entry_size = sizeof(vcache_entry_t);
+    head.count = count;
+
+    if (fwrite(&head, sizeof(head), 1, file) != 1 ||
+            (count > 0 && fwrite(entries, sizeof(*entries), count, file) != count)) {
+        ret_val = F_WRITE_ERROR;
+        goto exit_file;
+    }
+
+    if (fflush(file) != 0 || fsync(fileno(file)) != 0) {
+        ret_val = F_WRITE_ERROR;
+        goto exit_file;
+    }
+
+    if (fclose(file) != 0) {
+        ret_val = F_WRITE_ERROR;
+        goto exit_tmp;
+    }
+
+    if (rename(cache->tmp_path, cache->path) != 0) {
+        ret_val = F_WRITE_ERROR;
+        goto exit_tmp;
+    }
+
+    ret_val = EXIT_OK;
+    goto exit_normal;
+
+    exit_file:
+        fclose(file);
+    exit_tmp:
+        unlink(cache->tmp_path);
+    exit_normal:
+        return ret_val;
+}
+
+// The index is read again under the lock, so discs checked by other runs in
+// the meantime keep their entries
+error_state_t vcache_save(vcache_t *cache, bool complete) {
+
+    error_state_t ret_val;
+    vcache_entry_t *stored, *merged;
+    uint32_t stored_count, merged_count;
+    struct flock lock = {0};
+    int lock_fd;
+    bool damaged;
+
+    if (cache == NULL) {
+        return ARG_ERROR;
+    }
+
+    pthread_mutex_lock(&save_lock);
+
+    lock_fd = open(cache->lock_path, O_RDWR | O_CREAT, 0644);
+    if (lock_fd == -1) {
+        ret_val = F_OPEN_ERROR;
+        goto exit_unlock;
+    }
+
+    lock.l_type = F_WRLCK;
+    lock.l_whence = SEEK_SET;
+    while (fcntl(lock_fd, F_SETLKW, &lock) == -1) {
+        if (errno != EINTR) {
+            ret_val = F_OPEN_ERROR;
+            goto exit_lock_fd;
+        }
+    }
+
+    ret_val = load_entries(cache->path, &stored, &stored_count, &damaged);
+    if (ret_val != EXIT_OK) {
+        goto exit_lock_fd;
+    }
+
+    ret_val = merge_entries(cache, stored, stored_count, complete, &merged, &merged_count);
+    if (ret_val != EXIT_OK) {
+        goto exit_stored;
+    }
+
+    ret_val = write_entries(cache, merged, merged_count);
+
+    free(merged);
+    exit_stored:
+        free(stored);
+    exit_lock_fd:
+        close(lock_fd);
+    exit_unlock:
+        pthread_mutex_unlock(&save_lock);
+        return ret_val;
+}
+
+void vcache_free(vcache_t *cache) {
+    pthread_mutex_destroy(&cache->lock);
+    free(cache->fresh);
+    free(cache->entries);
+    free(cache->lock_path);
+    free(cache->tmp_path);
+    memset(cache, 0, sizeof(*cache));
+}
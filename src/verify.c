@@ -0,0 +1,446 @@
+#define _XOPEN_SOURCE 700
+#define _FILE_OFFSET_BITS 64
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <pthread.h>
+
+
+#include "verify.h"
+#include "util.h"
+#include "hash.h"
+
+static
+int compare_sizes(const void *a, const void *b) {
+    const dir_record_t *left = ((const verify_item_t *) a)->lead;
+    const dir_record_t *right = ((const verify_item_t *) b)->lead;
+
+    if (left->total_length != right->total_length) {
+        return (left->total_length < right->total_length) - (left->total_length > right->total_length);
+    }
+    return (left->block_offset > right->block_offset) - (left->block_offset < right->block_offset);
+}
+
+bool verify_passed(enum file_state state) {
+    return state == VERIFIED || state == SAMPLED || state == PRESENT;
+}
+
+// With fail_fast the first problem stops every worker
+static
+void settle(verify_pool_t *pool, dir_record_t *lead, enum file_state state) {
+
+    lead->state = state;
+
+    if (pool->fail_fast && !verify_passed(state)) {
+        pthread_mutex_lock(&pool->lock);
+        pool->stop = true;
+        pool->halted = true;
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+static
+void check_hash(verify_pool_t *pool, dir_record_t *lead, const uint8_t *checksum) {
+    settle(pool, lead, (memcmp(checksum, lead->hash, 0x10) == 0)? VERIFIED : MD5_MISMATCH);
+}
+
+// MD5 over VERIFY_SAMPLES blocks spread evenly from the first byte to the last
+static
+error_state_t sample_file(const char *path, off_t size, uint8_t *sample) {
+
+    error_state_t ret_val;
+    hash_md5_t hash;
+    char *buffer;
+    off_t offset;
+    size_t done;
+    ssize_t obtained;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        ret_val = F_OPEN_ERROR;
+        goto exit_normal;
+    }
+
+    buffer = malloc(VERIFY_SAMPLE_SIZE);
+    if (buffer == NULL) {
+        ret_val = ALLOC_ERROR;
+        goto exit_fd;
+    }
+
+    ret_val = hash_md5_init(&hash);
+    if (ret_val != EXIT_OK) {
+        goto exit_buffer;
+    }
+
+    for (int index = 0; index < VERIFY_SAMPLES; index++) {
+        offset = (size - VERIFY_SAMPLE_SIZE) * index / (VERIFY_SAMPLES - 1);
+
+        for (done = 0; done < VERIFY_SAMPLE_SIZE; done += obtained) {
+            obtained = pread(fd, buffer + done, VERIFY_SAMPLE_SIZE - done, offset + done);
+            if (obtained == -1 && errno == EINTR) {
+                obtained = 0;
+                continue;
+            }
+            if (obtained <= 0) {
+                ret_val = F_READ_ERROR;
+                goto exit_md5;
+            }
+        }
+
+        ret_val = hash_md5_update(&hash, buffer, VERIFY_SAMPLE_SIZE);
+        if (ret_val != EXIT_OK) {
+            goto exit_md5;
+        }
+    }
+
+    ret_val = hash_md5_finish(&hash, sample);
+    if (ret_val != EXIT_OK) {
+        goto exit_md5;
+    }
+
+    ret_val = EXIT_OK;
+
+    exit_md5:
+        hash_md5_free(&hash);
+    exit_buffer:
+        free(buffer);
+    exit_fd:
+        close(fd);
+    exit_normal:
+        return ret_val;
+}
+
+// Blocks that differ from the ones read when the file last passed in full
+// mean its content changed. Without such a reference they are only known to
+// be readable.
+static
+error_state_t sample_check(verify_item_t *item, verify_pool_t *pool, const char *full_path) {
+
+    error_state_t ret_val;
+    uint8_t sample[0x10], reference[0x10], hash[0x10];
+
+    ret_val = sample_file(full_path, item->lead->total_length, sample);
+    if (ret_val != EXIT_OK) {
+        return ret_val;
+    }
+
+    if (pool->cache != NULL && vcache_reference(pool->cache, &item->key, hash, reference) &&
+            memcmp(hash, item->lead->hash, 0x10) == 0 && memcmp(sample, reference, 0x10) != 0) {
+        settle(pool, item->lead, MD5_MISMATCH);
+    } else {
+        settle(pool, item->lead, SAMPLED);
+    }
+
+    return EXIT_OK;
+}
+
+// Settles what the mode allows without hashing the whole file, a file left
+// EMPTY still has to be hashed
+static
+error_state_t check_file(verify_item_t *item, verify_pool_t *pool, char *full_path) {
+
+    error_state_t ret_val;
+    struct stat st;
+    uint8_t checksum[0x10];
+
+    ret_val = build_full_path(full_path, MAX_PATH_LEN, pool->folder_path, item->lead);
+    if (ret_val != EXIT_OK) {
+        return ret_val;
+    }
+
+    if (stat(full_path, &st) == -1 || !S_ISREG(st.st_mode)) {
+        settle(pool, item->lead, MISSING);
+        return EXIT_OK;
+    }
+
+    if (st.st_size != item->lead->total_length) {
+        settle(pool, item->lead, SZ_MISMATCH);
+        return EXIT_OK;
+    }
+
+    // Taken before the file is read, a change during the read makes it stale
+    vcache_key(&item->key, &st);
+    if (pool->cache != NULL && vcache_lookup(pool->cache, &item->key, checksum)) {
+        check_hash(pool, item->lead, checksum);
+        return EXIT_OK;
+    }
+
+    if (pool->mode == VERIFY_SIZE) {
+        settle(pool, item->lead, PRESENT);
+        return EXIT_OK;
+    }
+
+    if (pool->mode == VERIFY_SAMPLE && st.st_size > VERIFY_SAMPLES * VERIFY_SAMPLE_SIZE) {
+        return sample_check(item, pool, full_path);
+    }
+
+    return EXIT_OK;
+}
+
+static
+void set_error(verify_pool_t *pool, dir_record_t *lead, error_state_t error) {
+    pthread_mutex_lock(&pool->lock);
+    if (pool->failed == NULL || (lead != NULL && lead->block_offset < pool->failed->block_offset)) {
+        pool->error = error;
+        pool->failed = lead;
+    }
+    pool->stop = true;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Takes files off the queue until one needs hashing
+static
+error_state_t next_file(void *opaque, const char **path, void **tag) {
+
+    error_state_t ret_val;
+    verify_worker_t *worker;
+    verify_pool_t *pool;
+    verify_item_t *item;
+
+    worker = (verify_worker_t *) opaque;
+    pool = worker->pool;
+
+    while (true) {
+        pthread_mutex_lock(&pool->lock);
+        if (pool->stop || pool->next == pool->count) {
+            pthread_mutex_unlock(&pool->lock);
+            *path = NULL;
+            return EXIT_OK;
+        }
+        item = &pool->items[pool->next];
+        pool->next += 1;
+        pthread_mutex_unlock(&pool->lock);
+
+        *tag = item;
+        ret_val = check_file(item, pool, worker->full_path);
+        if (ret_val != EXIT_OK) {
+            return ret_val;
+        }
+
+        if (item->lead->state == EMPTY) {
+            *path = worker->full_path;
+            return EXIT_OK;
+        }
+    }
+}
+
+// Large files also leave a sample in the cache for later sampled checks
+static
+error_state_t file_done(void *opaque, void *tag, const uint8_t *checksum) {
+
+    error_state_t ret_val;
+    verify_worker_t *worker;
+    verify_item_t *item;
+    uint8_t sample[0x10];
+
+    worker = (verify_worker_t *) opaque;
+    item = (verify_item_t *) tag;
+    check_hash(worker->pool, item->lead, checksum);
+
+    if (worker->pool->cache == NULL) {
+        return EXIT_OK;
+    }
+
+    if (item->lead->total_length <= VERIFY_SAMPLES * VERIFY_SAMPLE_SIZE) {
+        return vcache_store(worker->pool->cache, &item->key, checksum, NULL);
+    }
+
+    // The path buffer moved on to other files since this one was opened
+    ret_val = build_full_path(worker->full_path, MAX_PATH_LEN, worker->pool->folder_path, item->lead);
+    if (ret_val != EXIT_OK) {
+        return ret_val;
+    }
+
+    ret_val = sample_file(worker->full_path, item->lead->total_length, sample);
+    if (ret_val != EXIT_OK) {
+        return ret_val;
+    }
+
+    return vcache_store(worker->pool->cache, &item->key, checksum, sample);
+}
+
+static
+bool should_stop(void *opaque) {
+
+    verify_pool_t *pool;
+    bool stop;
+
+    pool = ((verify_worker_t *) opaque)->pool;
+
+    pthread_mutex_lock(&pool->lock);
+    stop = pool->stop;
+    pthread_mutex_unlock(&pool->lock);
+
+    return stop;
+}
+
+// One file after the other on the selected backend, for when it beats the lanes
+static
+error_state_t run_streams(verify_worker_t *worker, void **failed) {
+
+    error_state_t ret_val;
+    const char *path;
+    uint8_t checksum[0x10];
+    void *tag;
+
+    *failed = NULL;
+
+    while (true) {
+        tag = NULL;
+        ret_val = next_file(worker, &path, &tag);
+        if (ret_val != EXIT_OK || path == NULL) {
+            break;
+        }
+
+        ret_val = calc_checksum(checksum, (char *) path);
+        if (ret_val != EXIT_OK) {
+            break;
+        }
+
+        ret_val = file_done(worker, tag, checksum);
+        if (ret_val != EXIT_OK) {
+            break;
+        }
+    }
+
+    if (ret_val != EXIT_OK) {
+        *failed = tag;
+    }
+    return ret_val;
+}
+
+// Every worker keeps a file per MD5 lane in flight and refills a lane from
+// the queue as soon as its file is done
+static
+void *verify_worker(void *arg) {
+
+    error_state_t ret_val;
+    verify_worker_t worker;
+    void *failed;
+
+    worker.pool = (verify_pool_t *) arg;
+
+    worker.full_path = malloc(MAX_PATH_LEN);
+    if (worker.full_path == NULL) {
+        set_error(worker.pool, NULL, ALLOC_ERROR);
+        return NULL;
+    }
+
+    if (!hash_lanes()) {
+        ret_val = run_streams(&worker, &failed);
+        goto exit_run;
+    }
+
+    ret_val = md5mb_init(&worker.mb);
+    if (ret_val != EXIT_OK) {
+        set_error(worker.pool, NULL, ret_val);
+        goto exit_path;
+    }
+
+    ret_val = md5mb_run(&worker.mb, next_file, file_done, should_stop, &worker, &failed);
+    md5mb_free(&worker.mb);
+
+    exit_run:
+        if (ret_val != EXIT_OK) {
+            set_error(worker.pool, (failed != NULL)? ((verify_item_t *) failed)->lead : NULL, ret_val);
+        }
+    exit_path:
+        free(worker.full_path);
+        return NULL;
+}
+
+// MD5 is CPU bound, so every online core gets a worker unless told otherwise
+int verify_threads(int requested) {
+
+    long online;
+
+    if (requested > 0) {
+        return min(requested, MAX_THREADS);
+    }
+
+    online = sysconf(_SC_NPROCESSORS_ONLN);
+    return (online > 0)? min(online, MAX_THREADS) : 1;
+}
+
+// Checks every file of ft on a pool of threads as deep as opts asks, leaving
+// the outcome in each lead's state. With a cache, files it vouches for aren't
+// read. complete tells whether every file was hashed or taken from the cache.
+error_state_t verify_files(file_table_t *ft, const char *folder_path, verify_opts_t *opts, vcache_t *cache,
+                    bool *verified, bool *complete) {
+
+    error_state_t ret_val;
+    verify_pool_t pool = {0};
+    pthread_t workers[MAX_THREADS];
+    int threads, started;
+
+    if (ft == NULL || folder_path == NULL || opts == NULL || verified == NULL || complete == NULL) {
+        ret_val = ARG_ERROR;
+        goto exit_normal;
+    }
+
+    pool.items = calloc(ft->length + 1, sizeof(*pool.items));
+    if (pool.items == NULL) {
+        ret_val = ALLOC_ERROR;
+        goto exit_normal;
+    }
+
+    for (uint32_t index = 0; index < ft->length; index++) {
+        if (ft->table[index]->lead_extent != NULL) continue;
+        pool.items[pool.count].lead = ft->table[index];
+        pool.count += 1;
+    }
+    qsort(pool.items, pool.count, sizeof(*pool.items), compare_sizes);
+
+    pool.folder_path = folder_path;
+    pool.cache = cache;
+    pool.mode = opts->mode;
+    pool.fail_fast = opts->fail_fast;
+    pool.error = EXIT_OK;
+
+    if (pthread_mutex_init(&pool.lock, NULL) != 0) {
+        ret_val = THREAD_ERROR;
+        goto exit_items;
+    }
+
+    threads = min(verify_threads(opts->threads), max(pool.count, 1));
+    for (started = 0; started < threads; started++) {
+        if (pthread_create(&workers[started], NULL, verify_worker, &pool) != 0) break;
+    }
+
+    // With no worker at all the files are checked right here
+    if (started == 0) {
+        verify_worker(&pool);
+    }
+
+    for (int index = 0; index < started; index++) {
+        pthread_join(workers[index], NULL);
+    }
+    pthread_mutex_destroy(&pool.lock);
+
+    ret_val = pool.error;
+    if (ret_val != EXIT_OK) {
+        goto exit_items;
+    }
+
+    *verified = true;
+    for (uint32_t index = 0; index < pool.count; index++) {
+        if (!verify_passed(pool.items[index].lead->state)) *verified = false;
+    }
+    *complete = (pool.mode == VERIFY_FULL && !pool.halted);
+
+    exit_items:
+        free(pool.items);
+    exit_normal:
+        return ret_val;
+}
@@ -0,0 +1,329 @@
+#define _XOPEN_SOURCE 700
+#define _FILE_OFFSET_BITS 64
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "viso.h"
+#include "iso.h"
+#include "ird.h"
+#include "layout.h"
+#include "util.h"
+
+static
+error_state_t read_full(int fd, char *buffer, size_t length, off_t offset) {
+
+    ssize_t obtained;
+
+    while (length > 0) {
+        obtained = pread(fd, buffer, length, offset);
+        if (obtained < 0 && errno == EINTR) continue;
+        if (obtained < 0) return F_READ_ERROR;
+        if (obtained == 0) return F_SIZE_ERROR;
+
+        buffer += obtained;
+        offset += obtained;
+        length -= obtained;
+    }
+    return EXIT_OK;
+}
+
+static
+error_state_t load_blob(FILE *blob, off_t size, char **data) {
+
+    error_state_t ret_val;
+
+    *data = malloc(size + 1);
+    if (*data == NULL) {
+        return ALLOC_ERROR;
+    }
+
+    ret_val = read_full(fileno(blob), *data, size, 0);
+    if (ret_val != EXIT_OK) {
+        free(*data);
+        *data = NULL;
+    }
+    return ret_val;
+}
+
+error_state_t viso_open(viso_t **viso_wrap, ird_t *ird, char *folder_path) {
+
+    error_state_t ret_val;
+    viso_t *viso;
+
+    if (viso_wrap == NULL || ird == NULL || folder_path == NULL) {
+        ret_val = ARG_ERROR;
+        goto exit_normal;
+    }
+
+    viso = calloc(1, sizeof(*viso));
+    if (viso == NULL) {
+        ret_val = ALLOC_ERROR;
+        goto exit_normal;
+    }
+    viso->folder_path = folder_path;
+
+    ret_val = init_traverse(&viso->info, ird->header_path, ird->footer_path);
+    if (ret_val != EXIT_OK) {
+        goto exit_viso;
+    }
+    viso->block_size = viso->info.desc->block_size;
+
+    ret_val = build_dir_list(&viso->dt, &viso->info);
+    if (ret_val != EXIT_OK) {
+        goto exit_traverse;
+    }
+    sort_dir_list(&viso->dt);
+
+    ret_val = build_file_list(&viso->ft, &viso->info, &viso->dt, ird->file_count*2);
+    if (ret_val != EXIT_OK) {
+        goto exit_dirs;
+    }
+    sort_file_list(&viso->ft);
+
+    ret_val = build_layout(&viso->layout, &viso->info, &viso->ft);
+    if (ret_val != EXIT_OK) {
+        goto exit_files;
+    }
+
+    ret_val = load_blob(viso->info.header, viso->layout.header_size, &viso->header);
+    if (ret_val != EXIT_OK) {
+        goto exit_layout;
+    }
+
+    ret_val = load_blob(viso->info.footer, viso->layout.footer_size, &viso->footer);
+    if (ret_val != EXIT_OK) {
+        goto exit_header;
+    }
+
+    for (int slot = 0; slot < VISO_HANDLES; slot++) {
+        viso->handles[slot].fd = -1;
+    }
+    pthread_mutex_init(&viso->lock, NULL);
+
+    *viso_wrap = viso;
+    ret_val = EXIT_OK;
+    goto exit_normal;
+
+    exit_header:
+        free(viso->header);
+    exit_layout:
+        free_layout(&viso->layout);
+    exit_files:
+        free_file_list(&viso->ft);
+    exit_dirs:
+        free_dir_list(&viso->dt);
+    exit_traverse:
+        free_traverse(&viso->info);
+    exit_viso:
+        free(viso);
+    exit_normal:
+        return ret_val;
+}
+
+// Segments are contiguous and sorted, the last one starting at or before
+// offset holds it.
+static
+uint32_t find_segment(iso_layout_t *layout, off_t offset) {
+
+    uint32_t low, high, middle;
+
+    low = 0;
+    high = layout->length;
+    while (high - low > 1) {
+        middle = low + (high - low)/2;
+        if (layout->segments[middle].offset <= offset) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// Hands out an open descriptor for the record's file. Handles in use are
+// never evicted, when all of them are busy the caller gets a private one.
+static
+error_state_t acquire_handle(viso_t *viso, dir_record_t *record, viso_handle_t **handle, int *fd) {
+
+    error_state_t ret_val;
+    dir_record_t *lead;
+    viso_handle_t *slot, *victim;
+    char path[MAX_PATH_LEN];
+
+    lead = (record->lead_extent != NULL)? record->lead_extent : record;
+
+    pthread_mutex_lock(&viso->lock);
+
+    victim = NULL;
+    for (int index = 0; index < VISO_HANDLES; index++) {
+        slot = &viso->handles[index];
+
+        if (slot->fd != -1 && slot->lead == lead) {
+            slot->users += 1;
+            slot->last_use = ++viso->clock;
+            pthread_mutex_unlock(&viso->lock);
+
+            *handle = slot;
+            *fd = slot->fd;
+            return EXIT_OK;
+        }
+
+        if (slot->users > 0) continue;
+        if (victim == NULL || slot->fd == -1 ||
+                (victim->fd != -1 && slot->last_use < victim->last_use)) {
+            victim = slot;
+        }
+    }
+
+    // Opening happens under the lock so two readers can't race for one file
+    ret_val = build_full_path(path, MAX_PATH_LEN, viso->folder_path, record);
+    if (ret_val != EXIT_OK) {
+        goto exit_lock;
+    }
+
+    *fd = open(path, O_RDONLY);
+    if (*fd == -1) {
+        ret_val = F_OPEN_ERROR;
+        goto exit_lock;
+    }
+
+    *handle = victim;
+    if (victim != NULL) {
+        if (victim->fd != -1) close(victim->fd);
+        victim->lead = lead;
+        victim->fd = *fd;
+        victim->users = 1;
+        victim->last_use = ++viso->clock;
+    }
+
+    ret_val = EXIT_OK;
+    exit_lock:
+        pthread_mutex_unlock(&viso->lock);
+        return ret_val;
+}
+
+static
+void release_handle(viso_t *viso, viso_handle_t *handle, int fd) {
+
+    if (handle == NULL) {
+        close(fd);
+        return;
+    }
+
+    pthread_mutex_lock(&viso->lock);
+    handle->users -= 1;
+    pthread_mutex_unlock(&viso->lock);
+}
+
+static
+error_state_t read_extent(viso_t *viso, dir_record_t *record, char *buffer,
+                    size_t length, off_t offset) {
+
+    error_state_t ret_val;
+    viso_handle_t *handle;
+    int fd;
+
+    ret_val = acquire_handle(viso, record, &handle, &fd);
+    if (ret_val != EXIT_OK) {
+        return ret_val;
+    }
+
+    ret_val = read_full(fd, buffer, length, record->file_offset + offset);
+    release_handle(viso, handle, fd);
+    return ret_val;
+}
+
+// Reads are clipped at the end of the ISO, obtained tells how much was
+// filled. Safe to call from several threads at once.
+error_state_t viso_pread(viso_t *viso, void *buffer, size_t length, off_t offset, size_t *obtained) {
+
+    error_state_t ret_val;
+    iso_segment_t *segment;
+    char *output;
+    uint32_t index;
+    off_t inner;
+    size_t take;
+
+    if (viso == NULL || buffer == NULL || obtained == NULL || offset < 0) {
+        return ARG_ERROR;
+    }
+
+    *obtained = 0;
+    if (offset >= viso->layout.total_size) {
+        return EXIT_OK;
+    }
+    length = min(length, viso->layout.total_size - offset);
+
+    output = buffer;
+    index = find_segment(&viso->layout, offset);
+    while (length > 0) {
+        segment = &viso->layout.segments[index];
+        inner = offset - segment->offset;
+        if (inner >= segment->length) {
+            index += 1;
+            continue;
+        }
+        take = min(length, segment->length - inner);
+
+        ret_val = EXIT_OK;
+        switch (segment->kind) {
+            case SEG_HEADER:
+                memcpy(output, viso->header + inner, take);
+                break;
+            case SEG_FOOTER:
+                memcpy(output, viso->footer + inner, take);
+                break;
+            case SEG_GAP:
+                memset(output, 0, take);
+                break;
+            case SEG_EXTENT:
+                ret_val = read_extent(viso, segment->record, output, take, inner);
+                break;
+        }
+        if (ret_val != EXIT_OK) {
+            return ret_val;
+        }
+
+        output += take;
+        offset += take;
+        length -= take;
+        *obtained += take;
+        index += 1;
+    }
+    return EXIT_OK;
+}
+
+off_t viso_size(viso_t *viso) {
+    return viso->layout.total_size;
+}
+
+void viso_close(viso_t *viso) {
+
+    if (viso == NULL) {
+        return;
+    }
+
+    for (int slot = 0; slot < VISO_HANDLES; slot++) {
+        if (viso->handles[slot].fd != -1) close(viso->handles[slot].fd);
+    }
+
+    pthread_mutex_destroy(&viso->lock);
+    free(viso->header);
+    free(viso->footer);
+    free_layout(&viso->layout);
+    free_file_list(&viso->ft);
+    free_dir_list(&viso->dt);
+    free_traverse(&viso->info);
+    free(viso);
+}
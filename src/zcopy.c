@@ -0,0 +1,359 @@
+#define _GNU_SOURCE
+#define _XOPEN_SOURCE 700
+#define _FILE_OFFSET_BITS 64
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+
+#include "zcopy.h"
+#include "source.h"
+#include "rebuild.h"
+#include "iso.h"
+#include "util.h"
+
+void zcopy_init(zcopy_t *zc) {
+    zc->pipe_fds[0] = -1;
+    zc->pipe_fds[1] = -1;
+    zc->use_splice = false;
+    zc->clone_size = 0;
+    zc->cloned = 0;
+    zc->clone_off = NULL;
+}
+
+void zcopy_free(zcopy_t *zc) {
+    if (zc->pipe_fds[0] != -1) close(zc->pipe_fds[0]);
+    if (zc->pipe_fds[1] != -1) close(zc->pipe_fds[1]);
+    zcopy_init(zc);
+}
+
+// Turns on reflinks, they can only share whole blocks of the output's
+// filesystem. Writers of the same output pass the same clone_off so only
+// the first failure is reported.
+void zcopy_share(zcopy_t *zc, int out_fd, bool *clone_off) {
+
+    struct stat st;
+
+    zc->clone_off = clone_off;
+    if (__atomic_load_n(clone_off, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    if (fstat(out_fd, &st) == 0 && st.st_blksize > 0) {
+        zc->clone_size = st.st_blksize;
+    }
+}
+
+static
+error_state_t open_pipe(zcopy_t *zc) {
+
+    if (zc->pipe_fds[0] != -1) {
+        return EXIT_OK;
+    }
+
+    if (pipe(zc->pipe_fds) != 0) {
+        zc->pipe_fds[0] = -1;
+        zc->pipe_fds[1] = -1;
+        return F_OPEN_ERROR;
+    }
+
+    // Larger pipes mean fewer round trips, the default is only 64 KiB
+    fcntl(zc->pipe_fds[1], F_SETPIPE_SZ, ZCOPY_PIPE_SIZE);
+    return EXIT_OK;
+}
+
+static
+ssize_t splice_range(zcopy_t *zc, int in_fd, off_t *in_offset,
+                    int out_fd, off_t *out_offset, size_t size) {
+
+    ssize_t obtained, drained, moved;
+
+    obtained = splice(in_fd, in_offset, zc->pipe_fds[1], NULL, size, SPLICE_F_MOVE);
+    if (obtained <= 0) {
+        return obtained;
+    }
+
+    drained = 0;
+    while (drained < obtained) {
+        moved = splice(zc->pipe_fds[0], NULL, out_fd, out_offset,
+                        obtained - drained, SPLICE_F_MOVE);
+        if (moved < 0 && errno == EINTR) continue;
+        if (moved <= 0) {
+            return -1;
+        }
+        drained += moved;
+    }
+    return obtained;
+}
+
+static
+error_state_t copy_range(zcopy_t *zc, int in_fd, off_t in_offset,
+                    int out_fd, off_t out_offset, off_t size, off_t *total_written) {
+
+    error_state_t ret_val;
+    ssize_t obtained;
+    off_t rw_total;
+    size_t rw_size;
+
+    rw_total = 0;
+
+    while (rw_total < size) {
+        rw_size = min(ZCOPY_CHUNK_SIZE, size - rw_total);
+
+        if (!zc->use_splice) {
+            obtained = copy_file_range(in_fd, &in_offset, out_fd, &out_offset, rw_size, 0);
+
+            if (obtained < 0 && (errno == EXDEV || errno == EINVAL ||
+                    errno == ENOSYS || errno == EOPNOTSUPP)) {
+                zc->use_splice = true;
+                continue;
+            }
+        } else {
+            ret_val = open_pipe(zc);
+            if (ret_val != EXIT_OK) {
+                goto exit_normal;
+            }
+            obtained = splice_range(zc, in_fd, &in_offset, out_fd, &out_offset, rw_size);
+        }
+
+        if (obtained < 0 && errno == EINTR) continue;
+        if (obtained < 0) {
+            ret_val = F_WRITE_ERROR;
+            goto exit_normal;
+        }
+        if (obtained == 0) break;
+
+        rw_total += obtained;
+    }
+
+    *total_written = rw_total;
+    ret_val = EXIT_OK;
+
+    exit_normal:
+        return ret_val;
+}
+
+// Filesystems without reflinks, or sources on another one, turn sharing off
+// for the rest of the rebuild. Nothing is shared in that case.
+static
+error_state_t clone_range(zcopy_t *zc, int in_fd, off_t in_offset,
+                    int out_fd, off_t out_offset, off_t size, off_t *shared) {
+
+    struct file_clone_range range;
+
+    range.src_fd = in_fd;
+    range.src_offset = in_offset;
+    range.src_length = size;
+    range.dest_offset = out_offset;
+
+    *shared = 0;
+    if (ioctl(out_fd, FICLONERANGE, &range) == 0) {
+        zc->cloned += size;
+        *shared = size;
+        return EXIT_OK;
+    }
+
+    if (errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP || errno == ENOTTY ||
+            errno == ENOSYS || errno == EPERM) {
+        if (!__atomic_exchange_n(zc->clone_off, true, __ATOMIC_RELAXED)) {
+            printf("Reflinks are unavailable here, copying instead\n");
+        }
+        zc->clone_size = 0;
+        return EXIT_OK;
+    }
+    return F_WRITE_ERROR;
+}
+
+// With sharing on, the blocks both sides agree on are cloned and only the
+// unaligned head and tail around them go through a copy.
+error_state_t zcopy_range(zcopy_t *zc, int in_fd, off_t in_offset,
+                    int out_fd, off_t out_offset, off_t size, off_t *total_written) {
+
+    error_state_t ret_val;
+    off_t head, middle, done, obtained;
+
+    if (zc == NULL || total_written == NULL) {
+        ret_val = ARG_ERROR;
+        goto exit_normal;
+    }
+
+    done = 0;
+    if (zc->clone_size > 0 && __atomic_load_n(zc->clone_off, __ATOMIC_RELAXED)) {
+        zc->clone_size = 0;
+    }
+
+    if (zc->clone_size > 0) {
+        head = (zc->clone_size - out_offset % zc->clone_size) % zc->clone_size;
+        middle = (size > head)? (size - head) / zc->clone_size * zc->clone_size : 0;
+
+        if (middle > 0 && (in_offset + head) % zc->clone_size == 0) {
+            ret_val = copy_range(zc, in_fd, in_offset, out_fd, out_offset, head, &done);
+            if (ret_val != EXIT_OK || done < head) {
+                goto exit_total;
+            }
+
+            ret_val = clone_range(zc, in_fd, in_offset + head, out_fd, out_offset + head,
+                            middle, &obtained);
+            if (ret_val != EXIT_OK) {
+                goto exit_normal;
+            }
+            done += obtained;
+        }
+    }
+
+    ret_val = copy_range(zc, in_fd, in_offset + done, out_fd, out_offset + done,
+                    size - done, &obtained);
+    if (ret_val != EXIT_OK) {
+        goto exit_normal;
+    }
+    done += obtained;
+
+    exit_total:
+        *total_written = done;
+    exit_normal:
+        return ret_val;
+}
+
+error_state_t zcopy_blob(FILE *blob, FILE *iso_file) {
+
+    error_state_t ret_val;
+    off_t position, obtained;
+    zcopy_t zc;
+
+    if (blob == NULL || iso_file == NULL) {
+        ret_val = ARG_ERROR;
+        goto exit_early;
+    }
+
+    if (fflush(iso_file) != 0) {
+        ret_val = F_WRITE_ERROR;
+        goto exit_early;
+    }
+
+    position = ftello(iso_file);
+    if (position == -1) {
+        ret_val = F_SEEK_ERROR;
+        goto exit_early;
+    }
+
+    zcopy_init(&zc);
+    ret_val = zcopy_range(&zc, fileno(blob), 0, fileno(iso_file), position,
+                    INT64_MAX, &obtained);
+    zcopy_free(&zc);
+
+    if (ret_val != EXIT_OK) {
+        goto exit_early;
+    }
+
+    if (fseeko(iso_file, position + obtained, SEEK_SET) != 0) {
+        ret_val = F_SEEK_ERROR;
+        goto exit_early;
+    }
+
+    ret_val = EXIT_OK;
+    exit_early:
+        return ret_val;
+}
+
+error_state_t zcopy_copy(rebuild_job_t *job, FILE *iso_file) {
+
+    error_state_t ret_val;
+    int iso_fd;
+    off_t position, target, obtained;
+    zcopy_t zc;
+    bool clone_off;
+    source_cache_t cache;
+
+    dir_record_t *cur_record;
+    FILE *cur_file;
+
+    if (job == NULL || iso_file == NULL) {
+        ret_val = ARG_ERROR;
+        goto exit_early;
+    }
+
+    if (fflush(iso_file) != 0) {
+        ret_val = F_WRITE_ERROR;
+        goto exit_early;
+    }
+
+    iso_fd = fileno(iso_file);
+    position = ftello(iso_file);
+    if (position == -1) {
+        ret_val = F_SEEK_ERROR;
+        goto exit_early;
+    }
+
+    ret_val = source_init(&cache, job->ft, job->folder_path);
+    if (ret_val != EXIT_OK) {
+        goto exit_cache;
+    }
+
+    zcopy_init(&zc);
+    clone_off = false;
+    if (job->opts->backend == IO_REFLINK) {
+        zcopy_share(&zc, iso_fd, &clone_off);
+    }
+
+    for (int index = 0; index < job->ft->length; index++) {
+        cur_record = job->ft->table[index];
+        printf("%s\n", cur_record->file_id);
+
+        target = extent_position(cur_record, job->block_size);
+        if (target < position) {
+            ret_val = RECORD_ECMA_ERROR;
+            goto exit_normal;
+        }
+
+        ret_val = fill_gap_fd(iso_fd, position, target - position, job->opts->gap_mode);
+        if (ret_val != EXIT_OK) {
+            goto exit_normal;
+        }
+
+        ret_val = source_get(&cache, index, &cur_file);
+        if (ret_val != EXIT_OK) {
+            goto exit_normal;
+        }
+
+        ret_val = zcopy_range(&zc, fileno(cur_file), cur_record->file_offset, iso_fd, target,
+                        cur_record->extent_length, &obtained);
+        if (ret_val != EXIT_OK) {
+            goto exit_normal;
+        }
+        source_done(&cache, index, obtained);
+
+        if (obtained != cur_record->extent_length) {
+            ret_val = F_SIZE_ERROR;
+            goto exit_normal;
+        }
+        position = target + obtained;
+    }
+
+    if (fseeko(iso_file, position, SEEK_SET) != 0) {
+        ret_val = F_SEEK_ERROR;
+        goto exit_normal;
+    }
+
+    if (zc.cloned > 0) {
+        printf("Shared %.1f MiB with the JB folder through reflinks\n", (double) zc.cloned / (1 << 20));
+    }
+    ret_val = EXIT_OK;
+
+    exit_normal:
+        zcopy_free(&zc);
+    exit_cache:
+        source_free(&cache);
+    exit_early:
+        return ret_val;
+}
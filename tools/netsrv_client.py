@@ -0,0 +1,155 @@
+#!/usr/bin/env python3
+"""Minimal ps3netsrv client for checking --serve against a rebuilt ISO.
+
+Stats and opens the served ISO, then compares sequential and random
+READ_FILE, READ_FILE_CRITICAL and READ_CD_2048 replies byte for byte with
+a local copy of the same ISO. Exits non-zero on the first mismatch.
+
+    ps3_rebuild --serve=38008 -r game.ird JB_FOLDER &
+    tools/netsrv_client.py BLUS-12345.iso --port 38008
+"""
+
+import argparse
+import os
+import random
+import socket
+import struct
+import sys
+
+OPEN_FILE = 0x1224
+READ_FILE_CRITICAL = 0x1225
+READ_CD_2048 = 0x1226
+READ_FILE = 0x1227
+STAT_FILE = 0x1230
+
+SECTOR_SIZE = 0x800
+MAX_READ = 0x400000
+ISO_DIR = "/PS3ISO"
+
+
+class Client:
+    def __init__(self, host, port):
+        self.sock = socket.create_connection((host, port), timeout=30)
+
+    def close(self):
+        self.sock.close()
+
+    def recv_full(self, length):
+        data = bytearray()
+        while len(data) < length:
+            chunk = self.sock.recv(length - len(data))
+            if not chunk:
+                raise ConnectionError("server closed the connection")
+            data += chunk
+        return bytes(data)
+
+    def path_command(self, opcode, path):
+        raw = path.encode()
+        self.sock.sendall(struct.pack(">HH12x", opcode, len(raw)) + raw)
+
+    def stat(self, path):
+        self.path_command(STAT_FILE, path)
+        size, _, _, _, is_dir = struct.unpack(">QQQQB", self.recv_full(33))
+        return size, bool(is_dir)
+
+    def open(self, path):
+        self.path_command(OPEN_FILE, path)
+        size, _ = struct.unpack(">QQ", self.recv_full(16))
+        return size
+
+    def read_file(self, offset, length):
+        self.sock.sendall(struct.pack(">H2xIQ", READ_FILE, length, offset))
+        (obtained,) = struct.unpack(">I", self.recv_full(4))
+        if obtained == 0xFFFFFFFF:
+            raise IOError("READ_FILE failed at %d" % offset)
+        return self.recv_full(obtained)
+
+    def read_critical(self, offset, length):
+        self.sock.sendall(struct.pack(">H2xIQ", READ_FILE_CRITICAL, length, offset))
+        return self.recv_full(length)
+
+    def read_cd(self, sector, count):
+        self.sock.sendall(struct.pack(">H2xII4x", READ_CD_2048, sector, count))
+        return self.recv_full(count * SECTOR_SIZE)
+
+
+def expect(condition, message):
+    if not condition:
+        print("FAIL: " + message)
+        sys.exit(1)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("iso", help="local copy of the ISO being served")
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=38008)
+    parser.add_argument("--name", help="served ISO name (default: basename of iso)")
+    parser.add_argument("--reads", type=int, default=200, help="random reads per command")
+    parser.add_argument("--seed", type=int, default=0)
+    args = parser.parse_args()
+
+    with open(args.iso, "rb") as iso:
+        expected = iso.read()
+    size = len(expected)
+    path = "%s/%s" % (ISO_DIR, args.name or os.path.basename(args.iso))
+    rng = random.Random(args.seed)
+
+    client = Client(args.host, args.port)
+
+    expect(client.stat("/") == (0, True), "/ is not a folder")
+    expect(client.stat(path) == (size, False), "stat size of %s" % path)
+    expect(client.stat(ISO_DIR + "/missing.iso")[0] == 0xFFFFFFFFFFFFFFFF, "missing file was found")
+    expect(client.open(ISO_DIR + "/missing.iso") == 0xFFFFFFFFFFFFFFFF, "missing file was opened")
+    expect(client.open(path) == size, "open size of %s" % path)
+
+    for offset in range(0, size, 0x40000):
+        data = client.read_file(offset, 0x40000)
+        expect(data == expected[offset:offset + 0x40000], "sequential READ_FILE at %d" % offset)
+    print("sequential READ_FILE: %d bytes ok" % size)
+
+    for sector in range(0, size // SECTOR_SIZE, 64):
+        count = min(64, size // SECTOR_SIZE - sector)
+        data = client.read_cd(sector, count)
+        offset = sector * SECTOR_SIZE
+        expect(data == expected[offset:offset + count * SECTOR_SIZE], "sequential READ_CD_2048 at sector %d" % sector)
+    print("sequential READ_CD_2048: %d sectors ok" % (size // SECTOR_SIZE))
+
+    for _ in range(args.reads):
+        offset = rng.randrange(size)
+        length = rng.randrange(1, 0x20000)
+        data = client.read_file(offset, length)
+        expect(data == expected[offset:offset + length], "random READ_FILE %d+%d" % (offset, length))
+
+        length = min(length, size - offset)
+        data = client.read_critical(offset, length)
+        expect(data == expected[offset:offset + length], "random READ_FILE_CRITICAL %d+%d" % (offset, length))
+
+        sector = rng.randrange(size // SECTOR_SIZE)
+        count = rng.randrange(1, min(64, size // SECTOR_SIZE - sector) + 1)
+        data = client.read_cd(sector, count)
+        offset = sector * SECTOR_SIZE
+        expect(data == expected[offset:offset + count * SECTOR_SIZE], "random READ_CD_2048 at sector %d" % sector)
+    print("random reads: %d of each command ok" % args.reads)
+
+    data = client.read_file(size - 100, 0x1000)
+    expect(data == expected[size - 100:], "short READ_FILE at the end of the ISO")
+    client.close()
+
+    # A sector count that wraps in 32 bits must drop the connection
+    client = Client(args.host, args.port)
+    client.open(path)
+    client.sock.sendall(struct.pack(">H2xII4x", READ_CD_2048, 0, 0x200001))
+    try:
+        dropped = client.sock.recv(1) == b""
+    except ConnectionError:
+        dropped = True
+    expect(dropped, "oversized READ_CD_2048 was answered")
+    client.close()
+    print("oversized READ_CD_2048 rejected")
+
+    print("all reads match %s" % args.iso)
+
+
+if __name__ == "__main__":
+    main()